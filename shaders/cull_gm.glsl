@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in VS_OUT {
+	mat4 instanceMat;
+	flat int visible;
+} gs_in[];
+
+// captured by transform feedback
+out mat4 culledMat;
+
+void main() {
+	// only survivors are emitted, so the feedback buffer is compacted
+	if (gs_in[0].visible == 1) {
+		culledMat = gs_in[0].instanceMat;
+		EmitVertex();
+		EndPrimitive();
+	}
+}
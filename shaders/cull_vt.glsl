@@ -0,0 +1,42 @@
+#version 330 core
+
+// one point per instance
+layout (location = 0) in mat4 instanceMat;
+
+out VS_OUT {
+	mat4 instanceMat;
+	flat int visible;
+} vs_out;
+
+// world space, normal points inside
+uniform vec4 frustumPlanes[6];
+// bounding sphere of the model before instance transform
+uniform vec3 sphereCenter;
+uniform float sphereRadius;
+
+uniform vec3 viewPos;
+uniform float maxDistance;
+uniform float minScreenRadius;
+uniform float projectScale;
+
+void main() {
+	vec3 center = (instanceMat * vec4(sphereCenter, 1)).xyz;
+	float scale = max(length(instanceMat[0].xyz), max(length(instanceMat[1].xyz), length(instanceMat[2].xyz)));
+	float radius = sphereRadius * scale;
+
+	int visible = 1;
+	for (int i = 0; i < 6; i++) {
+		if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+			visible = 0;
+	}
+
+	float dist = length(center - viewPos);
+	if (dist - radius > maxDistance)
+		visible = 0;
+	// too small on screen
+	if (dist > radius && radius / dist * projectScale < minScreenRadius)
+		visible = 0;
+
+	vs_out.instanceMat = instanceMat;
+	vs_out.visible = visible;
+}
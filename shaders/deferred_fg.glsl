@@ -0,0 +1,106 @@
+#version 330 core
+
+// lighting pass of src/deferred.h, one light per draw, added to the framebuffer
+
+struct Light {
+	vec3 pos;
+	vec3 di;
+	vec3 color;
+
+	// point lights have a cone that always passes
+	float cutoffCos;
+	float cutoffStartCos;
+	float range;
+
+	bool shadowed;
+	mat4 shadowMat;
+	vec4 shadowRect;
+};
+// the light of this draw, set with Light::setupLight(shader, 0)
+uniform Light lights[1];
+uniform sampler2DShadow shadowAtlas;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 invViewProject;
+
+uniform vec3 viewPos;
+uniform vec3 ambient;
+uniform vec3 fog_color;
+// ambient light and fog instead of a light
+uniform bool ambientPass;
+
+out vec4 FragColor;
+
+// smooth window reaching 0 at the light range
+float rangeFade(float dist, float range) {
+	float ratio = dist / range;
+	float window = clamp(1 - ratio * ratio * ratio * ratio, 0, 1);
+	return window * window;
+}
+
+// same as fg.glsl, fraction of light reaching pos, 3x3 taps of 2x2 hardware pcf in the light's atlas tile
+float shadowFactor(mat4 shadowMat, vec4 shadowRect, vec3 pos) {
+	vec4 lightPos = shadowMat * vec4(pos, 1);
+	if (lightPos.w <= 0)
+		return 1.0;
+	lightPos.xyz /= lightPos.w;
+
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	float lit = 0;
+	for (int x = -1; x <= 1; x++) {
+		for (int y = -1; y <= 1; y++) {
+			vec2 uv = clamp(lightPos.xy + vec2(x, y) * texel, shadowRect.xy, shadowRect.zw);
+			lit += texture(shadowAtlas, vec3(uv, lightPos.z));
+		}
+	}
+	return lit / 9;
+}
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 normal = texelFetch(gNormal, texel, 0);
+	// no mesh on this pixel
+	if (normal.a == 0)
+		discard;
+
+	// world position from depth
+	vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+	float depth = texelFetch(gDepth, texel, 0).r;
+	vec4 world = invViewProject * vec4(vec3(uv, depth) * 2 - 1, 1);
+	vec3 pos = world.xyz / world.w;
+
+	vec3 albedo = texelFetch(gAlbedo, texel, 0).rgb;
+	// same fog as fg.glsl, lights are faded so their sum matches the forward path
+	float fogDense = clamp((length(pos)-10)/5, 0, 1);
+
+	if (ambientPass) {
+		FragColor = vec4(albedo * ambient * (1-fogDense) + fog_color * fogDense, 1);
+		return;
+	}
+
+	vec3 norm = normal.xyz;
+	vec3 viewVec = normalize(viewPos - pos);
+	vec3 lightVec = lights[0].pos - pos;
+	float dist = length(lightVec);
+	lightVec /= dist;
+	float cutoffFactor = (dot(-lightVec, lights[0].di) - lights[0].cutoffCos) / (lights[0].cutoffStartCos - lights[0].cutoffCos);
+	cutoffFactor = clamp(cutoffFactor, 0, 1) * rangeFade(dist, lights[0].range);
+	if (cutoffFactor <= 0)
+		discard;
+	if (lights[0].shadowed)
+		cutoffFactor *= shadowFactor(lights[0].shadowMat, lights[0].shadowRect, pos);
+
+	vec3 color = albedo * lights[0].color * (cutoffFactor * clamp(dot(lightVec, norm), 0, 1));
+
+	// specular color is premultiplied by its scale, shininess 0 means no specular
+	vec4 specular = texelFetch(gSpecular, texel, 0);
+	if (specular.a > 0) {
+		vec3 reflectVec = reflect(-lightVec, norm);
+		color += specular.rgb * lights[0].color * (cutoffFactor * pow(clamp(dot(reflectVec, viewVec), 0, 1), specular.a));
+	}
+
+	FragColor = vec4(color * (1-fogDense), 1);
+}
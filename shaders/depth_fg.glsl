@@ -0,0 +1,18 @@
+#version 330 core
+
+in vec2 uv;
+
+uniform bool alpha_test;
+uniform bool flip_y;
+uniform sampler2D diffuseTex;
+
+void main() {
+	// depth only, no color output
+	if (alpha_test) {
+		vec2 texCoord = uv;
+		if (flip_y)
+			texCoord.y = 1 - texCoord.y;
+		if (texture(diffuseTex, texCoord).a < 0.5)
+			discard;
+	}
+}
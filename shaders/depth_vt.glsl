@@ -0,0 +1,22 @@
+#version 330 core
+
+// position only stream, texture coordinates are bound for alpha tested meshes only
+layout (location = 0) in vec3 pos;
+layout (location = 2) in vec2 texCoord;
+layout (location = 3) in mat4 instanceMat;
+
+out vec2 uv;
+
+uniform mat4 modelMat;
+uniform mat4 nodeMat;
+uniform mat4 viewMat;
+uniform mat4 projectMat;
+
+// has to match vt.glsl exactly for the main pass depth test
+invariant gl_Position;
+
+void main() {
+	vec3 worldPos = (instanceMat * modelMat * nodeMat * vec4(pos, 1)).xyz;
+	gl_Position = projectMat * viewMat * vec4(worldPos, 1);
+	uv = texCoord;
+}
@@ -1,5 +1,18 @@
 #version 330 core
 
+// compile time features, inserted by ShaderPermutations:
+// HAS_DIFFUSE_TEX, HAS_SPEC_TEX: material has the texture
+// HAS_SPECULAR: shininess > 0
+// FLIP_Y: flip texture y axis
+// ALPHA_CUTOUT: discard low alpha instead of blending
+// OIT_PASS: write weighted blended oit targets, see src/oit.h
+// LIGHT_COUNT: number of lights in the uniform array, each draw loops over its meshLights only
+// CLUSTERED_LIGHTING: lights come from the cluster lists of src/clusteredLights.h instead
+// GBUFFER_PASS: write material and normal for src/deferred.h instead of lighting
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 0
+#endif
+
 in VS_OUT {
 	vec2 texCoord;
 	vec3 pos;
@@ -7,22 +20,56 @@ in VS_OUT {
 } vs_out;
 
 struct Light {
-	int type; // 1: spot light
-
 	vec3 pos;	
 	vec3 di;
 	vec3 color;
 
+	// point lights have a cone that always passes
 	float cutoffCos;
 	float cutoffStartCos;
+	float range;
+
+	// spotlight shadow in the atlas of src/shadowAtlas.h
+	bool shadowed;
+	mat4 shadowMat;
+	vec4 shadowRect;
 };
-// at most 10 lights
-uniform Light lights[10];
+#if LIGHT_COUNT > 0
+uniform Light lights[LIGHT_COUNT];
+uniform sampler2DShadow shadowAtlas;
+// lights that can reach the mesh, indices into lights, set per draw by Model::draw
+uniform int meshLightNum;
+uniform int meshLights[LIGHT_COUNT];
+#endif
+
+#ifdef CLUSTERED_LIGHTING
+// 3 texels per light: (pos, range), (di, cutoffCos), (color, cutoffStartCos)
+uniform samplerBuffer lightData;
+// per cluster (offset, count) into clusterLightIndices
+uniform usamplerBuffer clusterData;
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterTileSize;
+// slice = log(view depth) * scale + bias
+uniform float clusterZScale;
+uniform float clusterZBias;
+uniform float nearPlane;
+uniform float farPlane;
+#endif
 uniform vec3 ambient;
-uniform int lightNum;
 uniform vec3 viewPos;
 
-out vec4 FragColor;
+#ifdef GBUFFER_PASS
+layout (location = 0) out vec4 GAlbedo;
+// specular color * scale, shininess
+layout (location = 1) out vec4 GSpecular;
+// normal, 1 marks covered pixels
+layout (location = 2) out vec4 GNormal;
+#else
+layout (location = 0) out vec4 FragColor;
+// accumulated weight of the oit pass
+layout (location = 1) out vec4 OitWeight;
+#endif
 
 struct Material {
 	sampler2D tex_diffuse_texture;
@@ -37,22 +84,58 @@ struct Material {
 uniform Material mtl;
 
 uniform vec3 fog_color;
-uniform bool flip_y;
-
-vec4 readTexture(sampler2D sampler, vec2 texCoord, vec3 texColor) {
-	vec4 color;
-	if (textureSize(sampler, 0).x > 1) {
-		color = texture(sampler, texCoord);
-	} else {
-		color = vec4(1);
+
+// smooth window reaching 0 at the light range
+float rangeFade(float dist, float range) {
+	float ratio = dist / range;
+	float window = clamp(1 - ratio * ratio * ratio * ratio, 0, 1);
+	return window * window;
+}
+
+#if LIGHT_COUNT > 0
+// fraction of light reaching pos, 3x3 taps of 2x2 hardware pcf in the light's atlas tile
+float shadowFactor(mat4 shadowMat, vec4 shadowRect, vec3 pos) {
+	vec4 lightPos = shadowMat * vec4(pos, 1);
+	if (lightPos.w <= 0)
+		return 1.0;
+	lightPos.xyz /= lightPos.w;
+
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	float lit = 0;
+	for (int x = -1; x <= 1; x++) {
+		for (int y = -1; y <= 1; y++) {
+			vec2 uv = clamp(lightPos.xy + vec2(x, y) * texel, shadowRect.xy, shadowRect.zw);
+			lit += texture(shadowAtlas, vec3(uv, lightPos.z));
+		}
 	}
-	return color * vec4(texColor,1);
+	return lit / 9;
+}
+#endif
+
+void addLight(vec3 lightPos, vec3 lightDi, vec3 lightColor, float cutoffCos, float cutoffStartCos, float range,
+		vec3 norm, vec3 viewVec, inout vec3 diffuseLight, inout vec3 specularLight) {
+	// outside of the cone or range the factor is 0
+	vec3 lightVec = lightPos - vs_out.pos;
+	float dist = length(lightVec);
+	lightVec /= dist;
+	float cutoffFactor = (dot(-lightVec, lightDi) - cutoffCos) / (cutoffStartCos - cutoffCos);
+	cutoffFactor = clamp(cutoffFactor, 0, 1) * rangeFade(dist, range);
+
+	float diffLight = clamp(dot(lightVec, norm),0,1);
+	diffuseLight += lightColor * (cutoffFactor * diffLight);
+
+#ifdef HAS_SPECULAR
+	vec3 reflectVec = reflect(-lightVec, norm);
+	float specLight = pow(clamp(dot(reflectVec, viewVec),0,1), mtl.tex_spec_shininess) * mtl.tex_spec_scale;
+	specularLight += lightColor * (cutoffFactor * specLight);
+#endif
 }
 
 void main() {
 	vec2 texCoord = vs_out.texCoord;
-	if (flip_y)
-		texCoord.y = 1 - texCoord.y;
+#ifdef FLIP_Y
+	texCoord.y = 1 - texCoord.y;
+#endif
 
 	vec3 color = vec3(0,0,0);
 
@@ -63,41 +146,63 @@ void main() {
 	vec3 diffuseLight = ambient;
 	vec3 specularLight = vec3(0);
 
-	for (int i = 0; i<lightNum; i++) {
-		if (lights[i].type == 1) {
-			// spot light
-			vec3 lightVec = normalize(lights[i].pos - vs_out.pos);
-			float cutoffFactor = (dot(-lightVec, lights[i].di) - lights[i].cutoffCos) / (lights[i].cutoffStartCos - lights[i].cutoffCos);
-			cutoffFactor = clamp(cutoffFactor, 0, 1);
-
-			if (cutoffFactor != 0) {
-				vec3 reflectVec = reflect(-lightVec, norm);
-
-				float diffLight= clamp(dot(lightVec, norm),0,1);
-				float specLight;
-				if (mtl.tex_spec_shininess > 0) {
-					specLight = pow(clamp(dot(reflectVec, viewVec),0,1), mtl.tex_spec_shininess);
-					specLight *= mtl.tex_spec_scale;
-				} else {
-					specLight = 0;
-				}
-
-				diffLight = cutoffFactor * diffLight;
-				specLight = cutoffFactor * specLight;
-
-				diffuseLight += lights[i].color * diffLight;
-				specularLight += lights[i].color * specLight;
-			}
-		}
+#ifdef CLUSTERED_LIGHTING
+	// only the lights touching this fragment's cluster
+	float ndcDepth = gl_FragCoord.z * 2 - 1;
+	float viewDepth = 2 * nearPlane * farPlane / (farPlane + nearPlane - ndcDepth * (farPlane - nearPlane));
+	ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy / clusterTileSize), int(log(viewDepth) * clusterZScale + clusterZBias));
+	cluster = clamp(cluster, ivec3(0), clusterDims - 1);
+	uvec2 lightRange = texelFetch(clusterData, cluster.x + clusterDims.x * (cluster.y + clusterDims.y * cluster.z)).xy;
+
+	for (uint i = lightRange.x; i < lightRange.x + lightRange.y; i++) {
+		int light = int(texelFetch(clusterLightIndices, int(i)).r) * 3;
+		vec4 posRange = texelFetch(lightData, light);
+		vec4 diCutoff = texelFetch(lightData, light + 1);
+		vec4 colorCutoff = texelFetch(lightData, light + 2);
+		addLight(posRange.xyz, diCutoff.xyz, colorCutoff.rgb, diCutoff.w, colorCutoff.w, posRange.w,
+			norm, viewVec, diffuseLight, specularLight);
 	}
+#elif LIGHT_COUNT > 0
+	for (int i = 0; i < meshLightNum; i++) {
+		Light light = lights[meshLights[i]];
+		vec3 lightColor = light.color;
+		if (light.shadowed)
+			lightColor *= shadowFactor(light.shadowMat, light.shadowRect, vs_out.pos);
+		addLight(light.pos, light.di, lightColor, light.cutoffCos, light.cutoffStartCos, light.range,
+			norm, viewVec, diffuseLight, specularLight);
+	}
+#endif
 
 	// diffuse
-	vec4 diffuseColor = readTexture(mtl.tex_diffuse_texture, texCoord, mtl.tex_diffuse_color);
+#ifdef HAS_DIFFUSE_TEX
+	vec4 diffuseColor = texture(mtl.tex_diffuse_texture, texCoord) * vec4(mtl.tex_diffuse_color, 1);
+#else
+	vec4 diffuseColor = vec4(mtl.tex_diffuse_color, 1);
+#endif
+#ifdef ALPHA_CUTOUT
+	if (diffuseColor.a < 0.5)
+		discard;
+	diffuseColor.a = 1;
+#endif
 	color += diffuseColor.xyz * diffuseLight;
 
 	// specular
-	vec4 specColor = readTexture(mtl.tex_specular_texture, texCoord, mtl.tex_specular_color);
-	color += specColor.xyz * specularLight;
+#ifdef HAS_SPEC_TEX
+	vec3 specColor = texture(mtl.tex_specular_texture, texCoord).rgb * mtl.tex_specular_color;
+#else
+	vec3 specColor = mtl.tex_specular_color;
+#endif
+
+#ifdef GBUFFER_PASS
+	GAlbedo = vec4(diffuseColor.rgb, 1);
+#ifdef HAS_SPECULAR
+	GSpecular = vec4(specColor * mtl.tex_spec_scale, mtl.tex_spec_shininess);
+#else
+	GSpecular = vec4(0);
+#endif
+	GNormal = vec4(norm, 1);
+#else
+	color += specColor * specularLight;
 
 	// fog, clear 20, fade 20
 	float depth = length(vs_out.pos);
@@ -107,6 +212,13 @@ void main() {
 	// alpha, assume alpha is only decided by diffuse
 	float alpha = diffuseColor.a;
 
+#ifdef OIT_PASS
+	// favour surfaces close to the camera
+	float weight = clamp(alpha * max(1e-2, 3e3 * pow(1 - gl_FragCoord.z, 3)), 1e-2, 3e3);
+	FragColor = vec4(color * alpha * weight, alpha);
+	OitWeight = vec4(alpha * weight);
+#else
 	FragColor = vec4(color, alpha);
-	// FragColor = vec4(diffuseLight, 1);
-}
\ No newline at end of file
+#endif
+#endif
+}
@@ -0,0 +1,7 @@
+#version 330 core
+
+// full screen triangle, no vertex buffer
+void main() {
+	vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(pos * 2 - 1, 0, 1);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+// frame time graph of src/frameGraph.h, positions in pixels
+layout (location = 0) in vec2 pos;
+
+uniform mat4 projectMat;
+
+void main() {
+	gl_Position = projectMat * vec4(pos, 0, 1);
+}
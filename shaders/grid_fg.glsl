@@ -0,0 +1,102 @@
+#version 330 core
+
+in vec3 worldPos;
+
+struct Light {
+	vec3 pos;
+	vec3 di;
+	vec3 color;
+
+	// point lights have a cone that always passes
+	float cutoffCos;
+	float cutoffStartCos;
+	float range;
+
+	bool shadowed;
+	mat4 shadowMat;
+	vec4 shadowRect;
+};
+// at most 10 lights
+uniform Light lights[10];
+uniform sampler2DShadow shadowAtlas;
+uniform vec3 ambient;
+uniform int lightNum;
+uniform vec3 viewPos;
+
+uniform vec3 plainColor;
+uniform float lineInterval;
+uniform float lineWidth;
+uniform vec3 fog_color;
+
+out vec4 FragColor;
+
+// smooth window reaching 0 at the light range
+float rangeFade(float dist, float range) {
+	float ratio = dist / range;
+	float window = clamp(1 - ratio * ratio * ratio * ratio, 0, 1);
+	return window * window;
+}
+
+// same as fg.glsl, fraction of light reaching pos, 3x3 taps of 2x2 hardware pcf in the light's atlas tile
+float shadowFactor(mat4 shadowMat, vec4 shadowRect, vec3 pos) {
+	vec4 lightPos = shadowMat * vec4(pos, 1);
+	if (lightPos.w <= 0)
+		return 1.0;
+	lightPos.xyz /= lightPos.w;
+
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	float lit = 0;
+	for (int x = -1; x <= 1; x++) {
+		for (int y = -1; y <= 1; y++) {
+			vec2 uv = clamp(lightPos.xy + vec2(x, y) * texel, shadowRect.xy, shadowRect.zw);
+			lit += texture(shadowAtlas, vec3(uv, lightPos.z));
+		}
+	}
+	return lit / 9;
+}
+
+// coverage of the grid lines in this pixel, filtered by the screen space footprint
+float gridCoverage(vec2 coord) {
+	vec2 footprint = fwidth(coord);
+	vec2 lineDist = abs(fract(coord - 0.5) - 0.5);
+	float halfWidth = lineWidth / lineInterval / 2;
+
+	vec2 coverage = 1 - clamp((lineDist - halfWidth) / footprint + 0.5, 0, 1);
+	float line = max(coverage.x, coverage.y);
+
+	// once several lines fall into one pixel they average to their area
+	float density = clamp(max(footprint.x, footprint.y) - 0.5, 0, 1);
+	return mix(line, lineWidth / lineInterval, density);
+}
+
+void main() {
+	vec3 norm = vec3(0, 1, 0);
+	vec3 viewVec = normalize(viewPos - worldPos);
+
+	vec3 diffuseLight = ambient;
+	vec3 specularLight = vec3(0);
+	for (int i = 0; i < lightNum; i++) {
+		vec3 lightVec = lights[i].pos - worldPos;
+		float dist = length(lightVec);
+		lightVec /= dist;
+		float cutoffFactor = (dot(-lightVec, lights[i].di) - lights[i].cutoffCos) / (lights[i].cutoffStartCos - lights[i].cutoffCos);
+		cutoffFactor = clamp(cutoffFactor, 0, 1) * rangeFade(dist, lights[i].range);
+		if (lights[i].shadowed)
+			cutoffFactor *= shadowFactor(lights[i].shadowMat, lights[i].shadowRect, worldPos);
+
+		vec3 reflectVec = reflect(-lightVec, norm);
+		diffuseLight += lights[i].color * cutoffFactor * clamp(dot(lightVec, norm), 0, 1);
+		// default material: shininess 25, scale 1
+		specularLight += lights[i].color * cutoffFactor * pow(clamp(dot(reflectVec, viewVec), 0, 1), 25);
+	}
+
+	vec3 albedo = mix(plainColor, vec3(1), gridCoverage(worldPos.xz / lineInterval));
+	vec3 color = albedo * diffuseLight + specularLight;
+
+	// same fog as fg.glsl
+	float depth = length(worldPos);
+	float fogDense = clamp((depth-10)/5, 0, 1);
+	color = color * (1-fogDense) + fog_color * fogDense;
+
+	FragColor = vec4(color, 1);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+
+out vec3 worldPos;
+
+uniform float plainSize;
+uniform bool followView;
+uniform vec3 viewPos;
+uniform mat4 viewMat;
+uniform mat4 projectMat;
+
+// triangle strip facing +y
+const vec2 corners[4] = vec2[](vec2(-1, -1), vec2(-1, 1), vec2(1, -1), vec2(1, 1));
+
+void main() {
+	vec2 xz = corners[gl_VertexID] * plainSize;
+	if (followView)
+		xz += viewPos.xz;
+
+	worldPos = vec3(xz.x, 0, xz.y);
+	gl_Position = projectMat * viewMat * vec4(worldPos, 1);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+uniform sampler2D accumTex;
+uniform sampler2D weightTex;
+
+out vec4 FragColor;
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 accum = texelFetch(accumTex, texel, 0);
+	float revealage = accum.a;
+
+	// no translucent surface on this pixel
+	if (revealage >= 1)
+		discard;
+
+	float weight = texelFetch(weightTex, texel, 0).r;
+	vec3 average = accum.rgb / max(weight, 1e-5);
+
+	// blended with SRC_ALPHA, ONE_MINUS_SRC_ALPHA over the opaque image
+	FragColor = vec4(average, 1 - revealage);
+}
@@ -3,6 +3,8 @@
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 norm;
 layout (location = 2) in vec2 texCoord;
+// per instance transform, identity when the mesh is not instanced
+layout (location = 3) in mat4 instanceMat;
 
 out VS_OUT {
 	vec2 texCoord;
@@ -12,13 +14,18 @@ out VS_OUT {
 
 uniform vec3 viewPos;
 uniform mat4 modelMat;
+// transform of the node drawing the mesh, identity when the mesh is instanced over its nodes
+uniform mat4 nodeMat;
 uniform mat4 viewMat;
 uniform mat4 projectMat;
 
+// depth pre-pass computes the same position in depth_vt.glsl
+invariant gl_Position;
+
 void main() {
-	vs_out.pos = (modelMat * vec4(pos, 1)).xyz;
+	vs_out.pos = (instanceMat * modelMat * nodeMat * vec4(pos, 1)).xyz;
 	gl_Position = projectMat * viewMat * vec4(vs_out.pos, 1);
 	vs_out.texCoord = texCoord;
-	// norm is not changed
-	vs_out.norm = norm;
+	// model matrix only scales uniformly, instances and nodes may rotate
+	vs_out.norm = mat3(instanceMat) * mat3(nodeMat) * norm;
 }
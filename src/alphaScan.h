@@ -0,0 +1,60 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ALPHA_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "global.h"
+
+// alpha values in (ALPHA_PARTIAL_MIN, ALPHA_PARTIAL_MAX) count as partially transparent
+const int ALPHA_PARTIAL_MIN = 16;
+const int ALPHA_PARTIAL_MAX = 239;
+// cutout textures may have this share of soft edge texels
+const float ALPHA_CUTOUT_MAX_PARTIAL = 0.1f;
+
+// decide how a RGBA8 image has to be rendered from its alpha channel
+AlphaMode classifyAlpha(const unsigned char* rgba, int pixelCount) {
+	int minAlpha = 255;
+	long long partialCount = 0;
+	int i = 0;
+
+#ifdef ALPHA_SCAN_SSE2
+	// 4 pixels per register, alpha shifted down to the low byte of each 32 bit lane
+	__m128i minVec = _mm_set1_epi32(255);
+	__m128i partialVec = _mm_setzero_si128();
+	const __m128i partialMin = _mm_set1_epi32(ALPHA_PARTIAL_MIN);
+	const __m128i partialMax = _mm_set1_epi32(ALPHA_PARTIAL_MAX);
+
+	for (; i + 4 <= pixelCount; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+		__m128i alpha = _mm_srli_epi32(pixels, 24);
+		// alpha fits in 16 bits, so the 16 bit min works on the 32 bit lanes
+		minVec = _mm_min_epi16(minVec, alpha);
+		__m128i partial = _mm_and_si128(_mm_cmpgt_epi32(alpha, partialMin), _mm_cmplt_epi32(alpha, partialMax));
+		// true lanes are -1, a lane counts at most pixelCount / 4 so it can not overflow
+		partialVec = _mm_sub_epi32(partialVec, partial);
+	}
+
+	int lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, minVec);
+	for (int lane = 0; lane < 4; lane++) {
+		minAlpha = lanes[lane] < minAlpha ? lanes[lane] : minAlpha;
+	}
+	_mm_storeu_si128((__m128i*)lanes, partialVec);
+	partialCount += (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+	for (; i < pixelCount; i++) {
+		int alpha = rgba[i * 4 + 3];
+		minAlpha = alpha < minAlpha ? alpha : minAlpha;
+		if (alpha > ALPHA_PARTIAL_MIN && alpha < ALPHA_PARTIAL_MAX)
+			partialCount++;
+	}
+
+	if (minAlpha == 255)
+		return ALPHA_OPAQUE;
+	if (partialCount <= pixelCount * ALPHA_CUTOUT_MAX_PARTIAL)
+		return ALPHA_CUTOUT;
+	return ALPHA_BLEND;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+
+#include "camera.h"
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// camera pose at a point of a path, angles in degrees
+struct CameraKeyframe {
+	float time;
+	vec3 pos;
+	float heading;
+	float pitch;
+};
+
+// keyframes interpolated linearly, the path repeats after its last keyframe
+// file format: one "time x y z heading pitch" keyframe per line, # starts a comment
+class CameraPath {
+public:
+	vector<CameraKeyframe> keyframes;
+
+	bool load(const string& path) {
+		ifstream file(path);
+		if (!file) {
+			cout << "can not read camera path " << path << endl;
+			return false;
+		}
+
+		keyframes.clear();
+		string line;
+		while (getline(file, line)) {
+			if (line.empty() || line[0] == '#')
+				continue;
+			CameraKeyframe keyframe;
+			istringstream values(line);
+			if (values >> keyframe.time >> keyframe.pos.x >> keyframe.pos.y >> keyframe.pos.z >> keyframe.heading >> keyframe.pitch)
+				keyframes.push_back(keyframe);
+		}
+		if (keyframes.size() == 0) {
+			cout << "camera path " << path << " has no keyframes" << endl;
+			return false;
+		}
+		sort(keyframes.begin(), keyframes.end(), [](const CameraKeyframe& a, const CameraKeyframe& b) {
+			return a.time < b.time;
+		});
+		return true;
+	}
+
+	bool save(const string& path) {
+		ofstream file(path);
+		if (!file) {
+			cout << "can not write camera path " << path << endl;
+			return false;
+		}
+		file << "# time x y z heading pitch" << endl;
+		for (const CameraKeyframe& keyframe : keyframes) {
+			file << keyframe.time << " " << keyframe.pos.x << " " << keyframe.pos.y << " " << keyframe.pos.z << " "
+				<< keyframe.heading << " " << keyframe.pitch << endl;
+		}
+		return true;
+	}
+
+	// circle around the model on the floor, looking at its center
+	static CameraPath orbit(float radius = 15, float height = 5, float duration = 8) {
+		CameraPath path;
+		const int steps = 16;
+		for (int i = 0; i <= steps; i++) {
+			float angle = 360.0f * i / steps;
+			CameraKeyframe keyframe;
+			keyframe.time = duration * i / steps;
+			keyframe.pos = vec3(radius * sin(radians(angle)), height, radius * cos(radians(angle)));
+			// heading 0 looks along -z, so looking back at the origin is the angle itself
+			keyframe.heading = angle;
+			keyframe.pitch = degrees(atan2(-(height - 3), radius));
+			path.keyframes.push_back(keyframe);
+		}
+		return path;
+	}
+
+	float duration() {
+		return keyframes.back().time;
+	}
+
+	void apply(Camera* camera, float time) {
+		CameraKeyframe pose = sample(time);
+		camera->setPose(pose.pos, radians(pose.heading), radians(pose.pitch));
+	}
+
+	CameraKeyframe sample(float time) {
+		if (duration() > 0)
+			time = fmod(time, duration());
+		int next = 0;
+		while (next < keyframes.size() && keyframes[next].time <= time)
+			next++;
+		if (next == 0)
+			return keyframes[0];
+		if (next == keyframes.size())
+			return keyframes.back();
+
+		const CameraKeyframe& a = keyframes[next - 1];
+		const CameraKeyframe& b = keyframes[next];
+		float t = (time - a.time) / (b.time - a.time);
+		CameraKeyframe pose;
+		pose.time = time;
+		pose.pos = mix(a.pos, b.pos, t);
+		pose.heading = mix(a.heading, b.heading, t);
+		pose.pitch = mix(a.pitch, b.pitch, t);
+		return pose;
+	}
+};
+
+// appends the camera pose to a path at a fixed interval, for replaying a manual session
+class CameraPathRecorder {
+public:
+	CameraPathRecorder(float interval = 0.1f) {
+		this->interval = interval;
+	}
+
+	// time in seconds, the path starts at the first call
+	void update(Camera* camera, float time) {
+		if (path.keyframes.size() == 0)
+			startTime = time;
+		else if (time - startTime < nextTime)
+			return;
+		CameraKeyframe keyframe;
+		keyframe.time = time - startTime;
+		keyframe.pos = camera->getViewPos();
+		keyframe.heading = degrees(camera->getHeading());
+		keyframe.pitch = degrees(camera->getPitch());
+		path.keyframes.push_back(keyframe);
+		nextTime = keyframe.time + interval;
+	}
+
+	bool save(const string& path) {
+		return this->path.save(path);
+	}
+
+private:
+	CameraPath path;
+	float interval;
+	float startTime = 0;
+	float nextTime = 0;
+};
+
+// timings of one model along the path
+struct BenchmarkRun {
+	string model;
+	vector<float> cpuMs;
+	// -1 when the timer query was not available
+	vector<float> gpuMs;
+	// lighting path of the run and the lights it shades, timings of runs shading different
+	// counts do not compare
+	string lightingPath;
+	int shadedLights = 0;
+};
+
+// plays a camera path at a fixed timestep, so every run renders the same frames
+// regardless of how fast they are rendered
+class Benchmark {
+public:
+	Benchmark(CameraPath path, int frames, float timestep = 1.0f / 60, int warmupFrames = 10) {
+		this->path = path;
+		this->frames = frames;
+		this->timestep = timestep;
+		this->warmupFrames = warmupFrames;
+	}
+
+	// renderFrame draws one frame with the camera already placed, it has to finish the gpu work
+	// (glFinish or a blocking swap) so the timer query of the frame is ready in the next one
+	void run(const string& model, Camera* camera, function<void()> renderFrame) {
+		BenchmarkRun result;
+		result.model = model;
+
+		// one extra frame reports the gpu time of the last recorded one
+		for (int i = -warmupFrames; i <= frames; i++) {
+			path.apply(camera, glm::max(i, 0) * timestep);
+			renderFrame();
+
+			if (i > 0)
+				result.gpuMs.push_back(frameStats.lastGpuMs);
+			if (i >= 0 && i < frames)
+				result.cpuMs.push_back(frameStats.lastCpuMs);
+		}
+		result.lightingPath = frameStats.lightingPath;
+		result.shadedLights = frameStats.shadedLights;
+		runs.push_back(result);
+
+		cout << "benchmark " << model << ": cpu p50 " << percentile(result.cpuMs, 50) << " ms, gpu p50 "
+			<< percentile(result.gpuMs, 50) << " ms, " << result.shadedLights << " lights shaded " << result.lightingPath << endl;
+	}
+
+	bool writeJson(const string& jsonPath, const string& settings) {
+		FILE* file = fopen(jsonPath.c_str(), "w");
+		if (file == NULL) {
+			cout << "can not write " << jsonPath << endl;
+			return false;
+		}
+
+		fprintf(file, "{\n");
+		fprintf(file, "  \"renderer\": \"%s\",\n", jsonEscape((const char*)glGetString(GL_RENDERER)).c_str());
+		fprintf(file, "  \"version\": \"%s\",\n", jsonEscape((const char*)glGetString(GL_VERSION)).c_str());
+		fprintf(file, "  \"settings\": \"%s\",\n", jsonEscape(settings).c_str());
+		fprintf(file, "  \"frames\": %d,\n", frames);
+		fprintf(file, "  \"warmup_frames\": %d,\n", warmupFrames);
+		fprintf(file, "  \"timestep\": %g,\n", timestep);
+		fprintf(file, "  \"runs\": [\n");
+		for (int r = 0; r < runs.size(); r++) {
+			BenchmarkRun& run = runs[r];
+			fprintf(file, "    {\n");
+			fprintf(file, "      \"model\": \"%s\",\n", jsonEscape(run.model).c_str());
+			fprintf(file, "      \"lighting\": \"%s\",\n", run.lightingPath.c_str());
+			fprintf(file, "      \"shaded_lights\": %d,\n", run.shadedLights);
+			writeSummary(file, "cpu_ms", run.cpuMs);
+			writeSummary(file, "gpu_ms", run.gpuMs);
+			writeSeries(file, "cpu_frame_ms", run.cpuMs, true);
+			writeSeries(file, "gpu_frame_ms", run.gpuMs, false);
+			fprintf(file, "    }%s\n", r + 1 < runs.size() ? "," : "");
+		}
+		fprintf(file, "  ]\n}\n");
+		fclose(file);
+		return true;
+	}
+
+	// nearest rank percentile of the available samples, -1 when there is none
+	static float percentile(vector<float> values, float p) {
+		values.erase(remove_if(values.begin(), values.end(), [](float v) { return v < 0; }), values.end());
+		if (values.size() == 0)
+			return -1;
+		sort(values.begin(), values.end());
+		int rank = (int)ceil(p / 100 * values.size());
+		return values[glm::clamp(rank - 1, 0, (int)values.size() - 1)];
+	}
+
+private:
+	CameraPath path;
+	int frames;
+	float timestep;
+	int warmupFrames;
+	vector<BenchmarkRun> runs;
+
+	void writeSummary(FILE* file, const char* name, const vector<float>& values) {
+		fprintf(file, "      \"%s\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n", name,
+			percentile(values, 50), percentile(values, 95), percentile(values, 99), percentile(values, 100));
+	}
+
+	void writeSeries(FILE* file, const char* name, const vector<float>& values, bool more) {
+		fprintf(file, "      \"%s\": [", name);
+		for (int i = 0; i < values.size(); i++) {
+			fprintf(file, "%s%.4f", i > 0 ? ", " : "", values[i]);
+		}
+		fprintf(file, "]%s\n", more ? "," : "");
+	}
+};
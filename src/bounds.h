@@ -0,0 +1,161 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOUNDS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// model space box, and the sphere around the box center that encloses every vertex, which is
+// tighter than the one around the box
+struct Bounds {
+	vec3 min = vec3(numeric_limits<float>::max());
+	vec3 max = vec3(numeric_limits<float>::lowest());
+	float radius = 0;
+
+	bool isEmpty() const {
+		return min.x > max.x;
+	}
+
+	vec3 center() const {
+		return (min + max) / 2.0f;
+	}
+
+	// union of both, the sphere is the smaller of the one around the new box and the one
+	// around both spheres
+	void add(const Bounds& other) {
+		if (other.isEmpty())
+			return;
+		if (isEmpty()) {
+			*this = other;
+			return;
+		}
+		vec3 oldCenter = center();
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+		vec3 newCenter = center();
+		float around = glm::max(glm::length(oldCenter - newCenter) + radius, glm::length(other.center() - newCenter) + other.radius);
+		radius = glm::min(glm::length(max - min) / 2, around);
+	}
+};
+
+// bounds after an affine transform: the box around the transformed box, which is centered on
+// the transformed center, and the sphere grown by the largest axis scale
+Bounds transformBounds(const Bounds& bounds, const mat4& m) {
+	if (bounds.isEmpty())
+		return bounds;
+	vec3 center = vec3(m * vec4(bounds.center(), 1));
+	vec3 extent = (bounds.max - bounds.min) / 2.0f;
+	vec3 worldExtent;
+	for (int axis = 0; axis < 3; axis++) {
+		worldExtent[axis] = abs(m[0][axis]) * extent.x + abs(m[1][axis]) * extent.y + abs(m[2][axis]) * extent.z;
+	}
+	Bounds transformed;
+	transformed.min = center - worldExtent;
+	transformed.max = center + worldExtent;
+	float scale = glm::max(glm::length(vec3(m[0])), glm::max(glm::length(vec3(m[1])), glm::length(vec3(m[2]))));
+	transformed.radius = bounds.radius * scale;
+	return transformed;
+}
+
+// vertices per block of the reduction, blocks are reduced on the thread pool and their results
+// merged in order
+const int BOUNDS_BLOCK = 65536;
+
+// box of vertices [begin, end) of positions stride bytes apart, the float after each position
+// is read too and has to exist
+inline void reduceBox(const unsigned char* positions, size_t stride, int begin, int end, vec3& lo, vec3& hi) {
+	int i = begin;
+#ifdef BOUNDS_SSE2
+	// the 4th lane holds whatever follows the position and is ignored, two accumulators so
+	// consecutive vertices do not wait on each other
+	__m128 min0 = _mm_set1_ps(numeric_limits<float>::max());
+	__m128 max0 = _mm_set1_ps(numeric_limits<float>::lowest());
+	__m128 min1 = min0;
+	__m128 max1 = max0;
+	for (; i + 1 < end; i += 2) {
+		__m128 p0 = _mm_loadu_ps((const float*)(positions + stride * i));
+		__m128 p1 = _mm_loadu_ps((const float*)(positions + stride * (i + 1)));
+		min0 = _mm_min_ps(min0, p0);
+		max0 = _mm_max_ps(max0, p0);
+		min1 = _mm_min_ps(min1, p1);
+		max1 = _mm_max_ps(max1, p1);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_min_ps(min0, min1));
+	lo = glm::min(lo, vec3(lanes[0], lanes[1], lanes[2]));
+	_mm_storeu_ps(lanes, _mm_max_ps(max0, max1));
+	hi = glm::max(hi, vec3(lanes[0], lanes[1], lanes[2]));
+#endif
+	for (; i < end; i++) {
+		const vec3& p = *(const vec3*)(positions + stride * i);
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+}
+
+// largest squared distance of vertices [begin, end) to center
+inline float reduceRadius(const unsigned char* positions, size_t stride, int begin, int end, vec3 center) {
+	int i = begin;
+	float farthest = 0;
+#ifdef BOUNDS_SSE2
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 c = _mm_setr_ps(center.x, center.y, center.z, 0);
+	__m128 max0 = _mm_setzero_ps();
+	for (; i < end; i++) {
+		__m128 d = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps((const float*)(positions + stride * i)), c), xyzMask);
+		__m128 square = _mm_mul_ps(d, d);
+		square = _mm_add_ps(square, _mm_shuffle_ps(square, square, _MM_SHUFFLE(2, 3, 0, 1)));
+		square = _mm_add_ps(square, _mm_shuffle_ps(square, square, _MM_SHUFFLE(1, 0, 3, 2)));
+		max0 = _mm_max_ps(max0, square);
+	}
+	farthest = _mm_cvtss_f32(max0);
+#endif
+	for (; i < end; i++) {
+		vec3 d = *(const vec3*)(positions + stride * i) - center;
+		farthest = glm::max(farthest, dot(d, d));
+	}
+	return farthest;
+}
+
+// bounds of count positions stride bytes apart, such as Vertex::Position, two passes: the box,
+// then the radius around its center; a big mesh is split over the thread pool
+Bounds computePositionBounds(const void* positions, size_t stride, int count) {
+	TraceZone zone("computePositionBounds");
+	Bounds bounds;
+	if (count <= 0)
+		return bounds;
+	const unsigned char* p = (const unsigned char*)positions;
+
+	int blockNum = (count + BOUNDS_BLOCK - 1) / BOUNDS_BLOCK;
+	vector<Bounds> blocks(blockNum);
+	ThreadPool::instance().parallelFor(blockNum, [&, p](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			reduceBox(p, stride, b * BOUNDS_BLOCK, std::min(count, (b + 1) * BOUNDS_BLOCK), blocks[b].min, blocks[b].max);
+		}
+	}, 1);
+	for (const Bounds& block : blocks) {
+		bounds.add(block);
+	}
+
+	vec3 center = bounds.center();
+	vector<float> farthest(blockNum);
+	ThreadPool::instance().parallelFor(blockNum, [&, p](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			farthest[b] = reduceRadius(p, stride, b * BOUNDS_BLOCK, std::min(count, (b + 1) * BOUNDS_BLOCK), center);
+		}
+	}, 1);
+	bounds.radius = sqrt(*max_element(farthest.begin(), farthest.end()));
+	return bounds;
+}
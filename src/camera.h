@@ -29,6 +29,8 @@ private:
 	bool viewMatChanged = true;
 
 	// perspective projection
+	float nearPlane = 0.1f;
+	float farPlane = 100.0f;
 	float fov;
 	float aspectRatio;
 	glm::mat4 projectMat;
@@ -42,12 +44,28 @@ public:
 		// init projection matrix
 		this->fov = fov;
 		aspectRatio = (float)windowWidth / (float)windowHeight;
-		projectMat = glm::perspective(fov, aspectRatio, 0.1f, 100.0f);
+		projectMat = glm::perspective(fov, aspectRatio, nearPlane, farPlane);
 
 		// init view matrix
 		viewMat = glm::lookAt(cameraPos, cameraPos + cameraDir, glm::vec3(0, 1, 0));
 	};
 
+	float getFov() {
+		return fov;
+	}
+
+	float getAspectRatio() {
+		return aspectRatio;
+	}
+
+	float getNearPlane() {
+		return nearPlane;
+	}
+
+	float getFarPlane() {
+		return farPlane;
+	}
+
 	const glm::mat4& getProjectMat() {
 		return projectMat;
 	}
@@ -69,9 +87,51 @@ public:
 		return cameraDir;
 	}
 
+	// angles in radians, same convention as the mouse control
+	float getHeading() {
+		return cameraHeading;
+	}
+
+	float getPitch() {
+		return cameraPitch;
+	}
+
+	// place the camera directly, for scripted camera paths
+	void setPose(glm::vec3 pos, float heading, float pitch) {
+		cameraPos = pos;
+		cameraHeading = heading;
+		cameraPitch = pitch;
+		updateDir();
+	}
+
+	// frustum planes in world space as (normal, d), normal points inside
+	// order: left, right, bottom, top, near, far
+	void getFrustumPlanes(glm::vec4 planes[6]) {
+		glm::mat4 m = projectMat * getViewMat();
+		glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		planes[0] = row3 + row0;
+		planes[1] = row3 - row0;
+		planes[2] = row3 + row1;
+		planes[3] = row3 - row1;
+		planes[4] = row3 + row2;
+		planes[5] = row3 - row2;
+		for (int i = 0; i < 6; i++) {
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		}
+	}
+
+	// scale from view space size to ndc size at distance 1
+	float getProjectScale() {
+		return projectMat[1][1];
+	}
+
 	void windowSizeChanged(int newWindowWidth, int newWindowHeight) {
 		aspectRatio = (float)newWindowWidth / (float)newWindowHeight;
-		projectMat = glm::perspective(fov, aspectRatio, 0.1f, 100.0f);
+		projectMat = glm::perspective(fov, aspectRatio, nearPlane, farPlane);
 	}
 
 	void mouseCallBack(GLFWwindow* window, float xpos, float ypos) {
@@ -93,8 +153,7 @@ public:
 		lastMouseX = xpos;
 		lastMouseY = ypos;
 
-		cameraDir = glm::vec3(-cos(cameraPitch) * sin(cameraHeading), sin(cameraPitch), -cos(cameraPitch) * cos(cameraHeading));
-		viewMatChanged = true;
+		updateDir();
 	}
 
 	void keyboardCallBack(GLFWwindow* window) {
@@ -150,4 +209,10 @@ public:
 
 		lastKeyboardEventTime = curTime;
 	}
+
+private:
+	void updateDir() {
+		cameraDir = glm::vec3(-cos(cameraPitch) * sin(cameraHeading), sin(cameraPitch), -cos(cameraPitch) * cos(cameraHeading));
+		viewMatChanged = true;
+	}
 };
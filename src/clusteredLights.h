@@ -0,0 +1,320 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "camera.h"
+#include "shader.h"
+#include "light.h"
+#include "stats.h"
+#include "trace.h"
+#include "threadPool.h"
+
+using namespace std;
+using namespace glm;
+
+// clustered forward lighting: the view frustum is split into dimX x dimY screen tiles
+// and dimZ exponential depth slices, every cluster gets the list of lights touching it,
+// and shaders/fg.glsl (CLUSTERED_LIGHTING) only loops over the list of its cluster
+class LightClusters {
+public:
+	LightClusters(int dimX = 16, int dimY = 9, int dimZ = 24) {
+		this->dimX = dimX;
+		this->dimY = dimY;
+		this->dimZ = dimZ;
+		// cluster groups of 4 must not cross a slice
+		tilesPerSlice = dimX * dimY;
+		paddedTiles = (tilesPerSlice + 3) / 4 * 4;
+		clusterLights.resize(dimX * dimY * dimZ);
+
+		glGenBuffers(3, buffers);
+		glGenTextures(3, textures);
+		GLenum formats[] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+		for (int i = 0; i < 3; i++) {
+			glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+			bufferSizes[i] = 16;
+			frameStats.bufferBytes += 16;
+			glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// assign lights to clusters and upload the lists, textures stay bound on units 2-4
+	void update(LightSet* lightSet, Camera* camera) {
+		TraceZone zone("LightClusters::update");
+		CpuTimer timer;
+		timer.begin();
+
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] != width || viewport[3] != height || camera->getFov() != fov || camera->getAspectRatio() != aspect)
+			buildClusterBounds(camera, viewport[2], viewport[3]);
+
+		prepareLights(lightSet, camera->getViewMat());
+
+		// slices are independent, each one writes only its own cluster lists
+		ThreadPool::instance().parallelFor(dimZ, [this](int begin, int end) {
+			for (int z = begin; z < end; z++) {
+				assignSlice(z);
+			}
+		}, 1);
+
+		flattenLists();
+		upload(lightSet);
+
+		frameStats.lightCullMs = timer.end();
+	}
+
+	// per frame uniforms of a CLUSTERED_LIGHTING variant
+	void setupShader(Shader* shader) {
+		shader->setInt("lightData", 2);
+		shader->setInt("clusterData", 3);
+		shader->setInt("clusterLightIndices", 4);
+		int location = glGetUniformLocation(shader->ID, "clusterDims");
+		glUniform3i(location, dimX, dimY, dimZ);
+		location = glGetUniformLocation(shader->ID, "clusterTileSize");
+		glUniform2f(location, (float)width / dimX, (float)height / dimY);
+		shader->setFloat("clusterZScale", dimZ / log(farPlane / nearPlane));
+		shader->setFloat("clusterZBias", -dimZ * log(nearPlane) / log(farPlane / nearPlane));
+		shader->setFloat("nearPlane", nearPlane);
+		shader->setFloat("farPlane", farPlane);
+	}
+
+private:
+	int dimX, dimY, dimZ;
+	int tilesPerSlice, paddedTiles;
+
+	// projection the bounds were built for
+	int width = 0, height = 0;
+	float fov = 0, aspect = 0;
+	float nearPlane, farPlane;
+
+	// view space cluster bounds, SoA, slice after slice, each slice padded to a multiple of 4
+	vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	vector<float> centerX, centerY, centerZ, radius;
+	// view depth range of each slice
+	vector<float> sliceNear, sliceFar;
+
+	// lights of this frame in view space
+	struct ViewLight {
+		vec3 pos;
+		vec3 di;
+		float range;
+		bool spot;
+		float cosAngle, sinAngle;
+	};
+	vector<ViewLight> viewLights;
+
+	vector<vector<unsigned int>> clusterLights;
+	vector<unsigned int> clusterData;
+	vector<unsigned int> lightIndices;
+	vector<vec4> lightData;
+
+	unsigned int buffers[3];
+	unsigned int textures[3];
+	// for the memory stats
+	size_t bufferSizes[3];
+
+	void buildClusterBounds(Camera* camera, int width, int height) {
+		this->width = width;
+		this->height = height;
+		fov = camera->getFov();
+		aspect = camera->getAspectRatio();
+		nearPlane = camera->getNearPlane();
+		farPlane = camera->getFarPlane();
+
+		int count = paddedTiles * dimZ;
+		for (vector<float>* values : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ, &centerX, &centerY, &centerZ, &radius }) {
+			// padding clusters are empty and far away, they never pass a test
+			values->assign(count, 1e30f);
+		}
+		sliceNear.resize(dimZ);
+		sliceFar.resize(dimZ);
+
+		float tanY = tan(fov / 2);
+		float tanX = tanY * aspect;
+		for (int z = 0; z < dimZ; z++) {
+			float dNear = nearPlane * pow(farPlane / nearPlane, (float)z / dimZ);
+			float dFar = nearPlane * pow(farPlane / nearPlane, (float)(z + 1) / dimZ);
+			sliceNear[z] = dNear;
+			sliceFar[z] = dFar;
+
+			for (int y = 0; y < dimY; y++) {
+				for (int x = 0; x < dimX; x++) {
+					float ndcX0 = -1 + 2.0f * x / dimX, ndcX1 = -1 + 2.0f * (x + 1) / dimX;
+					float ndcY0 = -1 + 2.0f * y / dimY, ndcY1 = -1 + 2.0f * (y + 1) / dimY;
+
+					vec3 lo = vec3(1e30f), hi = vec3(-1e30f);
+					for (float d : { dNear, dFar }) {
+						for (float ndcX : { ndcX0, ndcX1 }) {
+							for (float ndcY : { ndcY0, ndcY1 }) {
+								vec3 corner = vec3(ndcX * tanX * d, ndcY * tanY * d, -d);
+								lo = glm::min(lo, corner);
+								hi = glm::max(hi, corner);
+							}
+						}
+					}
+
+					int i = z * paddedTiles + y * dimX + x;
+					minX[i] = lo.x; minY[i] = lo.y; minZ[i] = lo.z;
+					maxX[i] = hi.x; maxY[i] = hi.y; maxZ[i] = hi.z;
+					vec3 center = (lo + hi) / 2.0f;
+					centerX[i] = center.x; centerY[i] = center.y; centerZ[i] = center.z;
+					radius[i] = length(hi - lo) / 2;
+				}
+			}
+		}
+	}
+
+	void prepareLights(LightSet* lightSet, const mat4& viewMat) {
+		const vector<Light>& lights = lightSet->getLights();
+		viewLights.resize(lights.size());
+		for (int i = 0; i < lights.size(); i++) {
+			const Light& light = lights[i];
+			ViewLight& viewLight = viewLights[i];
+			viewLight.pos = vec3(viewMat * vec4(light.getPos(), 1));
+			viewLight.di = normalize(mat3(viewMat) * light.getDi());
+			viewLight.range = light.getRange();
+			viewLight.spot = light.isSpotlight();
+			viewLight.cosAngle = glm::clamp(light.getCutoffCos(), -1.0f, 1.0f);
+			viewLight.sinAngle = sqrt(1 - viewLight.cosAngle * viewLight.cosAngle);
+		}
+	}
+
+	void assignSlice(int z) {
+		int sliceStart = z * paddedTiles;
+		for (int i = 0; i < tilesPerSlice; i++) {
+			clusterLights[z * tilesPerSlice + i].clear();
+		}
+
+		for (int l = 0; l < viewLights.size(); l++) {
+			const ViewLight& light = viewLights[l];
+			// depth range of the light sphere against the slice
+			float depth = -light.pos.z;
+			if (depth + light.range < sliceNear[z] || depth - light.range > sliceFar[z])
+				continue;
+
+			for (int g = 0; g < paddedTiles; g += 4) {
+				int mask = testClusters(light, sliceStart + g);
+				for (int lane = 0; lane < 4; lane++) {
+					if ((mask & (1 << lane)) && g + lane < tilesPerSlice)
+						clusterLights[z * tilesPerSlice + g + lane].push_back(l);
+				}
+			}
+		}
+	}
+
+	// bit per cluster of the 4 clusters starting at i that the light touches
+	int testClusters(const ViewLight& light, int i) {
+#ifdef CLUSTER_SSE2
+		// sphere against box: squared distance from the light to the box within range
+		__m128 zero = _mm_setzero_ps();
+		__m128 distSq = zero;
+		const float* mins[] = { &minX[i], &minY[i], &minZ[i] };
+		const float* maxs[] = { &maxX[i], &maxY[i], &maxZ[i] };
+		float pos[] = { light.pos.x, light.pos.y, light.pos.z };
+		for (int axis = 0; axis < 3; axis++) {
+			__m128 p = _mm_set1_ps(pos[axis]);
+			__m128 below = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(mins[axis]), p), zero);
+			__m128 above = _mm_max_ps(_mm_sub_ps(p, _mm_loadu_ps(maxs[axis])), zero);
+			__m128 d = _mm_add_ps(below, above);
+			distSq = _mm_add_ps(distSq, _mm_mul_ps(d, d));
+		}
+		__m128 rangeSq = _mm_set1_ps(light.range * light.range);
+		__m128 inside = _mm_cmple_ps(distSq, rangeSq);
+
+		if (light.spot) {
+			// cone against the cluster bounding sphere
+			__m128 vx = _mm_sub_ps(_mm_loadu_ps(&centerX[i]), _mm_set1_ps(light.pos.x));
+			__m128 vy = _mm_sub_ps(_mm_loadu_ps(&centerY[i]), _mm_set1_ps(light.pos.y));
+			__m128 vz = _mm_sub_ps(_mm_loadu_ps(&centerZ[i]), _mm_set1_ps(light.pos.z));
+			__m128 r = _mm_loadu_ps(&radius[i]);
+			__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+			__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(light.di.x)), _mm_mul_ps(vy, _mm_set1_ps(light.di.y))),
+				_mm_mul_ps(vz, _mm_set1_ps(light.di.z)));
+			__m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lenSq, _mm_mul_ps(along, along)), zero));
+			// distance from the sphere center to the cone surface
+			__m128 coneDist = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(light.cosAngle), across), _mm_mul_ps(along, _mm_set1_ps(light.sinAngle)));
+			__m128 outsideCone = _mm_cmpgt_ps(coneDist, r);
+			__m128 behind = _mm_cmplt_ps(along, _mm_sub_ps(zero, r));
+			inside = _mm_andnot_ps(_mm_or_ps(outsideCone, behind), inside);
+		}
+		return _mm_movemask_ps(inside);
+#else
+		int mask = 0;
+		for (int lane = 0; lane < 4; lane++) {
+			int c = i + lane;
+			vec3 lo = vec3(minX[c], minY[c], minZ[c]);
+			vec3 hi = vec3(maxX[c], maxY[c], maxZ[c]);
+			vec3 d = glm::max(lo - light.pos, vec3(0)) + glm::max(light.pos - hi, vec3(0));
+			bool inside = dot(d, d) <= light.range * light.range;
+
+			if (inside && light.spot) {
+				vec3 v = vec3(centerX[c], centerY[c], centerZ[c]) - light.pos;
+				float along = dot(v, light.di);
+				float across = sqrt(glm::max(dot(v, v) - along * along, 0.0f));
+				float coneDist = light.cosAngle * across - along * light.sinAngle;
+				inside = !(coneDist > radius[c] || along < -radius[c]);
+			}
+			if (inside)
+				mask |= 1 << lane;
+		}
+		return mask;
+#endif
+	}
+
+	void flattenLists() {
+		clusterData.resize(clusterLights.size() * 2);
+		lightIndices.clear();
+		for (int c = 0; c < clusterLights.size(); c++) {
+			clusterData[c * 2] = lightIndices.size();
+			clusterData[c * 2 + 1] = clusterLights[c].size();
+			lightIndices.insert(lightIndices.end(), clusterLights[c].begin(), clusterLights[c].end());
+		}
+		frameStats.lightRefs = lightIndices.size();
+		// texture buffers can not be empty
+		if (lightIndices.empty())
+			lightIndices.push_back(0);
+	}
+
+	void upload(LightSet* lightSet) {
+		const vector<Light>& lights = lightSet->getLights();
+		lightData.resize(glm::max((int)lights.size(), 1) * 3);
+		for (int i = 0; i < lights.size(); i++) {
+			const Light& light = lights[i];
+			lightData[i * 3] = vec4(light.getPos(), light.getRange());
+			lightData[i * 3 + 1] = vec4(light.getDi(), light.getCutoffCos());
+			lightData[i * 3 + 2] = vec4(light.getColor(), light.getCutoffStartCos());
+		}
+
+		uploadBuffer(0, &lightData[0], sizeof(vec4) * lightData.size());
+		uploadBuffer(1, &clusterData[0], sizeof(unsigned int) * clusterData.size());
+		uploadBuffer(2, &lightIndices[0], sizeof(unsigned int) * lightIndices.size());
+
+		for (int i = 0; i < 3; i++) {
+			glActiveTexture(GL_TEXTURE2 + i);
+			glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void uploadBuffer(int index, const void* data, size_t size) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[index]);
+		// new storage each frame, the previous frame may still read the old one
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		frameStats.bufferBytes += (long long)size - (long long)bufferSizes[index];
+		bufferSizes[index] = size;
+	}
+};
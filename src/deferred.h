@@ -0,0 +1,237 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <limits>
+#include <iostream>
+
+#include "camera.h"
+#include "shader.h"
+#include "light.h"
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// deferred shading: opaque and cutout meshes write their material and normal into a
+// G-buffer once (GBUFFER_PASS variant of fg.glsl), then every light shades only the
+// pixels inside the screen rectangle of its range with additive blending
+//
+// targets: albedo RGBA8, specular color * scale and shininess RGBA16F,
+// normal RGBA16F (alpha 1 where a mesh was written), depth DEPTH24_STENCIL8
+class DeferredRenderer {
+public:
+	DeferredRenderer() {
+		lightShader = new Shader("shaders/fullscreen_vt.glsl", "shaders/deferred_fg.glsl");
+		glGenVertexArrays(1, &quadVAO);
+	}
+
+	~DeferredRenderer() {
+		releaseTargets();
+		glDeleteVertexArrays(1, &quadVAO);
+		glDeleteProgram(lightShader->ID);
+		delete lightShader;
+	}
+
+	// redirect drawing into the G-buffer, depth is copied from the current framebuffer
+	// so what is already drawn there still occludes
+	void beginGeometry() {
+		// before createTargets, which leaves framebuffer 0 bound
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] != width || viewport[3] != height)
+			createTargets(viewport[2], viewport[3]);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, targetFBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		float zero[] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 3; i++) {
+			glClearBufferfv(GL_COLOR, i, zero);
+		}
+	}
+
+	// shade the G-buffer into the framebuffer bound in beginGeometry, its depth is
+	// updated for the forward passes drawn afterwards
+	void light(LightSet* lights, Camera* camera, vec3 fogColor) {
+		TraceZone zone("DeferredRenderer::light");
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+
+		GLboolean depthMask;
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+
+		lightShader->use();
+		unsigned int textures[] = { albedoTex, specularTex, normalTex, depthTex };
+		const char* names[] = { "gAlbedo", "gSpecular", "gNormal", "gDepth" };
+		for (int i = 0; i < 4; i++) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			lightShader->setInt(names[i], i);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		lightShader->setInt("shadowAtlas", SHADOW_TEX_UNIT);
+		lightShader->setMat4("invViewProject", inverse(camera->getProjectMat() * camera->getViewMat()));
+		lightShader->setVec3("viewPos", camera->getViewPos());
+		lightShader->setVec3("fog_color", fogColor);
+		lightShader->setVec3("ambient", lights->getAmbient());
+		glBindVertexArray(quadVAO);
+
+		// ambient and fog, over the whole screen; replaces what the framebuffer holds under the
+		// meshes and keeps the rest, since pixels without a mesh are discarded
+		glDisable(GL_BLEND);
+		lightShader->setBool("ambientPass", true);
+		drawQuad();
+
+		// one scissored quad per light, added on top
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		lightShader->setBool("ambientPass", false);
+		glEnable(GL_SCISSOR_TEST);
+		CpuTimer timer;
+		for (int i = 0; i < lights->size(); i++) {
+			Light& light = lights->getLight(i);
+			timer.begin();
+			ivec4 rect;
+			bool visible = lightRect(light, camera, rect);
+			frameStats.lightCullMs += timer.end();
+			if (!visible)
+				continue;
+
+			glScissor(rect.x, rect.y, rect.z, rect.w);
+			light.setupLight(lightShader, 0);
+			drawQuad();
+			frameStats.lightRefs++;
+		}
+		glDisable(GL_SCISSOR_TEST);
+
+		glBindVertexArray(0);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDisable(GL_BLEND);
+		glDepthMask(depthMask);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+private:
+	Shader* lightShader;
+	unsigned int quadVAO;
+
+	unsigned int FBO = 0;
+	unsigned int albedoTex = 0;
+	unsigned int specularTex = 0;
+	unsigned int normalTex = 0;
+	unsigned int depthTex = 0;
+	int width = 0;
+	int height = 0;
+
+	// framebuffer the lights are added to
+	int targetFBO = 0;
+
+	void drawQuad() {
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		frameStats.addDraw(1);
+	}
+
+	// pixel rectangle (x, y, width, height) covering the light's range, false when it is off screen
+	bool lightRect(const Light& light, Camera* camera, ivec4& rect) {
+		vec3 center = light.getPos();
+		float radius = glm::min(light.getRange(), camera->getFarPlane());
+
+		vec4 planes[6];
+		camera->getFrustumPlanes(planes);
+		for (int i = 0; i < 6; i++) {
+			if (dot(vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		}
+
+		// projected corners of the box around the sphere, whole screen once the box reaches behind the camera
+		mat4 viewProject = camera->getProjectMat() * camera->getViewMat();
+		vec2 lo = vec2(numeric_limits<float>::max());
+		vec2 hi = vec2(numeric_limits<float>::lowest());
+		for (int i = 0; i < 8; i++) {
+			vec3 corner = center + radius * vec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+			vec4 clip = viewProject * vec4(corner, 1);
+			if (clip.w <= camera->getNearPlane()) {
+				rect = ivec4(0, 0, width, height);
+				return true;
+			}
+			vec2 ndc = vec2(clip) / clip.w;
+			lo = glm::min(lo, ndc);
+			hi = glm::max(hi, ndc);
+		}
+
+		lo = glm::clamp(lo, vec2(-1), vec2(1));
+		hi = glm::clamp(hi, vec2(-1), vec2(1));
+		if (lo.x >= hi.x || lo.y >= hi.y)
+			return false;
+
+		vec2 screen = vec2(width, height);
+		ivec2 start = ivec2(floor((lo * 0.5f + 0.5f) * screen));
+		ivec2 end = ivec2(ceil((hi * 0.5f + 0.5f) * screen));
+		rect = ivec4(start, end - start);
+		return true;
+	}
+
+	void createTargets(int width, int height) {
+		releaseTargets();
+		this->width = width;
+		this->height = height;
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		albedoTex = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTex, 0);
+		specularTex = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, specularTex, 0);
+		normalTex = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, normalTex, 0);
+
+		// same format as the default framebuffer, required by the depth blits
+		depthTex = createTexture(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+
+		unsigned int drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, drawBuffers);
+		frameStats.textureBytes += targetMemory();
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			cout << "g-buffer framebuffer is not complete" << endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	unsigned int createTexture(GLenum internalFormat, GLenum format, GLenum type) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return texture;
+	}
+
+	// albedo 4, specular 8, normal 8 and depth 4 bytes per pixel
+	long long targetMemory() {
+		return textureMemory(width, height, 4 + 8 + 8 + 4);
+	}
+
+	void releaseTargets() {
+		if (FBO == 0)
+			return;
+		glDeleteFramebuffers(1, &FBO);
+		unsigned int textures[] = { albedoTex, specularTex, normalTex, depthTex };
+		glDeleteTextures(4, textures);
+		frameStats.textureBytes -= targetMemory();
+		FBO = 0;
+	}
+};
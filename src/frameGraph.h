@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+
+#include "shader.h"
+#include "stats.h"
+
+using namespace std;
+using namespace glm;
+
+// rolling graph of the frame time history in frameStats, cpu in white and gpu in green
+// the gray line marks a 60 fps frame, the scale grows in steps of it
+class FrameGraph {
+public:
+	FrameGraph() {
+		shader = new Shader("shaders/graph_vt.glsl", "shaders/graph_fg.glsl");
+
+		glGenVertexArrays(1, &VAO);
+		glBindVertexArray(VAO);
+		glGenBuffers(1, &VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	~FrameGraph() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteProgram(shader->ID);
+		delete shader;
+	}
+
+	// top left corner and size in pixels, y goes down as in gltext
+	void draw(float x, float y, float width, float height) {
+		const int historySize = FrameStats::HISTORY_SIZE;
+		float maxMs = 0;
+		for (int i = 0; i < historySize; i++) {
+			maxMs = glm::max(maxMs, glm::max(frameStats.cpuHistory[i], frameStats.gpuHistory[i]));
+		}
+		float scaleMs = FRAME_MS * glm::max(ceil(maxMs / FRAME_MS), 1.0f);
+
+		// background strip, 60 fps line, then the cpu and gpu series oldest first
+		vertices.clear();
+		vertices.push_back(vec2(x, y));
+		vertices.push_back(vec2(x, y + height));
+		vertices.push_back(vec2(x + width, y));
+		vertices.push_back(vec2(x + width, y + height));
+		float frameY = y + height * (1 - FRAME_MS / scaleMs);
+		vertices.push_back(vec2(x, frameY));
+		vertices.push_back(vec2(x + width, frameY));
+		for (const float* history : { frameStats.cpuHistory, frameStats.gpuHistory }) {
+			for (int i = 0; i < historySize; i++) {
+				float ms = history[(frameStats.historyPos + i) % historySize];
+				vertices.push_back(vec2(x + width * i / (historySize - 1), y + height * (1 - ms / scaleMs)));
+			}
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * vertices.size(), &vertices[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		shader->use();
+		shader->setMat4("projectMat", glm::ortho(0.0f, (float)viewport[2], (float)viewport[3], 0.0f));
+
+		// flipping y turns the background around, so face culling is off too
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glEnable(GL_BLEND);
+		glBindVertexArray(VAO);
+
+		shader->setVec4("color", vec4(0, 0, 0, 0.5f));
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		shader->setVec4("color", vec4(0.5f, 0.5f, 0.5f, 1));
+		glDrawArrays(GL_LINES, 4, 2);
+		shader->setVec4("color", vec4(1));
+		glDrawArrays(GL_LINE_STRIP, 6, historySize);
+		shader->setVec4("color", vec4(0.3f, 1, 0.3f, 1));
+		glDrawArrays(GL_LINE_STRIP, 6 + historySize, historySize);
+
+		glBindVertexArray(0);
+		glDisable(GL_BLEND);
+		glEnable(GL_CULL_FACE);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+private:
+	const float FRAME_MS = 1000.0f / 60;
+
+	Shader* shader;
+	unsigned int VAO;
+	unsigned int VBO;
+	vector<vec2> vertices;
+};
@@ -7,9 +7,17 @@ using namespace glm;
 
 unsigned int EMPTY_TEX = 1;
 
+// how a material is rendered, decided by the alpha of its diffuse texture
+enum AlphaMode {
+	ALPHA_OPAQUE,	// blending off
+	ALPHA_CUTOUT,	// alpha tested with discard
+	ALPHA_BLEND,	// blended after everything else
+};
+
 struct Material {
 	unsigned int diffuse_texture = EMPTY_TEX;
 	vec3 diffuse_color = vec3(1);
+	AlphaMode alpha_mode = ALPHA_OPAQUE;
 
 	unsigned int specular_texture = EMPTY_TEX;
 	vec3 specular_color = vec3(1); 
@@ -0,0 +1,763 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <iostream>
+
+#include "mappedFile.h"
+#include "mesh.h"
+#include "nodeTree.h"
+#include "global.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// parsed json document, as much as gltf needs: numbers are doubles and objects keep their
+// keys in order, a missing key or index gives a null value
+class JsonValue {
+public:
+	enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+	Type type = JSON_NULL;
+	// also 0 or 1 for bools
+	double number = 0;
+	string text;
+	// array elements, or object values in the order of keys
+	vector<JsonValue> items;
+	vector<string> keys;
+
+	const JsonValue& operator[](const char* key) const {
+		for (int i = 0; i < keys.size(); i++) {
+			if (keys[i] == key)
+				return items[i];
+		}
+		return null();
+	}
+
+	const JsonValue& operator[](int index) const {
+		if (type != JSON_ARRAY || index < 0 || index >= items.size())
+			return null();
+		return items[index];
+	}
+
+	bool isNull() const {
+		return type == JSON_NULL;
+	}
+
+	int size() const {
+		return type == JSON_ARRAY ? items.size() : 0;
+	}
+
+	double asNumber(double fallback = 0) const {
+		return type == JSON_NUMBER || type == JSON_BOOL ? number : fallback;
+	}
+
+	int asInt(int fallback = -1) const {
+		return type == JSON_NUMBER ? (int)number : fallback;
+	}
+
+	bool asBool(bool fallback = false) const {
+		return type == JSON_BOOL ? number != 0 : fallback;
+	}
+
+	const string& asString() const {
+		return text;
+	}
+
+	// false on a syntax error
+	static bool parse(const string& json, JsonValue& root) {
+		const char* cursor = json.c_str();
+		if (!parseValue(cursor, root, 0))
+			return false;
+		skipSpace(cursor);
+		return *cursor == 0;
+	}
+
+private:
+	static const JsonValue& null() {
+		static const JsonValue value;
+		return value;
+	}
+
+	static void skipSpace(const char*& cursor) {
+		while (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')
+			cursor++;
+	}
+
+	static bool parseValue(const char*& cursor, JsonValue& value, int depth) {
+		// gltf nests a few levels, anything deeper is not worth the stack
+		if (depth > 64)
+			return false;
+		skipSpace(cursor);
+		switch (*cursor) {
+		case '{': {
+			value.type = JSON_OBJECT;
+			cursor++;
+			skipSpace(cursor);
+			if (*cursor == '}') {
+				cursor++;
+				return true;
+			}
+			while (true) {
+				skipSpace(cursor);
+				string key;
+				if (*cursor != '"' || !parseString(cursor, key))
+					return false;
+				skipSpace(cursor);
+				if (*cursor++ != ':')
+					return false;
+				value.keys.push_back(key);
+				value.items.push_back(JsonValue());
+				if (!parseValue(cursor, value.items.back(), depth + 1))
+					return false;
+				skipSpace(cursor);
+				if (*cursor == ',') {
+					cursor++;
+					continue;
+				}
+				return *cursor++ == '}';
+			}
+		}
+		case '[': {
+			value.type = JSON_ARRAY;
+			cursor++;
+			skipSpace(cursor);
+			if (*cursor == ']') {
+				cursor++;
+				return true;
+			}
+			while (true) {
+				value.items.push_back(JsonValue());
+				if (!parseValue(cursor, value.items.back(), depth + 1))
+					return false;
+				skipSpace(cursor);
+				if (*cursor == ',') {
+					cursor++;
+					continue;
+				}
+				return *cursor++ == ']';
+			}
+		}
+		case '"':
+			value.type = JSON_STRING;
+			return parseString(cursor, value.text);
+		case 't':
+			value.type = JSON_BOOL;
+			value.number = 1;
+			return parseWord(cursor, "true");
+		case 'f':
+			value.type = JSON_BOOL;
+			return parseWord(cursor, "false");
+		case 'n':
+			return parseWord(cursor, "null");
+		default: {
+			char* end;
+			value.type = JSON_NUMBER;
+			value.number = strtod(cursor, &end);
+			if (end == cursor)
+				return false;
+			cursor = end;
+			return true;
+		}
+		}
+	}
+
+	static bool parseWord(const char*& cursor, const char* word) {
+		size_t length = strlen(word);
+		if (strncmp(cursor, word, length) != 0)
+			return false;
+		cursor += length;
+		return true;
+	}
+
+	// cursor on the opening quote, \u escapes are written as utf-8
+	static bool parseString(const char*& cursor, string& text) {
+		cursor++;
+		while (*cursor != '"') {
+			if (*cursor == 0)
+				return false;
+			if (*cursor != '\\') {
+				text += *cursor++;
+				continue;
+			}
+			cursor++;
+			char escaped = *cursor++;
+			switch (escaped) {
+			case 'b': text += '\b'; break;
+			case 'f': text += '\f'; break;
+			case 'n': text += '\n'; break;
+			case 'r': text += '\r'; break;
+			case 't': text += '\t'; break;
+			case 'u': {
+				unsigned int code = 0;
+				for (int i = 0; i < 4; i++) {
+					char c = *cursor++;
+					code <<= 4;
+					if (c >= '0' && c <= '9')
+						code |= c - '0';
+					else if (c >= 'a' && c <= 'f')
+						code |= c - 'a' + 10;
+					else if (c >= 'A' && c <= 'F')
+						code |= c - 'A' + 10;
+					else
+						return false;
+				}
+				if (code < 0x80) {
+					text += (char)code;
+				}
+				else if (code < 0x800) {
+					text += (char)(0xc0 | (code >> 6));
+					text += (char)(0x80 | (code & 0x3f));
+				}
+				else {
+					text += (char)(0xe0 | (code >> 12));
+					text += (char)(0x80 | ((code >> 6) & 0x3f));
+					text += (char)(0x80 | (code & 0x3f));
+				}
+				break;
+			}
+			case 0:
+				return false;
+			default:
+				// \" \\ and \/
+				text += escaped;
+			}
+		}
+		cursor++;
+		return true;
+	}
+};
+
+// metallic roughness material of a gltf file
+struct GlbMaterial {
+	vec4 baseColor = vec4(1);
+	// index into GlbLoader::images, -1 when not textured
+	int baseColorImage = -1;
+	float metallic = 1;
+	float roughness = 1;
+	AlphaMode alphaMode = ALPHA_OPAQUE;
+};
+
+// encoded image, either inside the binary chunk or a file next to the model
+struct GlbImage {
+	const unsigned char* data = NULL;
+	size_t bytes = 0;
+	// relative file name when data is NULL
+	string uri;
+};
+
+// one triangle primitive, its buffers are ranges of the mapped file
+struct GlbPrimitive {
+	string name;
+	// index into GlbLoader::materials, -1 for the default material
+	int material = -1;
+	RawMeshData raw;
+	// only for primitives without indices, or decoded ones
+	vector<unsigned int> indices;
+	// decoded on the cpu instead of raw when the file has no normals, they are generated
+	vector<Vertex> vertices;
+	bool hasTexCoords = false;
+	// the gltf mesh it belongs to, for GlbLoader::meshNodes
+	int mesh = -1;
+};
+
+// .glb reader: the json chunk is parsed, the accessors of every triangle primitive are
+// resolved to byte ranges of the binary chunk which Mesh uploads as they are, so nothing
+// is converted on the cpu and the mapped file has to stay open until the meshes are set up
+// primitives without normals are the exception, they are decoded to get normals generated
+// every mesh is read once, the nodes of the scene go into nodeTree and those drawing each
+// mesh into meshNodes
+class GlbLoader {
+public:
+	vector<GlbPrimitive> primitives;
+	NodeTree nodeTree;
+	// nodes of nodeTree drawing each gltf mesh, by mesh index
+	vector<vector<int>> meshNodes;
+	vector<GlbMaterial> materials;
+	vector<GlbImage> images;
+
+	// false when the file can not be read or uses what the loader does not handle
+	// (external or sparse buffers), assimp takes those
+	bool load(const string& path) {
+		TraceZone zone("GlbLoader::load", path.c_str());
+		if (!file.open(path)) {
+			cout << "can not read " << path << endl;
+			return false;
+		}
+		const unsigned char* data = (const unsigned char*)file.getData();
+		size_t size = file.getSize();
+
+		// 12 byte header, then chunks of length, type and data
+		if (size < 20 || readUint(data) != 0x46546C67 || readUint(data + 4) != 2) {
+			cout << path << " is not a glb 2.0 file" << endl;
+			return false;
+		}
+		size_t length = glm::min((size_t)readUint(data + 8), size);
+		size_t jsonBytes = readUint(data + 12);
+		if (readUint(data + 16) != 0x4E4F534A || 20 + jsonBytes > length) {
+			cout << path << " has no json chunk" << endl;
+			return false;
+		}
+		size_t binStart = 20 + ((jsonBytes + 3) & ~(size_t)3);
+		if (binStart + 8 <= length && readUint(data + binStart + 4) == 0x004E4942) {
+			bin = data + binStart + 8;
+			binBytes = glm::min((size_t)readUint(data + binStart), length - binStart - 8);
+		}
+
+		JsonValue root;
+		{
+			TraceZone jsonZone("GlbLoader::parseJson");
+			if (!JsonValue::parse(string((const char*)data + 20, jsonBytes), root)) {
+				cout << path << " has invalid json" << endl;
+				return false;
+			}
+		}
+
+		const JsonValue& buffers = root["buffers"];
+		for (int i = 0; i < buffers.size(); i++) {
+			if (i > 0 || !buffers[i]["uri"].isNull()) {
+				cout << path << " refers to external buffers" << endl;
+				return false;
+			}
+		}
+		const JsonValue& views = root["bufferViews"];
+		for (int i = 0; i < views.size(); i++) {
+			BufferView view;
+			view.offset = (size_t)views[i]["byteOffset"].asNumber();
+			view.bytes = (size_t)views[i]["byteLength"].asNumber();
+			view.stride = views[i]["byteStride"].asInt(0);
+			if (views[i]["buffer"].asInt() != 0 || bin == NULL || view.offset + view.bytes > binBytes) {
+				cout << path << " has a buffer view outside of its binary chunk" << endl;
+				return false;
+			}
+			bufferViews.push_back(view);
+		}
+
+		readImages(root);
+		readMaterials(root);
+		if (!readMeshes(root)) {
+			cout << path << " has accessors the glb reader does not handle" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	size_t getFileSize() {
+		return file.getSize();
+	}
+
+private:
+	struct BufferView {
+		size_t offset;
+		size_t bytes;
+		// 0 when tightly packed
+		int stride;
+	};
+
+	// byte range of an accessor in the binary chunk
+	struct Accessor {
+		size_t start;
+		size_t bytes;
+		int stride;
+		int components;
+		GLenum type;
+		bool normalized;
+		int count;
+	};
+
+	MappedFile file;
+	const unsigned char* bin = NULL;
+	size_t binBytes = 0;
+	vector<BufferView> bufferViews;
+
+	static unsigned int readUint(const unsigned char* p) {
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+	}
+
+	void readImages(const JsonValue& root) {
+		const JsonValue& jsonImages = root["images"];
+		for (int i = 0; i < jsonImages.size(); i++) {
+			GlbImage image;
+			int view = jsonImages[i]["bufferView"].asInt();
+			if (view >= 0 && view < bufferViews.size()) {
+				image.data = bin + bufferViews[view].offset;
+				image.bytes = bufferViews[view].bytes;
+			}
+			else {
+				image.uri = jsonImages[i]["uri"].asString();
+			}
+			images.push_back(image);
+		}
+	}
+
+	void readMaterials(const JsonValue& root) {
+		const JsonValue& textures = root["textures"];
+		const JsonValue& jsonMaterials = root["materials"];
+		for (int i = 0; i < jsonMaterials.size(); i++) {
+			const JsonValue& jsonMaterial = jsonMaterials[i];
+			const JsonValue& pbr = jsonMaterial["pbrMetallicRoughness"];
+			GlbMaterial material;
+			const JsonValue& factor = pbr["baseColorFactor"];
+			for (int c = 0; c < 4 && c < factor.size(); c++) {
+				material.baseColor[c] = (float)factor[c].asNumber(1);
+			}
+			int texture = pbr["baseColorTexture"]["index"].asInt();
+			int image = textures[texture]["source"].asInt();
+			if (image >= 0 && image < (int)images.size())
+				material.baseColorImage = image;
+			material.metallic = (float)pbr["metallicFactor"].asNumber(1);
+			material.roughness = (float)pbr["roughnessFactor"].asNumber(1);
+
+			const string& alphaMode = jsonMaterial["alphaMode"].asString();
+			if (alphaMode == "MASK")
+				material.alphaMode = ALPHA_CUTOUT;
+			else if (alphaMode == "BLEND")
+				material.alphaMode = ALPHA_BLEND;
+			materials.push_back(material);
+		}
+	}
+
+	// meshes in the order the nodes of the scene reach them, each one once
+	bool readMeshes(const JsonValue& root) {
+		const JsonValue& nodes = root["nodes"];
+		const JsonValue& meshes = root["meshes"];
+		vector<int> order;
+		vector<bool> taken(meshes.size(), false);
+		meshNodes.assign(meshes.size(), vector<int>());
+
+		// depth first with the parent in nodeTree, a node visited twice is a broken file and
+		// stops the walk
+		const JsonValue& scene = root["scenes"][root["scene"].asInt(0)];
+		vector<pair<int, int>> stack;
+		for (int i = scene["nodes"].size() - 1; i >= 0; i--) {
+			stack.push_back(make_pair(scene["nodes"][i].asInt(), -1));
+		}
+		vector<bool> visited(nodes.size(), false);
+		while (!stack.empty()) {
+			int node = stack.back().first;
+			int parent = stack.back().second;
+			stack.pop_back();
+			if (node < 0 || node >= nodes.size() || visited[node])
+				continue;
+			visited[node] = true;
+			int treeNode = nodeTree.addNode(parent, nodeTransform(nodes[node]));
+			int mesh = nodes[node]["mesh"].asInt();
+			if (mesh >= 0 && mesh < meshes.size()) {
+				if (!taken[mesh]) {
+					taken[mesh] = true;
+					order.push_back(mesh);
+				}
+				meshNodes[mesh].push_back(treeNode);
+			}
+			const JsonValue& children = nodes[node]["children"];
+			for (int i = children.size() - 1; i >= 0; i--) {
+				stack.push_back(make_pair(children[i].asInt(), treeNode));
+			}
+		}
+		// files without a scene still show their meshes
+		if (scene.isNull()) {
+			for (int i = 0; i < meshes.size(); i++) {
+				order.push_back(i);
+			}
+		}
+
+		const JsonValue& accessors = root["accessors"];
+		for (int mesh : order) {
+			const JsonValue& jsonPrimitives = meshes[mesh]["primitives"];
+			for (int i = 0; i < jsonPrimitives.size(); i++) {
+				const JsonValue& jsonPrimitive = jsonPrimitives[i];
+				// 4 is triangles, points and lines are not drawn by the viewer
+				if (jsonPrimitive["mode"].asInt(4) != 4)
+					continue;
+				GlbPrimitive primitive;
+				primitive.name = meshes[mesh]["name"].asString();
+				primitive.mesh = mesh;
+				primitive.material = jsonPrimitive["material"].asInt();
+				if (primitive.material >= (int)materials.size())
+					primitive.material = -1;
+				if (!readPrimitive(accessors, jsonPrimitive, primitive))
+					return false;
+				primitives.push_back(move(primitive));
+			}
+		}
+		return true;
+	}
+
+	// matrix, or translation, rotation and scale applied in this order from the right
+	static mat4 nodeTransform(const JsonValue& node) {
+		const JsonValue& matrix = node["matrix"];
+		if (matrix.size() == 16) {
+			// column major like glm
+			mat4 m;
+			for (int i = 0; i < 16; i++) {
+				m[i / 4][i % 4] = (float)matrix[i].asNumber();
+			}
+			return m;
+		}
+		mat4 m = mat4(1);
+		const JsonValue& translation = node["translation"];
+		if (translation.size() == 3)
+			m = glm::translate(m, vec3(translation[0].asNumber(), translation[1].asNumber(), translation[2].asNumber()));
+		const JsonValue& rotation = node["rotation"];
+		if (rotation.size() == 4)
+			m = m * glm::mat4_cast(glm::quat((float)rotation[3].asNumber(), (float)rotation[0].asNumber(), (float)rotation[1].asNumber(), (float)rotation[2].asNumber()));
+		const JsonValue& scale = node["scale"];
+		if (scale.size() == 3)
+			m = glm::scale(m, vec3(scale[0].asNumber(), scale[1].asNumber(), scale[2].asNumber()));
+		return m;
+	}
+
+	bool readPrimitive(const JsonValue& accessors, const JsonValue& jsonPrimitive, GlbPrimitive& primitive) {
+		const JsonValue& attributes = jsonPrimitive["attributes"];
+		const char* names[4] = { "POSITION", "NORMAL", "TEXCOORD_0", "TANGENT" };
+		Accessor used[4];
+		bool present[4] = {};
+		for (int i = 0; i < 4; i++) {
+			const JsonValue& index = attributes[names[i]];
+			if (index.isNull())
+				continue;
+			if (!readAccessor(accessors[index.asInt()], used[i]))
+				return false;
+			present[i] = true;
+		}
+		// positions are required to be float vec3 and to have their bounds in min and max
+		const JsonValue& positionAccessor = accessors[attributes["POSITION"].asInt()];
+		if (!present[0] || used[0].type != GL_FLOAT || used[0].components != 3)
+			return false;
+		RawMeshData& raw = primitive.raw;
+		raw.vertexCount = used[0].count;
+		for (int i = 1; i < 4; i++) {
+			// attributes with fewer vertices would read past their range
+			if (present[i] && used[i].count < raw.vertexCount)
+				present[i] = false;
+		}
+		// tangents carry the bitangent sign in w
+		if (present[3] && used[3].components != 4)
+			present[3] = false;
+		if (!present[1])
+			return decodePrimitive(accessors, jsonPrimitive, used, present[2] && used[2].components == 2, primitive);
+		readBounds(positionAccessor, used[0], raw);
+
+		// ranges of the attributes, merged where they overlap (interleaved buffers) and packed
+		// one after another at 4 byte alignment
+		vector<pair<size_t, size_t>> ranges;
+		for (int i = 0; i < 4; i++) {
+			if (present[i])
+				ranges.push_back(make_pair(used[i].start, used[i].start + used[i].bytes));
+		}
+		sort(ranges.begin(), ranges.end());
+		for (auto& range : ranges) {
+			if (!raw.vertexRanges.empty()) {
+				RawRange& last = raw.vertexRanges.back();
+				size_t lastStart = last.data - bin;
+				if (range.first < lastStart + last.bytes) {
+					last.bytes = glm::max(last.bytes, range.second - lastStart);
+					continue;
+				}
+				raw.vertexBytes = (last.offset + last.bytes + 3) & ~(size_t)3;
+			}
+			RawRange packed;
+			packed.data = bin + range.first;
+			packed.bytes = range.second - range.first;
+			packed.offset = raw.vertexBytes;
+			raw.vertexRanges.push_back(packed);
+		}
+		raw.vertexBytes = raw.vertexRanges.back().offset + raw.vertexRanges.back().bytes;
+		for (int i = 0; i < 4; i++) {
+			if (!present[i])
+				continue;
+			for (const RawRange& range : raw.vertexRanges) {
+				size_t rangeStart = range.data - bin;
+				if (used[i].start >= rangeStart && used[i].start < rangeStart + range.bytes) {
+					RawAttribute& attribute = raw.attributes[i];
+					attribute.offset = range.offset + (used[i].start - rangeStart);
+					attribute.stride = used[i].stride;
+					attribute.components = used[i].components;
+					attribute.type = used[i].type;
+					attribute.normalized = used[i].normalized;
+				}
+			}
+		}
+
+		const JsonValue& indices = jsonPrimitive["indices"];
+		if (indices.isNull()) {
+			primitive.indices.resize(raw.vertexCount);
+			for (int i = 0; i < raw.vertexCount; i++) {
+				primitive.indices[i] = i;
+			}
+			return true;
+		}
+		Accessor index;
+		if (!readAccessor(accessors[indices.asInt()], index) || index.components != 1 || index.type == GL_FLOAT)
+			return false;
+		// index buffers are tightly packed by the spec
+		if (index.stride != componentSize(index.type))
+			return false;
+		raw.indexData = bin + index.start;
+		raw.indexType = index.type;
+		raw.indexCount = index.count;
+		return true;
+	}
+
+	// vertices and indices of a primitive without normals, for normals.h; the tangents of the file
+	// are dropped since the spec has them ignored without normals
+	bool decodePrimitive(const JsonValue& accessors, const JsonValue& jsonPrimitive, const Accessor* used, bool hasTexCoords, GlbPrimitive& primitive) {
+		int count = used[0].count;
+		primitive.hasTexCoords = hasTexCoords;
+		primitive.vertices.resize(count);
+		for (int i = 0; i < count; i++) {
+			Vertex& vertex = primitive.vertices[i];
+			readElement(used[0], i, &vertex.Position.x);
+			vertex.Normal = vec3(0);
+			vertex.TexCoord = vec2(0);
+			if (hasTexCoords)
+				readElement(used[2], i, &vertex.TexCoord.x);
+		}
+
+		const JsonValue& indices = jsonPrimitive["indices"];
+		if (indices.isNull()) {
+			primitive.indices.resize(count);
+			for (int i = 0; i < count; i++) {
+				primitive.indices[i] = i;
+			}
+			return true;
+		}
+		Accessor index;
+		if (!readAccessor(accessors[indices.asInt()], index) || index.components != 1 || index.type == GL_FLOAT)
+			return false;
+		primitive.indices.resize(index.count);
+		for (int i = 0; i < index.count; i++) {
+			const unsigned char* p = bin + index.start + (size_t)index.stride * i;
+			unsigned int value;
+			if (index.type == GL_UNSIGNED_INT)
+				value = readUint(p);
+			else if (index.type == GL_UNSIGNED_SHORT)
+				value = p[0] | (p[1] << 8);
+			else
+				value = p[0];
+			// the normals are generated from the indices, they have to stay in range
+			if (value >= (unsigned int)count)
+				return false;
+			primitive.indices[i] = value;
+		}
+		return true;
+	}
+
+	// element i of an accessor as floats, normalized integers are scaled to 0..1 or -1..1
+	void readElement(const Accessor& accessor, int i, float* out) {
+		const unsigned char* p = bin + accessor.start + (size_t)accessor.stride * i;
+		for (int c = 0; c < accessor.components; c++) {
+			float value;
+			switch (accessor.type) {
+			case GL_FLOAT:
+				memcpy(&value, p + c * 4, 4);
+				break;
+			case GL_UNSIGNED_BYTE:
+				value = accessor.normalized ? p[c] / 255.0f : p[c];
+				break;
+			case GL_BYTE:
+				value = accessor.normalized ? glm::max((signed char)p[c] / 127.0f, -1.0f) : (signed char)p[c];
+				break;
+			case GL_UNSIGNED_SHORT: {
+				unsigned short v;
+				memcpy(&v, p + c * 2, 2);
+				value = accessor.normalized ? v / 65535.0f : v;
+				break;
+			}
+			case GL_SHORT: {
+				short v;
+				memcpy(&v, p + c * 2, 2);
+				value = accessor.normalized ? glm::max(v / 32767.0f, -1.0f) : v;
+				break;
+			}
+			default:
+				value = (float)readUint(p + c * 4);
+			}
+			out[c] = value;
+		}
+	}
+
+	bool readAccessor(const JsonValue& accessor, Accessor& result) {
+		int view = accessor["bufferView"].asInt();
+		// accessors without a view are all zeros, they and sparse ones are left to assimp
+		if (view < 0 || view >= bufferViews.size() || !accessor["sparse"].isNull())
+			return false;
+
+		const string& type = accessor["type"].asString();
+		if (type == "SCALAR")
+			result.components = 1;
+		else if (type == "VEC2")
+			result.components = 2;
+		else if (type == "VEC3")
+			result.components = 3;
+		else if (type == "VEC4")
+			result.components = 4;
+		else
+			return false;
+		// gltf component types are the gl enums
+		result.type = (GLenum)accessor["componentType"].asInt(0);
+		int size = componentSize(result.type);
+		if (size == 0)
+			return false;
+		result.normalized = accessor["normalized"].asBool();
+		result.count = accessor["count"].asInt(0);
+		if (result.count <= 0)
+			return false;
+
+		const BufferView& bufferView = bufferViews[view];
+		int elementSize = size * result.components;
+		result.stride = bufferView.stride > 0 ? bufferView.stride : elementSize;
+		result.start = bufferView.offset + (size_t)accessor["byteOffset"].asNumber();
+		result.bytes = (size_t)result.stride * (result.count - 1) + elementSize;
+		return result.start + result.bytes <= bufferView.offset + bufferView.bytes;
+	}
+
+	static int componentSize(GLenum type) {
+		switch (type) {
+		case GL_BYTE:
+		case GL_UNSIGNED_BYTE:
+			return 1;
+		case GL_SHORT:
+		case GL_UNSIGNED_SHORT:
+			return 2;
+		case GL_UNSIGNED_INT:
+		case GL_FLOAT:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	// min and max are required for positions, files without them get their positions scanned
+	void readBounds(const JsonValue& accessor, const Accessor& position, RawMeshData& raw) {
+		const JsonValue& min = accessor["min"];
+		const JsonValue& max = accessor["max"];
+		if (min.size() == 3 && max.size() == 3) {
+			for (int i = 0; i < 3; i++) {
+				raw.boundMin[i] = (float)min[i].asNumber();
+				raw.boundMax[i] = (float)max[i].asNumber();
+			}
+			return;
+		}
+
+		raw.boundMin = vec3(numeric_limits<float>::max());
+		raw.boundMax = vec3(numeric_limits<float>::lowest());
+		for (int i = 0; i < position.count; i++) {
+			vec3 p;
+			memcpy(&p, bin + position.start + (size_t)position.stride * i, sizeof(vec3));
+			raw.boundMin = glm::min(raw.boundMin, p);
+			raw.boundMax = glm::max(raw.boundMax, p);
+		}
+	}
+};
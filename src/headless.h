@@ -0,0 +1,230 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "stats.h"
+
+// offscreen GL 3.3 core context for machines without a display, one backend is picked at build time:
+// OMV_HEADLESS_EGL: libEGL, Mesa surfaceless platform (llvmpipe on cpu only machines) or the default device
+// OMV_HEADLESS_OSMESA: libOSMesa
+#if defined(OMV_HEADLESS_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#ifndef EGL_NO_CONFIG_KHR
+#define EGL_NO_CONFIG_KHR ((EGLConfig)0)
+#endif
+#elif defined(OMV_HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+using namespace std;
+
+class HeadlessContext {
+public:
+	// false when no backend is built in or the context can not be created
+	bool create(int width, int height) {
+		if (width <= 0 || height <= 0) {
+			cout << "headless context size " << width << "x" << height << " is empty" << endl;
+			return false;
+		}
+#if defined(OMV_HEADLESS_EGL)
+		display = EGL_NO_DISPLAY;
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay != NULL)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major, minor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			cout << "egl display initialization failed" << endl;
+			return false;
+		}
+
+		// the surfaceless platform has no configs, contexts are then created without one
+		const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config = EGL_NO_CONFIG_KHR;
+		EGLint configNum = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &configNum) || configNum == 0)
+			config = EGL_NO_CONFIG_KHR;
+
+		eglBindAPI(EGL_OPENGL_API);
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+			EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		// no surface, everything is drawn into an OffscreenTarget
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			cout << "egl opengl 3.3 core context creation failed" << endl;
+			return false;
+		}
+		return true;
+#elif defined(OMV_HEADLESS_OSMESA)
+		const int attribs[] = {
+			OSMESA_FORMAT, OSMESA_RGBA,
+			OSMESA_DEPTH_BITS, 24,
+			OSMESA_STENCIL_BITS, 8,
+			OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+			OSMESA_CONTEXT_MAJOR_VERSION, 3,
+			OSMESA_CONTEXT_MINOR_VERSION, 3,
+			0
+		};
+		context = OSMesaCreateContextAttribs(attribs, NULL);
+		buffer.resize((size_t)width * height * 4);
+		if (context == NULL || !OSMesaMakeCurrent(context, &buffer[0], GL_UNSIGNED_BYTE, width, height)) {
+			cout << "osmesa opengl 3.3 core context creation failed" << endl;
+			return false;
+		}
+		return true;
+#else
+		cout << "headless rendering is not built in, define OMV_HEADLESS_EGL or OMV_HEADLESS_OSMESA" << endl;
+		return false;
+#endif
+	}
+
+	// for gladLoadGLLoader and ProgramBinaryCache::init
+	GLADloadproc getProcLoader() {
+		return loadProc;
+	}
+
+	void destroy() {
+#if defined(OMV_HEADLESS_EGL)
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+#elif defined(OMV_HEADLESS_OSMESA)
+		if (context != NULL)
+			OSMesaDestroyContext(context);
+		context = NULL;
+#endif
+	}
+
+private:
+#if defined(OMV_HEADLESS_EGL)
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#elif defined(OMV_HEADLESS_OSMESA)
+	OSMesaContext context = NULL;
+	// default framebuffer of the context, not drawn to
+	vector<unsigned char> buffer;
+#endif
+
+	static void* loadProc(const char* name) {
+#if defined(OMV_HEADLESS_EGL)
+		return (void*)eglGetProcAddress(name);
+#elif defined(OMV_HEADLESS_OSMESA)
+		return (void*)OSMesaGetProcAddress(name);
+#else
+		(void)name;
+		return NULL;
+#endif
+	}
+};
+
+// framebuffer standing in for the window, same formats as a default framebuffer so
+// the depth blits of OitTarget and DeferredRenderer keep working
+class OffscreenTarget {
+public:
+	OffscreenTarget(int width, int height) {
+		this->width = width;
+		this->height = height;
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		glGenRenderbuffers(1, &colorRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+
+		glGenRenderbuffers(1, &depthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+		frameStats.textureBytes += textureMemory(width, height, 4 + 4);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			cout << "offscreen framebuffer is not complete" << endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	~OffscreenTarget() {
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteRenderbuffers(1, &colorRBO);
+		glDeleteRenderbuffers(1, &depthRBO);
+		frameStats.textureBytes -= textureMemory(width, height, 4 + 4);
+	}
+
+	// make it the target of the following draws
+	void bind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, width, height);
+	}
+
+	// RGB rows, top row first
+	void readPixels(vector<unsigned char>& pixels) {
+		pixels.resize((size_t)width * height * 3);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+		// gl rows start at the bottom
+		size_t rowSize = (size_t)width * 3;
+		vector<unsigned char> row(rowSize);
+		for (int y = 0; y < height / 2; y++) {
+			unsigned char* top = &pixels[y * rowSize];
+			unsigned char* bottom = &pixels[(height - 1 - y) * rowSize];
+			copy(top, top + rowSize, row.begin());
+			copy(bottom, bottom + rowSize, top);
+			copy(row.begin(), row.end(), bottom);
+		}
+	}
+
+	// binary ppm, readable without any image library
+	bool savePPM(const string& path) {
+		vector<unsigned char> pixels;
+		readPixels(pixels);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == NULL) {
+			cout << "can not write " << path << endl;
+			return false;
+		}
+		fprintf(file, "P6\n%d %d\n255\n", width, height);
+		fwrite(&pixels[0], 1, pixels.size(), file);
+		fclose(file);
+		return true;
+	}
+
+	int getWidth() {
+		return width;
+	}
+
+	int getHeight() {
+		return height;
+	}
+
+private:
+	int width, height;
+	unsigned int FBO;
+	unsigned int colorRBO;
+	unsigned int depthRBO;
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "camera.h"
+#include "shader.h"
+#include "stats.h"
+#include "trace.h"
+#include "threadPool.h"
+
+using namespace std;
+using namespace glm;
+
+// per instance world transforms of one model, plus the compacted buffers the meshes draw from
+class InstanceSet {
+public:
+	vector<mat4> transforms;
+	// all instances, input of the culling pass
+	unsigned int sourceVBO = 0;
+	// visible instances only, the gpu pass writes one while the meshes draw from the other
+	unsigned int culledVBOs[2] = {};
+	// primitives written into each of culledVBOs
+	unsigned int writtenQueries[2] = {};
+	// reads sourceVBO as points for transform feedback
+	unsigned int cullVAO = 0;
+	// culled buffer the meshes draw from with its instance count, -1 for sourceVBO with all instances
+	int drawIndex = -1;
+	int visibleCount = 0;
+	// culled buffer written by the gpu whose count is not read yet, -1 for none
+	int pendingIndex = -1;
+
+	InstanceSet(const vector<mat4>& transforms) {
+		this->transforms = transforms;
+		visibleCount = transforms.size();
+
+		glGenBuffers(1, &sourceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, sourceVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * transforms.size(), &transforms[0], GL_STATIC_DRAW);
+
+		glGenBuffers(2, culledVBOs);
+		for (unsigned int vbo : culledVBOs) {
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * transforms.size(), &transforms[0], GL_STREAM_COPY);
+		}
+		frameStats.bufferBytes += 3 * sizeof(mat4) * transforms.size();
+		glGenQueries(2, writtenQueries);
+
+		glGenVertexArrays(1, &cullVAO);
+		glBindVertexArray(cullVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, sourceVBO);
+		for (int i = 0; i < 4; i++) {
+			glEnableVertexAttribArray(i);
+			glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// buffer of the instances to draw, visibleCount of them
+	unsigned int drawVBO() {
+		return drawIndex >= 0 ? culledVBOs[drawIndex] : sourceVBO;
+	}
+
+	void release() {
+		glDeleteVertexArrays(1, &cullVAO);
+		glDeleteBuffers(1, &sourceVBO);
+		glDeleteBuffers(2, culledVBOs);
+		glDeleteQueries(2, writtenQueries);
+		frameStats.bufferBytes -= 3 * sizeof(mat4) * transforms.size();
+	}
+};
+
+// frustum, distance and screen size culling of instances, on gpu through transform
+// feedback, or on the worker threads when the feedback program does not link or its first
+// pass fails
+// the gpu result is drawn once its count can be read without waiting, a frame or more later,
+// and all instances are drawn until then
+class InstanceCuller {
+public:
+	// instances further than this are dropped
+	float maxDistance = 100;
+	// instances whose projected bounding sphere radius is below this (ndc units) are dropped
+	float minScreenRadius = 0.005;
+
+	InstanceCuller() {
+		cullShader = Shader::createFeedbackShader("shaders/cull_vt.glsl", "shaders/cull_gm.glsl", { "culledMat" });
+		gpuSupported = cullShader != NULL;
+		if (!gpuSupported)
+			cout << "culling program did not build, instances are culled on cpu" << endl;
+		gpuCulling = gpuSupported;
+	}
+
+	bool isGpuCulling() {
+		return gpuCulling;
+	}
+
+	void setGpuCulling(bool enabled) {
+		gpuCulling = enabled && gpuSupported;
+	}
+
+	// center and radius are the world space bounding sphere of the model before instance transform
+	void cull(InstanceSet* set, vec3 center, float radius, Camera* camera) {
+		TraceZone zone("InstanceCuller::cull");
+		vec4 planes[6];
+		camera->getFrustumPlanes(planes);
+
+		if (gpuCulling && cullGpu(set, center, radius, planes, camera))
+			return;
+		cullCpu(set, center, radius, planes, camera);
+	}
+
+private:
+	Shader* cullShader = NULL;
+	bool gpuSupported;
+	bool gpuCulling;
+	// the first gpu pass is checked for errors
+	bool gpuVerified = false;
+
+	// cpu culling scratch, kept between frames to avoid reallocation
+	vector<mat4> visible;
+	vector<pair<int, int>> ranges;
+	mutex rangesMutex;
+
+	// false when the pass can not run this frame and the cpu culls instead, gpu culling is
+	// turned off for good when the first pass fails
+	bool cullGpu(InstanceSet* set, vec3 center, float radius, vec4 planes[6], Camera* camera) {
+		// the count of the last pass, when the gpu is done with it
+		if (set->pendingIndex >= 0) {
+			GLuint available = 0;
+			glGetQueryObjectuiv(set->writtenQueries[set->pendingIndex], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint written = 0;
+				glGetQueryObjectuiv(set->writtenQueries[set->pendingIndex], GL_QUERY_RESULT, &written);
+				set->drawIndex = set->pendingIndex;
+				set->visibleCount = written;
+				set->pendingIndex = -1;
+			}
+		}
+		// a pass at a time, into the buffer not drawn from
+		if (set->pendingIndex >= 0)
+			return true;
+		int target = set->drawIndex == 0 ? 1 : 0;
+		// drawing, even with the rasterizer off, needs a complete framebuffer, which a surfaceless
+		// headless context does not have before its target is bound
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			return false;
+
+		if (!gpuVerified) {
+			while (glGetError() != GL_NO_ERROR) {
+			}
+		}
+		cullShader->use();
+		for (int i = 0; i < 6; i++) {
+			cullShader->setVec4("frustumPlanes[" + to_string(i) + "]", planes[i]);
+		}
+		cullShader->setVec3("sphereCenter", center);
+		cullShader->setFloat("sphereRadius", radius);
+		cullShader->setVec3("viewPos", camera->getViewPos());
+		cullShader->setFloat("maxDistance", maxDistance);
+		cullShader->setFloat("minScreenRadius", minScreenRadius);
+		cullShader->setFloat("projectScale", camera->getProjectScale());
+
+		// survivors are streamed into the target buffer, nothing is rasterized
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(set->cullVAO);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, set->culledVBOs[target]);
+
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, set->writtenQueries[target]);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, set->transforms.size());
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glBindVertexArray(0);
+		glDisable(GL_RASTERIZER_DISCARD);
+
+		if (!gpuVerified) {
+			gpuVerified = true;
+			if (glGetError() != GL_NO_ERROR) {
+				cout << "transform feedback culling failed, instances are culled on cpu" << endl;
+				gpuSupported = false;
+				gpuCulling = false;
+				return false;
+			}
+		}
+		set->pendingIndex = target;
+		return true;
+	}
+
+	void cullCpu(InstanceSet* set, vec3 center, float radius, vec4 planes[6], Camera* camera) {
+		int count = set->transforms.size();
+		vec3 viewPos = camera->getViewPos();
+		float projectScale = camera->getProjectScale();
+
+		visible.resize(count);
+		ranges.clear();
+
+		// each chunk compacts its survivors at the start of its own range
+		ThreadPool::instance().parallelFor(count, [&](int begin, int end) {
+			int written = begin;
+			for (int i = begin; i < end; i++) {
+				const mat4& m = set->transforms[i];
+				if (sphereVisible(m, center, radius, planes, viewPos, projectScale)) {
+					visible[written++] = m;
+				}
+			}
+			lock_guard<mutex> lock(rangesMutex);
+			ranges.push_back(make_pair(begin, written - begin));
+		}, 1024);
+
+		// then the chunks are joined in order
+		sort(ranges.begin(), ranges.end());
+		int total = 0;
+		for (auto& range : ranges) {
+			if (range.first != total && range.second > 0) {
+				memmove(&visible[total], &visible[range.first], sizeof(mat4) * range.second);
+			}
+			total += range.second;
+		}
+
+		// a gpu pass still pending is dropped
+		set->pendingIndex = -1;
+		set->drawIndex = 0;
+		if (total > 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, set->culledVBOs[0]);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(mat4) * total, &visible[0]);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		set->visibleCount = total;
+	}
+
+	// same test as shaders/cull_vt.glsl
+	bool sphereVisible(const mat4& instanceMat, vec3 center, float radius, vec4 planes[6], vec3 viewPos, float projectScale) {
+		vec3 c = vec3(instanceMat * vec4(center, 1));
+		float scale = glm::max(length(vec3(instanceMat[0])), glm::max(length(vec3(instanceMat[1])), length(vec3(instanceMat[2]))));
+		float r = radius * scale;
+
+		for (int i = 0; i < 6; i++) {
+			if (dot(vec3(planes[i]), c) + planes[i].w < -r)
+				return false;
+		}
+
+		float dist = length(c - viewPos);
+		if (dist - r > maxDistance)
+			return false;
+		if (dist > r && r / dist * projectScale < minScreenRadius)
+			return false;
+
+		return true;
+	}
+};
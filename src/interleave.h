@@ -0,0 +1,52 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INTERLEAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+#include "mesh.h"
+
+using namespace glm;
+
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex is written as two 4 float halves");
+
+// fills vertices [begin, end) from separate arrays of 3 floats per vertex (assimp's layout),
+// texture coordinates use the first 2 of their 3, normals and texCoords may be NULL for zeros
+void interleaveVertices(const float* positions, const float* normals, const float* texCoords, Vertex* vertices, int begin, int end) {
+	int i = begin;
+#ifdef INTERLEAVE_SSE2
+	// every load reads the first float of the next vertex too, so the last one is left to the
+	// scalar loop to stay inside the arrays
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 1 < end; i++) {
+		__m128 p = _mm_loadu_ps(positions + i * 3);
+		__m128 n = normals != NULL ? _mm_loadu_ps(normals + i * 3) : zero;
+		__m128 t = texCoords != NULL ? _mm_loadu_ps(texCoords + i * 3) : zero;
+		// px py pz nx
+		__m128 zx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));
+		__m128 first = _mm_shuffle_ps(p, zx, _MM_SHUFFLE(2, 0, 1, 0));
+		// ny nz u v
+		__m128 second = _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1));
+		float* out = &vertices[i].Position.x;
+		_mm_storeu_ps(out, first);
+		_mm_storeu_ps(out + 4, second);
+	}
+#endif
+	for (; i < end; i++) {
+		Vertex& vertex = vertices[i];
+		memcpy(&vertex.Position, positions + i * 3, sizeof(vec3));
+		if (normals != NULL)
+			memcpy(&vertex.Normal, normals + i * 3, sizeof(vec3));
+		else
+			vertex.Normal = vec3(0);
+		if (texCoords != NULL)
+			memcpy(&vertex.TexCoord, texCoords + i * 3, sizeof(vec2));
+		else
+			vertex.TexCoord = vec2(0);
+	}
+}
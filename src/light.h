@@ -9,9 +9,17 @@
 using namespace std;
 using namespace glm;
 
+// shaders declare uniform Light lights[10]
+const int MAX_FORWARD_LIGHTS = 10;
+// spot lights do not fade with distance
+const float UNBOUNDED_RANGE = 1000;
+// texture unit of the shadow atlas, see src/shadowAtlas.h
+const int SHADOW_TEX_UNIT = 5;
+
 class Light {
 public:
-	static Light createSpotlight(vec3 pos, vec3 di, float angle) {
+	// shadowResolution is the requested shadow map size, 0 for no shadow
+	static Light createSpotlight(vec3 pos, vec3 di, float angle, float range = UNBOUNDED_RANGE, int shadowResolution = 1024) {
 		Light light;
 
 		light.type = 1;
@@ -19,31 +27,134 @@ public:
 		light.pos = pos;
 		light.di = normalize(di);
 		light.color = vec3(1);
+		light.range = range;
 
 		light.cutoffCos = cos(radians((angle/2)+5));
 		light.cutoffStartCos = cos(radians(angle/2));
+		light.shadowResolution = shadowResolution;
+
+		return light;
+	}
+
+	// light in all directions, fading out at range
+	static Light createPointlight(vec3 pos, vec3 color, float range) {
+		Light light;
+
+		light.type = 0;
+
+		light.pos = pos;
+		light.di = vec3(0, -1, 0);
+		light.color = color;
+		light.range = range;
+
+		// cone factor (dot - cutoffCos) / (cutoffStartCos - cutoffCos) is always >= 1,
+		// so shaders handle both types without branching on type
+		light.cutoffCos = -2;
+		light.cutoffStartCos = -1;
 
 		return light;
 	}
 
 	void setupLight(Shader* shader, int index) {
-		shader->setInt(uniName(index, "type"), type);
 		shader->setVec3(uniName(index, "pos"), pos);
 		shader->setVec3(uniName(index, "di"), di);
 		shader->setVec3(uniName(index, "color"), color);
 		shader->setFloat(uniName(index, "cutoffCos"), cutoffCos);
 		shader->setFloat(uniName(index, "cutoffStartCos"), cutoffStartCos);
+		shader->setFloat(uniName(index, "range"), range);
+		shader->setBool(uniName(index, "shadowed"), shadowed);
+		if (shadowed) {
+			shader->setMat4(uniName(index, "shadowMat"), shadowMat);
+			shader->setVec4(uniName(index, "shadowRect"), shadowRect);
+		}
+	}
+
+	// shadowMat maps world space to atlas uv and depth, shadowRect is the uv area of the tile
+	void setShadow(const mat4& shadowMat, vec4 shadowRect) {
+		shadowed = true;
+		this->shadowMat = shadowMat;
+		this->shadowRect = shadowRect;
+	}
+
+	void clearShadow() {
+		shadowed = false;
+	}
+
+	bool hasShadow() const {
+		return shadowed;
+	}
+
+	int getShadowResolution() const {
+		return shadowResolution;
+	}
+
+	// whether the light can reach a world space box: range sphere against the box, then for
+	// spotlights the cone against the bounding sphere of the box, both conservative
+	bool affectsBox(vec3 boxMin, vec3 boxMax) const {
+		vec3 closest = glm::clamp(pos, boxMin, boxMax);
+		vec3 toBox = closest - pos;
+		if (dot(toBox, toBox) > range * range)
+			return false;
+		if (!isSpotlight())
+			return true;
+
+		vec3 center = (boxMin + boxMax) / 2.0f;
+		float radius = length(boxMax - boxMin) / 2;
+		vec3 toCenter = center - pos;
+		float along = dot(toCenter, di);
+		float across = sqrt(glm::max(dot(toCenter, toCenter) - along * along, 0.0f));
+		float cosAngle = glm::clamp(cutoffCos, -1.0f, 1.0f);
+		float sinAngle = sqrt(1 - cosAngle * cosAngle);
+		// distance of the sphere center to the cone surface
+		if (cosAngle * across - sinAngle * along > radius)
+			return false;
+		return along > -radius;
+	}
+
+	bool isSpotlight() const {
+		return type == 1;
+	}
+
+	vec3 getPos() const {
+		return pos;
+	}
+
+	vec3 getDi() const {
+		return di;
 	}
+
+	vec3 getColor() const {
+		return color;
+	}
+
+	float getRange() const {
+		return range;
+	}
+
+	float getCutoffCos() const {
+		return cutoffCos;
+	}
+
+	float getCutoffStartCos() const {
+		return cutoffStartCos;
+	}
+
 private:
 	vec3 pos;
 	vec3 di;
 	vec3 color;
 	int type;
+	float range;
 
 	// spot light cutoff
 	float cutoffCos;
 	float cutoffStartCos;
 
+	int shadowResolution = 0;
+	bool shadowed = false;
+	mat4 shadowMat;
+	vec4 shadowRect;
+
 	string uniName(int index, string name) {
 		return "lights[" + to_string(index) + "]." + name;
 	}
@@ -56,13 +167,53 @@ public:
 		lights.push_back(light);
 	}
 
+	void removePointlights() {
+		vector<Light> spotlights;
+		for (Light& light : lights) {
+			if (light.isSpotlight())
+				spotlights.push_back(light);
+		}
+		lights = spotlights;
+	}
+
+	int size() {
+		return lights.size();
+	}
+
+	const vector<Light>& getLights() {
+		return lights;
+	}
+
+	Light& getLight(int index) {
+		return lights[index];
+	}
+
+	vec3 getAmbient() {
+		return ambient;
+	}
+
+	// lights the uniform array path can show, the first MAX_FORWARD_LIGHTS
+	int forwardCount() {
+		return glm::min((int)lights.size(), MAX_FORWARD_LIGHTS);
+	}
+
+	// indices of the forward lights that can reach a world space box
+	void selectLights(vec3 boxMin, vec3 boxMax, vector<int>& selected) {
+		selected.clear();
+		for (int i = 0; i < forwardCount(); i++) {
+			if (lights[i].affectsBox(boxMin, boxMax))
+				selected.push_back(i);
+		}
+	}
+
 	// setup lights in shader
 	void setupLights(Shader* shader) {
-		for (int i = 0; i < lights.size(); i++) {
+		for (int i = 0; i < forwardCount(); i++) {
 			lights[i].setupLight(shader, i);
 		}
-		shader->setInt("lightNum", lights.size());
+		shader->setInt("lightNum", forwardCount());
 		shader->setVec3("ambient", ambient);
+		shader->setInt("shadowAtlas", SHADOW_TEX_UNIT);
 	}
 
 private:
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#include <malloc.h>
+#endif
+#endif
+
+#include "model.h"
+
+using namespace std;
+
+// peak resident memory of the process in MB
+double peakRssMB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / 1048576.0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1048576.0;
+#else
+	// kilobytes on linux
+	return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+// resident memory of the process now in MB
+double currentRssMB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize / 1048576.0;
+#elif defined(__APPLE__)
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+		return 0;
+	return info.resident_size / 1048576.0;
+#else
+#ifdef __GLIBC__
+	// freed memory is kept by malloc and would be reused by the next model without showing
+	malloc_trim(0);
+#endif
+	// second field of statm is the resident size in pages
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == NULL)
+		return 0;
+	long pages = 0, residentPages = 0;
+	int read = fscanf(file, "%ld %ld", &pages, &residentPages);
+	fclose(file);
+	if (read != 2)
+		return 0;
+	return (double)residentPages * sysconf(_SC_PAGESIZE) / 1048576.0;
+#endif
+}
+
+// stages of the fastest of the runs of one model
+struct LoadBenchmarkResult {
+	string model;
+	ModelLoadStats stats;
+	// resident memory the loaded model holds, the most of its runs; the peak of the process is
+	// reported once for the whole corpus since it also covers the models loaded before
+	double rssGrowthMB = 0;
+	// meshes of all runs read from the mesh cache and generated, while it is on
+	int cacheHits = 0;
+	int cacheMisses = 0;
+};
+
+// loads every model of a corpus a few times and reports time, size and throughput of each
+// loading stage, one line per stage in fixed columns so reports of two commits can be diffed
+class LoadBenchmark {
+public:
+	// without upload no gl context is needed, the upload stage is reported as 0
+	// the mesh cache is normally off so the stages time the work and not the cache reads
+	LoadBenchmark(int runs, bool upload, bool useMeshCache = false) {
+		this->runs = runs;
+		this->upload = upload;
+		this->useMeshCache = useMeshCache;
+	}
+
+	void run(const string& path) {
+		LoadBenchmarkResult result;
+		result.model = path;
+		float bestMs = -1;
+		bool cacheEnabled = meshCache.isEnabled();
+		meshCache.setEnabled(useMeshCache);
+		int hits = meshCache.hits;
+		int misses = meshCache.misses;
+		for (int i = 0; i < runs; i++) {
+			double rssBefore = currentRssMB();
+			Model model(path.c_str(), upload);
+			if (upload)
+				glFinish();
+			result.rssGrowthMB = glm::max(result.rssGrowthMB, currentRssMB() - rssBefore);
+			const ModelLoadStats& stats = model.getLoadStats();
+			float ms = totalMs(stats);
+			if (bestMs < 0 || ms < bestMs) {
+				bestMs = ms;
+				result.stats = stats;
+			}
+			model.release();
+		}
+		result.cacheHits = meshCache.hits - hits;
+		result.cacheMisses = meshCache.misses - misses;
+		meshCache.setEnabled(cacheEnabled);
+		results.push_back(result);
+
+		cout << "loaded " << path << " in " << bestMs << " ms" << endl;
+	}
+
+	bool write(const string& reportPath) {
+		FILE* file = fopen(reportPath.c_str(), "w");
+		if (file == NULL) {
+			cout << "can not write " << reportPath << endl;
+			return false;
+		}
+
+		fprintf(file, "# load benchmark, fastest of %d runs, gl upload %s, mesh cache %s\n", runs, upload ? "on" : "off", useMeshCache ? "on" : "off");
+		if (upload)
+			fprintf(file, "# renderer %s\n", (const char*)glGetString(GL_RENDERER));
+		fprintf(file, "# process peak_rss_mb %.1f\n", peakRssMB());
+		fprintf(file, "# %-8s %10s %10s %10s %10s %10s\n", "stage", "ms", "MB", "MB/s", "Mtris/s", "ms/Mverts");
+		for (const LoadBenchmarkResult& result : results) {
+			const ModelLoadStats& stats = result.stats;
+			// vertices and indices produced by the conversion
+			double meshMB = ((double)sizeof(Vertex) * stats.vertices + sizeof(unsigned int) * 3.0 * stats.triangles) / 1048576;
+
+			fprintf(file, "model %s\n", result.model.c_str());
+			fprintf(file, "vertices %d triangles %d textures %d merged_meshes %d rss_growth_mb %.1f\n",
+				stats.vertices, stats.triangles, stats.textures, stats.mergedMeshes, result.rssGrowthMB);
+			// the bounds and convert stages then include reading the cache
+			if (useMeshCache)
+				fprintf(file, "mesh_cache hits %d misses %d\n", result.cacheHits, result.cacheMisses);
+			writeStage(file, "parse", stats.parseMs, stats.fileBytes / 1048576.0, stats.triangles, stats.vertices);
+			writeStage(file, "convert", stats.convertMs, meshMB, stats.triangles, stats.vertices);
+			writeStage(file, "decode", stats.decodeMs, stats.decodedBytes / 1048576.0, -1, -1);
+			writeStage(file, "dedup", stats.dedupMs, meshMB, stats.triangles, stats.vertices);
+			writeStage(file, "bounds", stats.boundsMs, meshMB, stats.triangles, stats.vertices);
+			writeStage(file, "upload", stats.uploadMs, stats.uploadedBytes / 1048576.0, stats.triangles, stats.vertices);
+			writeStage(file, "total", totalMs(stats), stats.fileBytes / 1048576.0, stats.triangles, stats.vertices);
+		}
+		fclose(file);
+		return true;
+	}
+
+private:
+	int runs;
+	bool upload;
+	bool useMeshCache;
+	vector<LoadBenchmarkResult> results;
+
+	static float totalMs(const ModelLoadStats& stats) {
+		return stats.parseMs + stats.convertMs + stats.decodeMs + stats.dedupMs + stats.boundsMs + stats.uploadMs;
+	}
+
+	// triangles and vertices -1 when the stage does not work on the geometry
+	void writeStage(FILE* file, const char* stage, float ms, double MB, int triangles, int vertices) {
+		double seconds = ms / 1000;
+		fprintf(file, "  %-8s %10.3f %10.3f %10.1f ", stage, ms, MB, seconds > 0 ? MB / seconds : 0);
+		if (triangles < 0)
+			fprintf(file, "%10s ", "-");
+		else
+			fprintf(file, "%10.3f ", seconds > 0 ? triangles / seconds / 1e6 : 0);
+		// cost of a million vertices, comparable between models of different size
+		if (vertices <= 0)
+			fprintf(file, "%10s\n", "-");
+		else
+			fprintf(file, "%10.3f\n", ms / (vertices / 1e6));
+	}
+};
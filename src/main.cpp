@@ -6,14 +6,24 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
 
 #include "modelViewer.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "loadBenchmark.h"
+#include "objGenerator.h"
+#include "trace.h"
 #include "ui.h"
 
 using namespace std;
 
 ModelViewer* viewer;
 UI* ui;
+// written when tracing is stopped with T
+string tracePath = "trace.json";
 
 void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 	viewer->mouseCallback(window, xpos, ypos);
@@ -27,57 +37,332 @@ void windowSizeChangeCallback(GLFWwindow* window, int width, int height) {
 void keyPressCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	viewer->keyPressCallback(window, key, action);
 	ui->keyPressCallback(window, key, action);
+
+	// first press starts a capture, the second one writes it
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		if (tracer.isEnabled()) {
+			tracer.stop();
+			tracer.write(tracePath);
+		}
+		else {
+			tracer.start();
+			cout << "tracing started" << endl;
+		}
+	}
+}
+
+// command line: [--headless] [--size WIDTHxHEIGHT] [--frames N] [--output image.ppm]
+// [--benchmark path.txt|orbit] [--timestep seconds] [--json result.json] [--keys KEYS] [--record path.txt]
+// [--trace trace.json] [--load-benchmark report.txt] [--runs N] [--no-gl] [--benchmark-mesh-cache]
+// [--crease degrees] [--area-weighted] [--tangents] [--no-mesh-cache] [--no-dedup] [model.obj ...]
+// generator: --generate out.obj [--triangles N] [--meshes N] [--materials N] [--textures N]
+// [--texture-size N] [--sharing 0-1] [--transparency 0-1] [--seed N]
+struct Options {
+	bool headless = false;
+	int width = 1800;
+	int height = 1200;
+	// frames rendered in headless mode or recorded per model by the benchmark, 0 for the default
+	int frames = 0;
+	// last headless frame is written here when set
+	string output;
+	// camera path file or "orbit", replayed over every model instead of interactive control
+	string benchmark;
+	float timestep = 1.0f / 60;
+	string json = "benchmark.json";
+	// key presses applied before the first frame, e.g. "IR" for the instance grid with deferred shading
+	string keys;
+	// the interactive camera is recorded into this path file
+	string record;
+	// everything from startup to exit is traced into this file when set
+	string trace;
+	// only load the models and write the stage timings here, no rendering
+	string loadBenchmark;
+	int runs = 3;
+	// load benchmark without a gl context, stops before the upload
+	bool noGl = false;
+	// load benchmark reads and writes the mesh cache, otherwise every run does the full work
+	bool benchmarkMeshCache = false;
+	// write a synthetic model here and exit
+	string generate;
+	ObjGeneratorSettings generator;
+	// for meshes read without normals, and tangents
+	NormalSettings normals;
+	bool meshCache = true;
+	// copies of a mesh drawn as instances of it
+	DedupSettings dedup;
+	vector<string> modelPaths;
+};
+
+Options parseOptions(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless") {
+			options.headless = true;
+		}
+		else if (arg == "--size" && hasValue) {
+			if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+				cout << "size should look like 1280x720" << endl;
+				exit(1);
+			}
+		}
+		else if (arg == "--frames" && hasValue) {
+			options.frames = std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--output" && hasValue) {
+			options.output = argv[++i];
+		}
+		else if (arg == "--benchmark" && hasValue) {
+			options.benchmark = argv[++i];
+		}
+		else if (arg == "--timestep" && hasValue) {
+			options.timestep = (float)atof(argv[++i]);
+		}
+		else if (arg == "--json" && hasValue) {
+			options.json = argv[++i];
+		}
+		else if (arg == "--keys" && hasValue) {
+			options.keys = argv[++i];
+		}
+		else if (arg == "--record" && hasValue) {
+			options.record = argv[++i];
+		}
+		else if (arg == "--trace" && hasValue) {
+			options.trace = argv[++i];
+		}
+		else if (arg == "--load-benchmark" && hasValue) {
+			options.loadBenchmark = argv[++i];
+		}
+		else if (arg == "--runs" && hasValue) {
+			options.runs = std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--no-gl") {
+			options.noGl = true;
+		}
+		else if (arg == "--benchmark-mesh-cache") {
+			options.benchmarkMeshCache = true;
+		}
+		else if (arg == "--generate" && hasValue) {
+			options.generate = argv[++i];
+		}
+		else if (arg == "--triangles" && hasValue) {
+			options.generator.triangles = std::max(atoll(argv[++i]), 1LL);
+		}
+		else if (arg == "--meshes" && hasValue) {
+			options.generator.meshes = atoi(argv[++i]);
+		}
+		else if (arg == "--materials" && hasValue) {
+			options.generator.materials = atoi(argv[++i]);
+		}
+		else if (arg == "--textures" && hasValue) {
+			options.generator.textures = atoi(argv[++i]);
+		}
+		else if (arg == "--texture-size" && hasValue) {
+			options.generator.textureSize = atoi(argv[++i]);
+		}
+		else if (arg == "--sharing" && hasValue) {
+			options.generator.vertexSharing = (float)atof(argv[++i]);
+		}
+		else if (arg == "--transparency" && hasValue) {
+			options.generator.transparency = (float)atof(argv[++i]);
+		}
+		else if (arg == "--seed" && hasValue) {
+			options.generator.seed = (unsigned int)atoi(argv[++i]);
+		}
+		else if (arg == "--crease" && hasValue) {
+			options.normals.creaseAngle = (float)atof(argv[++i]);
+		}
+		else if (arg == "--area-weighted") {
+			options.normals.angleWeighted = false;
+		}
+		else if (arg == "--tangents") {
+			options.normals.generateTangents = true;
+		}
+		else if (arg == "--no-mesh-cache") {
+			options.meshCache = false;
+		}
+		else if (arg == "--no-dedup") {
+			options.dedup.enabled = false;
+		}
+		else {
+			options.modelPaths.push_back(arg);
+		}
+	}
+
+	if (options.modelPaths.size() == 0) {
+		options.modelPaths = {
+			// "D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\backpack\\backpack.obj",
+			"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\cyborg\\cyborg.obj",
+			// "D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\nanosuit\\nanosuit.obj",
+			"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\planet\\planet.obj",
+			"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\rock\\rock.obj",
+			"D:\\code\\learn opengl\\resources\\tree2\\tree2.obj",
+			"D:\\code\\learn opengl\\resources\\low_poly_tree\\low_poly_tree.obj",
+			// "D:\\code\\learn opengl\\resources\\man\\man_100k.obj",
+			"D:\\code\\learn opengl\\resources\\hotdog\\hotdog.obj",
+			"D:\\code\\learn opengl\\resources\\car\\car.obj",
+		};
+	}
+	return options;
+}
+
+// after a context is current: load gl, create the viewer and its models
+void setupViewer(GLADloadproc loader, Camera* camera, Options& options, chrono::high_resolution_clock::time_point startTime) {
+	if (!gladLoadGLLoader(loader))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		exit(1);
+	}
+
+	glViewport(0, 0, options.width, options.height);
+
+	programBinaryCache.init(loader);
+
+	viewer = new ModelViewer(camera);
+	viewer->setup(options.modelPaths);
+	for (char key : options.keys) {
+		viewer->keyPressCallback(NULL, toupper(key), GLFW_PRESS);
+	}
+
+	// warm start when all programs came from the binary cache
+	programBinaryCache.printStats();
+	meshCache.printStats();
+	cout << (programBinaryCache.misses + programBinaryCache.rejected == 0 ? "warm" : "cold") << " startup: "
+		<< chrono::duration<float, milli>(chrono::high_resolution_clock::now() - startTime).count() << " ms" << endl;
+}
+
+// replay the camera path over every model and write the timings, renderFrame has to wait for the gpu
+void runBenchmark(Options& options, Camera* camera, function<void()> renderFrame) {
+	CameraPath path;
+	if (options.benchmark == "orbit")
+		path = CameraPath::orbit();
+	else if (!path.load(options.benchmark))
+		exit(1);
+
+	Benchmark benchmark(path, options.frames > 0 ? options.frames : 600, options.timestep);
+	for (int i = 0; i < viewer->modelCount(); i++) {
+		viewer->setCurrentModel(i);
+		benchmark.run(options.modelPaths[i], camera, renderFrame);
+	}
+
+	string settings = to_string(options.width) + "x" + to_string(options.height) + " keys=" + options.keys
+		+ (options.headless ? " headless" : " windowed") + " path=" + options.benchmark;
+	if (benchmark.writeJson(options.json, settings))
+		cout << "benchmark written to " << options.json << endl;
+}
+
+// load every model a few times without rendering, the gl context is headless
+int runLoadBenchmark(Options& options) {
+	HeadlessContext context;
+	if (!options.noGl) {
+		if (!context.create(options.width, options.height)) {
+			cout << "no gl context for the upload stage, --no-gl stops before it" << endl;
+			return 1;
+		}
+		if (!gladLoadGLLoader(context.getProcLoader())) {
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return 1;
+		}
+	}
+
+	LoadBenchmark benchmark(options.runs, !options.noGl, options.benchmarkMeshCache && options.meshCache);
+	for (const string& path : options.modelPaths) {
+		benchmark.run(path);
+	}
+	if (benchmark.write(options.loadBenchmark))
+		cout << "load benchmark written to " << options.loadBenchmark << endl;
+	meshCache.printStats();
+	if (!options.trace.empty())
+		tracer.write(options.trace);
+
+	if (!options.noGl)
+		context.destroy();
+	return 0;
 }
 
-int main() {
+// no window and no input, the frames go into an offscreen framebuffer
+int runHeadless(Options& options, chrono::high_resolution_clock::time_point startTime) {
+	HeadlessContext context;
+	if (!context.create(options.width, options.height))
+		return 1;
+
+	Camera camera = Camera(glm::radians(45.0f), options.width, options.height);
+	setupViewer(context.getProcLoader(), &camera, options, startTime);
+
+	OffscreenTarget* target = new OffscreenTarget(options.width, options.height);
+	if (!options.benchmark.empty()) {
+		runBenchmark(options, &camera, [target]() {
+			target->bind();
+			viewer->renderLoop();
+			glFinish();
+		});
+	}
+	else {
+		int frames = options.frames > 0 ? options.frames : 1;
+		for (int i = 0; i < frames; i++) {
+			target->bind();
+			viewer->renderLoop();
+		}
+		glFinish();
+		cout << frames << " headless frames, cpu " << frameStats.cpuMs << " ms, gpu " << frameStats.gpuMs << " ms" << endl;
+	}
+
+	if (!options.output.empty() && target->savePPM(options.output))
+		cout << "frame written to " << options.output << endl;
+
+	if (!options.trace.empty())
+		tracer.write(options.trace);
+
+	delete target;
+	context.destroy();
+	return 0;
+}
+
+int runWindowed(Options& options, chrono::high_resolution_clock::time_point startTime) {
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	int width = 1800, height = 1200;
-	GLFWwindow* window = glfwCreateWindow(width, height, "Obj Model Viewer", NULL, NULL);
+	GLFWwindow* window = glfwCreateWindow(options.width, options.height, "Obj Model Viewer", NULL, NULL);
 	if (window == NULL) {
 		cout << "Window creation failed." << endl;
 		exit(1);
 	}
 	glfwMakeContextCurrent(window);
 
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-	{
-		std::cout << "Failed to initialize GLAD" << std::endl;
-		exit(1);
-	}
-
-	glViewport(0, 0, width, height);
-
-	Camera camera = Camera(glm::radians(45.0f), width, height);
-	viewer = new ModelViewer(&camera);
+	Camera camera = Camera(glm::radians(45.0f), options.width, options.height);
+	setupViewer((GLADloadproc)glfwGetProcAddress, &camera, options, startTime);
 	ui = new UI();
 
+	if (!options.benchmark.empty()) {
+		// no vsync and no input, the path drives the camera
+		glfwSwapInterval(0);
+		runBenchmark(options, &camera, [window]() {
+			viewer->renderLoop();
+			glfwSwapBuffers(window);
+			glFinish();
+			glfwPollEvents();
+		});
+		if (!options.trace.empty())
+			tracer.write(options.trace);
+		glfwTerminate();
+		return 0;
+	}
+
+	CameraPathRecorder recorder;
 	glfwSetCursorPosCallback(window, mouseCallback);
 	glfwSetKeyCallback(window, keyPressCallback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	glfwSetFramebufferSizeCallback(window, windowSizeChangeCallback);
 
-	vector<string> modelPaths = {
-		// "D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\backpack\\backpack.obj",
-		"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\cyborg\\cyborg.obj",
-		// "D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\nanosuit\\nanosuit.obj",
-		"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\planet\\planet.obj",
-		"D:\\code\\learn opengl\\LearnOpenGL-master\\resources\\objects\\rock\\rock.obj",
-		"D:\\code\\learn opengl\\resources\\tree2\\tree2.obj",
-		"D:\\code\\learn opengl\\resources\\low_poly_tree\\low_poly_tree.obj",
-		// "D:\\code\\learn opengl\\resources\\man\\man_100k.obj",
-		"D:\\code\\learn opengl\\resources\\hotdog\\hotdog.obj",
-		"D:\\code\\learn opengl\\resources\\car\\car.obj",
-	};
-	viewer->setup(modelPaths);
-
 	while (!glfwWindowShouldClose(window)) {
 		viewer->keyHoldCallback(window);
 
 		viewer->renderLoop();
+		if (!options.record.empty())
+			recorder.update(&camera, glfwGetTime());
 
 		ui->drawUI();
 
@@ -85,6 +370,32 @@ int main() {
 		glfwPollEvents();
 	}
 
+	if (!options.record.empty() && recorder.save(options.record))
+		cout << "camera path written to " << options.record << endl;
+	if (!options.trace.empty() && tracer.isEnabled())
+		tracer.write(options.trace);
+
 	glfwTerminate();
 	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+	auto startTime = chrono::high_resolution_clock::now();
+
+	Options options = parseOptions(argc, argv);
+	normalSettings = options.normals;
+	meshCache.setEnabled(options.meshCache);
+	dedupSettings = options.dedup;
+	tracer.setThreadName("main");
+	if (!options.trace.empty()) {
+		tracePath = options.trace;
+		tracer.start();
+	}
+	if (!options.generate.empty())
+		return ObjGenerator(options.generator).write(options.generate) ? 0 : 1;
+	if (!options.loadBenchmark.empty())
+		return runLoadBenchmark(options);
+	if (options.headless)
+		return runHeadless(options, startTime);
+	return runWindowed(options, startTime);
+}
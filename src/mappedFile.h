@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// read only view of a whole file
+class MappedFile {
+public:
+	~MappedFile() {
+		close();
+	}
+
+	bool open(const string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+			return false;
+		size = (size_t)fileSize.QuadPart;
+		if (size == 0)
+			return true;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+			return false;
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		return data != NULL;
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+			return false;
+		size = (size_t)info.st_size;
+		if (size == 0)
+			return true;
+		void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED)
+			return false;
+		data = (const char*)mapped;
+		// read ahead, every page is touched once in order
+		madvise(mapped, size, MADV_SEQUENTIAL);
+		return true;
+#endif
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != NULL)
+			munmap((void*)data, size);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	// pages of the range are not needed anymore, they leave the resident set instead of
+	// waiting for memory pressure, reading them again goes back to the file
+	void discard(size_t offset, size_t bytes) {
+#ifndef _WIN32
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		// whole pages inside the range only, the neighbours may still be read
+		size_t start = (offset + page - 1) / page * page;
+		size_t end = std::min(offset + bytes, size) / page * page;
+		if (data != NULL && end > start)
+			madvise((void*)(data + start), end - start, MADV_DONTNEED);
+#endif
+	}
+
+	const char* getData() {
+		return data;
+	}
+
+	size_t getSize() {
+		return size;
+	}
+
+private:
+	const char* data = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
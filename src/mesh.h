@@ -5,9 +5,12 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
 #include <vector>
+#include <limits>
 
 #include "shader.h"
+#include "stats.h"
 #include "global.h"
+#include "bounds.h"
 
 using namespace glm;
 using namespace std;
@@ -18,19 +21,133 @@ struct Vertex {
 	glm::vec2 TexCoord;
 };
 
+// vertex attribute read in place from RawMeshData's vertex buffer, as a gltf accessor describes it
+struct RawAttribute {
+	// byte offset into the vertex buffer, -1 when the mesh does not have the attribute
+	long long offset = -1;
+	int stride = 0;
+	int components = 0;
+	GLenum type = GL_FLOAT;
+	bool normalized = false;
+};
+
+// vertex attribute location of each of RawMeshData's attributes, the tangent goes after the
+// instance transform in 3-6
+const int RAW_LOCATIONS[4] = { 0, 1, 2, 7 };
+
+// bytes of the source file copied as they are into the vertex buffer
+struct RawRange {
+	const unsigned char* data;
+	size_t bytes;
+	// where they go in the vertex buffer
+	size_t offset;
+};
+
+// geometry left in the layout of its file and uploaded without conversion, the pointers
+// belong to the loader and only have to stay valid until setupMesh
+struct RawMeshData {
+	vector<RawRange> vertexRanges;
+	size_t vertexBytes = 0;
+	// position, normal, texture coordinate and tangent, at the locations of RAW_LOCATIONS
+	RawAttribute attributes[4];
+	int vertexCount = 0;
+	// NULL when the indices are generated into Mesh::indices instead
+	const unsigned char* indexData = NULL;
+	GLenum indexType = GL_UNSIGNED_INT;
+	int indexCount = 0;
+	// from the file, the vertices are not read on the cpu
+	glm::vec3 boundMin;
+	glm::vec3 boundMax;
+};
+
 class Mesh {
 public:
 	std::vector<Vertex> vertices;
 	std::vector<unsigned int> indices;
+	// xyz and the bitangent sign in w, per vertex, empty when the mesh has no tangents
+	std::vector<glm::vec4> tangents;
 	Material mat;
+	// model space bounding box
+	glm::vec3 boundMin;
+	glm::vec3 boundMax;
+	glm::vec3 boundCenter;
+	// sphere around boundCenter enclosing every vertex
+	float boundRadius;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, Material material) {
+	// cpu side only, computeBounds and setupMesh are called by the model so it can time them
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, Material material, std::vector<glm::vec4> tangents = std::vector<glm::vec4>()) {
 		
-		this->vertices = vertices;
-		this->indices = indices;
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->tangents = std::move(tangents);
 		this->mat = material;
+	}
+
+	// geometry uploaded straight from the file, indices is only used when raw has no index data
+	Mesh(const RawMeshData& raw, std::vector<unsigned int> indices, Material material) {
+		this->raw = raw;
+		this->indices = std::move(indices);
+		this->mat = material;
+		isRaw = true;
+		indexType = raw.indexData != NULL ? raw.indexType : GL_UNSIGNED_INT;
+	}
+
+	// safe on worker threads
+	void computeBounds() {
+		Bounds bounds;
+		if (isRaw) {
+			// only the box is known without the vertices, the sphere goes around it
+			bounds.min = raw.boundMin;
+			bounds.max = raw.boundMax;
+			bounds.radius = glm::length(bounds.max - bounds.min) / 2;
+		}
+		else {
+			bounds = computePositionBounds(vertices.empty() ? NULL : &vertices[0].Position, sizeof(Vertex), vertices.size());
+		}
+		setBounds(bounds);
+	}
+
+	Bounds getBounds() {
+		Bounds bounds;
+		bounds.min = boundMin;
+		bounds.max = boundMax;
+		bounds.radius = boundRadius;
+		return bounds;
+	}
+
+	void setBounds(const Bounds& bounds) {
+		boundMin = bounds.min;
+		boundMax = bounds.max;
+		boundCenter = bounds.center();
+		boundRadius = bounds.radius;
+	}
+
+	// create the vertex arrays and upload the buffers
+	void setupMesh();
 
-		setupMesh();
+	// delete the gl objects of setupMesh
+	void release() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteVertexArrays(1, &depthVAO);
+		unsigned int buffers[] = { VBO, EBO, positionVBO, tangentVBO };
+		glDeleteBuffers(4, buffers);
+		frameStats.bufferBytes -= bufferSize();
+	}
+
+	int getVertexCount() {
+		return isRaw ? raw.vertexCount : vertices.size();
+	}
+
+	int getIndexCount() {
+		return isRaw && raw.indexData != NULL ? raw.indexCount : indices.size();
+	}
+
+	// bytes uploaded by setupMesh
+	long long bufferSize() {
+		if (isRaw)
+			return (long long)raw.vertexBytes + indexSize(indexType) * getIndexCount();
+		return (long long)(sizeof(Vertex) + sizeof(glm::vec3)) * vertices.size() + sizeof(unsigned int) * indices.size() +
+			sizeof(glm::vec4) * tangents.size();
 	}
 
 	void draw(Shader* shader) {
@@ -41,54 +158,115 @@ public:
 
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		frameStats.vertexArrayBinds++;
+		drawElements();
 		glBindVertexArray(0);
 	}
 
-	void setInstances(glm::vec3 posArray[], int count) {
-		glBindVertexArray(VAO);
-		if (instanceVBO == 0) {
-			glGenBuffers(1, &instanceVBO);
+	// depth only, texture is sampled only when its alpha can discard fragments
+	void drawDepth(Shader* depthShader) {
+		bool alphaTest = mat.alpha_mode == ALPHA_CUTOUT;
+		depthShader->setBool("alpha_test", alphaTest);
+		if (alphaTest) {
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, mat.diffuse_texture);
+			frameStats.textureBinds++;
+			depthShader->setInt("diffuseTex", 0);
+		}
+
+		glBindVertexArray(depthVAO);
+		frameStats.vertexArrayBinds++;
+		drawElements();
+		glBindVertexArray(0);
+	}
+
+	// per instance transform, mat4 in attributes 3-6, read from instance first on
+	void setInstanceBuffer(unsigned int instanceVBO, int first = 0) {
+		for (unsigned int vao : { VAO, depthVAO }) {
+			glBindVertexArray(vao);
+			glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+			for (int i = 0; i < 4; i++) {
+				glEnableVertexAttribArray(3 + i);
+				glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::mat4) * first + sizeof(glm::vec4) * i));
+				glVertexAttribDivisor(3 + i, 1);
+			}
 		}
-		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * count, &posArray[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-		glVertexAttribDivisor(3, 1);
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
+	}
+
+	void clearInstanceBuffer() {
+		for (unsigned int vao : { VAO, depthVAO }) {
+			glBindVertexArray(vao);
+			for (int i = 0; i < 4; i++) {
+				glDisableVertexAttribArray(3 + i);
+			}
+		}
+		glBindVertexArray(0);
+		instancesNum = 0;
+	}
 
+	void setInstanceCount(int count) {
 		instancesNum = count;
 	}
 
 private:
 	unsigned int VAO;
-	unsigned int instanceVBO = 0;
+	unsigned int VBO;
+	unsigned int EBO;
+	// depth pre-pass: tightly packed positions, plus texture coordinates of VBO
+	unsigned int depthVAO;
+	unsigned int positionVBO;
+	// location 7, 0 without tangents
+	unsigned int tangentVBO = 0;
+	// 0 means not instanced
 	int instancesNum = 0;
+	bool isRaw = false;
+	RawMeshData raw;
+	GLenum indexType = GL_UNSIGNED_INT;
 
-	void setupMesh();
+	void setupDepthMesh();
+	void setupRawMesh();
+
+	static int indexSize(GLenum type) {
+		return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+	}
+
+	void drawElements() {
+		int count = getIndexCount();
+		if (instancesNum > 0)
+			glDrawElementsInstanced(GL_TRIANGLES, count, indexType, 0, instancesNum);
+		else
+			glDrawElements(GL_TRIANGLES, count, indexType, 0);
+		frameStats.addDraw(count / 3 * glm::max(instancesNum, 1));
+	}
 };
 
 
 
 
 void Mesh::setupMesh() {
+	if (isRaw) {
+		setupRawMesh();
+		return;
+	}
+
 	// create VAO
 	glGenVertexArrays(1, &VAO);
 	glBindVertexArray(VAO);
 
 	// VBO: vertex buffer objects, stores vertex values in a buffer
-	unsigned int VBO;
 	glGenBuffers(1, &VBO); // first arg: number of buffers to generate
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	frameStats.bufferBytes += sizeof(Vertex) * vertices.size();
 
 	// EBO: element buffer object, stores vertex indexes
-	unsigned int EBO;
 	glGenBuffers(1, &EBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	frameStats.bufferBytes += sizeof(unsigned int) * indices.size();
 
 	// link vertex attributes
 	// position attribute
@@ -100,8 +278,94 @@ void Mesh::setupMesh() {
 	// texture coord attribute
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoord));
 	glEnableVertexAttribArray(2);
+	// tangent attribute, its own buffer so meshes without tangents keep the Vertex layout
+	if (!tangents.empty()) {
+		glGenBuffers(1, &tangentVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, tangentVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * tangents.size(), &tangents[0], GL_STATIC_DRAW);
+		frameStats.bufferBytes += sizeof(glm::vec4) * tangents.size();
+		glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+		glEnableVertexAttribArray(7);
+	}
 
 	// end of this VAO
 	glBindVertexArray(0);
+
+	setupDepthMesh();
+}
+
+void Mesh::setupDepthMesh() {
+	vector<glm::vec3> positions;
+	positions.reserve(vertices.size());
+	for (const Vertex& vertex : vertices) {
+		positions.push_back(vertex.Position);
+	}
+
+	glGenVertexArrays(1, &depthVAO);
+	glBindVertexArray(depthVAO);
+
+	glGenBuffers(1, &positionVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(), positions.data(), GL_STATIC_DRAW);
+	frameStats.bufferBytes += sizeof(glm::vec3) * positions.size();
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// alpha test needs texture coordinates, read from the interleaved buffer
+	if (mat.alpha_mode == ALPHA_CUTOUT) {
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoord));
+		glEnableVertexAttribArray(2);
+	}
+
+	// shares indices with the main VAO
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+	glBindVertexArray(0);
 }
 
+// the file's bytes go to the buffers unchanged and the attributes point into them
+void Mesh::setupRawMesh() {
+	glGenVertexArrays(1, &VAO);
+	glBindVertexArray(VAO);
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, raw.vertexBytes, NULL, GL_STATIC_DRAW);
+	for (const RawRange& range : raw.vertexRanges) {
+		glBufferSubData(GL_ARRAY_BUFFER, range.offset, range.bytes, range.data);
+	}
+
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	if (raw.indexData != NULL)
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)indexSize(indexType) * raw.indexCount, raw.indexData, GL_STATIC_DRAW);
+	else
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	frameStats.bufferBytes += bufferSize();
+
+	for (int i = 0; i < 4; i++) {
+		const RawAttribute& attribute = raw.attributes[i];
+		if (attribute.offset < 0)
+			continue;
+		glVertexAttribPointer(RAW_LOCATIONS[i], attribute.components, attribute.type, attribute.normalized, attribute.stride, (void*)(size_t)attribute.offset);
+		glEnableVertexAttribArray(RAW_LOCATIONS[i]);
+	}
+	glBindVertexArray(0);
+
+	// positions are read from the same buffer, there is no packed copy
+	glGenVertexArrays(1, &depthVAO);
+	glBindVertexArray(depthVAO);
+	positionVBO = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	const RawAttribute& position = raw.attributes[0];
+	glVertexAttribPointer(0, position.components, position.type, position.normalized, position.stride, (void*)(size_t)position.offset);
+	glEnableVertexAttribArray(0);
+	const RawAttribute& texCoord = raw.attributes[2];
+	if (mat.alpha_mode == ALPHA_CUTOUT && texCoord.offset >= 0) {
+		glVertexAttribPointer(2, texCoord.components, texCoord.type, texCoord.normalized, texCoord.stride, (void*)(size_t)texCoord.offset);
+		glEnableVertexAttribArray(2);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBindVertexArray(0);
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "mesh.h"
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// bounds of one mesh of a cached model file, with the vertex count and a hash of the positions
+// they were computed from
+struct CachedBounds {
+	int vertexCount;
+	unsigned long long positionHash;
+	Bounds bounds;
+};
+
+// meshes whose normals or tangents were generated, saved to disk and keyed by a hash of the
+// geometry they were generated from and the settings, so the generation runs once per mesh
+// the bounds of a model's meshes are kept too, keyed by its file
+class MeshCache {
+public:
+	// statistics of this launch, meshes are looked up from worker threads
+	atomic<int> hits{ 0 };
+	atomic<int> misses{ 0 };
+
+	MeshCache(string directory = "mesh_cache") {
+		this->directory = directory;
+	}
+
+	void setEnabled(bool enabled) {
+		this->enabled = enabled;
+	}
+
+	bool isEnabled() {
+		return enabled;
+	}
+
+	// key of a mesh: its vertices and indices as read from the file and what is generated from them
+	unsigned long long meshKey(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const string& settings) {
+		TraceZone zone("MeshCache::meshKey");
+		unsigned long long hash = FNV_OFFSET;
+		hash = fnv1a(hash, to_string(VERSION) + settings);
+		hash = mix(hash ^ hashBytes(vertices.data(), sizeof(Vertex) * vertices.size()));
+		hash = mix(hash ^ hashBytes(indices.data(), sizeof(unsigned int) * indices.size()));
+		return hash;
+	}
+
+	// replace the mesh with the cached one, false when there is none or it is damaged
+	bool load(unsigned long long key, vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents) {
+		if (!enabled)
+			return false;
+		TraceZone zone("MeshCache::load");
+
+		ifstream file(entryPath(key), ios::binary | ios::ate);
+		if (!file) {
+			misses++;
+			return false;
+		}
+		long long fileBytes = file.tellg();
+		file.seekg(0);
+
+		Header header;
+		file.read((char*)&header, sizeof(header));
+		bool valid = file && memcmp(header.magic, MAGIC, 4) == 0 && header.version == VERSION && header.key == key &&
+			fileBytes == (long long)sizeof(header) + entryBytes(header);
+		if (valid) {
+			vector<Vertex> cachedVertices(header.vertexCount);
+			vector<unsigned int> cachedIndices(header.indexCount);
+			vector<vec4> cachedTangents(header.tangentCount);
+			file.read((char*)cachedVertices.data(), sizeof(Vertex) * header.vertexCount);
+			file.read((char*)cachedIndices.data(), sizeof(unsigned int) * header.indexCount);
+			file.read((char*)cachedTangents.data(), sizeof(vec4) * header.tangentCount);
+			valid = (bool)file;
+			if (valid) {
+				vertices.swap(cachedVertices);
+				indices.swap(cachedIndices);
+				tangents.swap(cachedTangents);
+			}
+		}
+		file.close();
+
+		// written by another version or cut short, generated again and overwritten
+		if (!valid) {
+			misses++;
+			remove(entryPath(key).c_str());
+			return false;
+		}
+		hits++;
+		return true;
+	}
+
+	void store(unsigned long long key, const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<vec4>& tangents) {
+		if (!enabled)
+			return;
+		TraceZone zone("MeshCache::store");
+
+		Header header;
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.key = key;
+		header.vertexCount = vertices.size();
+		header.indexCount = indices.size();
+		header.tangentCount = tangents.size();
+
+		makeDirectory(directory);
+		ofstream file(entryPath(key), ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)vertices.data(), sizeof(Vertex) * vertices.size());
+		file.write((const char*)indices.data(), sizeof(unsigned int) * indices.size());
+		file.write((const char*)tangents.data(), sizeof(vec4) * tangents.size());
+	}
+
+	// key of what is cached for a model file, changes with the file's size and modification time
+	// and the settings the meshes were built with, 0 when the file can not be found
+	unsigned long long fileKey(const string& path, const string& settings) {
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return 0;
+		return fnv1a(FNV_OFFSET, to_string(VERSION) + " " + path + " " + to_string((long long)info.st_size) + " " +
+			to_string((long long)info.st_mtime) + " " + settings);
+	}
+
+	// bounds of every mesh of a model file, false when they were not stored or the file changed
+	bool loadBounds(unsigned long long key, vector<CachedBounds>& bounds) {
+		if (!enabled || key == 0)
+			return false;
+
+		ifstream file(boundsPath(key), ios::binary | ios::ate);
+		if (!file)
+			return false;
+		long long fileBytes = file.tellg();
+		file.seekg(0);
+
+		BoundsHeader header;
+		file.read((char*)&header, sizeof(header));
+		bool valid = file && memcmp(header.magic, MAGIC, 4) == 0 && header.version == VERSION && header.key == key &&
+			fileBytes == (long long)(sizeof(header) + sizeof(CachedBounds) * header.meshCount);
+		if (valid) {
+			bounds.resize(header.meshCount);
+			file.read((char*)bounds.data(), sizeof(CachedBounds) * header.meshCount);
+			valid = (bool)file;
+		}
+		return valid;
+	}
+
+	void storeBounds(unsigned long long key, const vector<CachedBounds>& bounds) {
+		if (!enabled || key == 0)
+			return;
+
+		BoundsHeader header;
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.key = key;
+		header.meshCount = bounds.size();
+
+		makeDirectory(directory);
+		ofstream file(boundsPath(key), ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)bounds.data(), sizeof(CachedBounds) * bounds.size());
+	}
+
+	// murmur3's finalizer
+	static unsigned long long mix(unsigned long long h) {
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// hash of the bytes, hashed in blocks on the thread pool, also keys the mesh dedup
+	static unsigned long long hashBytes(const void* data, size_t bytes) {
+		size_t blockBytes = HASH_BLOCK;
+		size_t blockNum = (bytes + blockBytes - 1) / blockBytes;
+		vector<unsigned long long> blockHashes(blockNum);
+		const unsigned char* p = (const unsigned char*)data;
+		ThreadPool::instance().parallelFor(blockNum, [&, p](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				blockHashes[i] = hashBlock(p + i * blockBytes, std::min(blockBytes, bytes - i * blockBytes));
+			}
+		}, 1);
+		unsigned long long hash = mix(bytes);
+		for (unsigned long long blockHash : blockHashes) {
+			hash = mix(hash ^ blockHash);
+		}
+		return hash;
+	}
+
+	void printStats() {
+		if (hits + misses == 0)
+			return;
+		cout << "generated normals and tangents: " << hits << " meshes from mesh cache, " << misses << " generated" << endl;
+	}
+
+private:
+	struct Header {
+		char magic[4];
+		int version;
+		unsigned long long key;
+		unsigned long long vertexCount;
+		unsigned long long indexCount;
+		unsigned long long tangentCount;
+	};
+	struct BoundsHeader {
+		char magic[4];
+		int version;
+		unsigned long long key;
+		unsigned long long meshCount;
+	};
+	const char* MAGIC = "OMVM";
+	// bumped when the generated data changes, old entries then miss
+	static const int VERSION = 3;
+	static const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+	static const unsigned long long FNV_PRIME = 1099511628211ULL;
+	// hashed in parallel, a block size independent of the thread count keeps keys stable
+	static const size_t HASH_BLOCK = 1 << 20;
+
+	string directory;
+	bool enabled = true;
+
+	static long long entryBytes(const Header& header) {
+		return (long long)(sizeof(Vertex) * header.vertexCount + sizeof(unsigned int) * header.indexCount + sizeof(vec4) * header.tangentCount);
+	}
+
+	unsigned long long fnv1a(unsigned long long hash, const string& data) {
+		for (unsigned char c : data) {
+			hash ^= c;
+			hash *= FNV_PRIME;
+		}
+		return hash;
+	}
+
+	// 8 bytes at a time, fnv1a byte by byte would take longer than generating the normals
+	static unsigned long long hashBlock(const unsigned char* data, size_t bytes) {
+		unsigned long long h = 0x9E3779B97F4A7C15ULL ^ bytes;
+		size_t i = 0;
+		for (; i + 8 <= bytes; i += 8) {
+			unsigned long long word;
+			memcpy(&word, data + i, 8);
+			h ^= word * 0x87C37B91114253D5ULL;
+			h = ((h << 31) | (h >> 33)) * 0x4CF5AD432745937FULL;
+		}
+		unsigned long long tail = 0;
+		memcpy(&tail, data + i, bytes - i);
+		return mix(h ^ tail);
+	}
+
+	string entryPath(unsigned long long key) {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.mesh", key);
+		return directory + "/" + name;
+	}
+
+	string boundsPath(unsigned long long key) {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bounds", key);
+		return directory + "/" + name;
+	}
+
+	static void makeDirectory(const string& path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+};
+
+MeshCache meshCache;
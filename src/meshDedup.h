@@ -0,0 +1,229 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+
+#include "mesh.h"
+#include "meshCache.h"
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// meshes of identical geometry, such as the same bolt exported many times with its transform
+// baked into the vertices, are kept once and drawn at the place of every copy
+struct DedupSettings {
+	bool enabled = true;
+	// how far a copy's vertices may be from the moved original's, relative to the mesh size
+	float tolerance = 1e-4f;
+	// normals and tangents of a copy may differ by this much after the rotation
+	float directionTolerance = 1e-3f;
+};
+
+DedupSettings dedupSettings;
+
+// mesh copy found to be original moved by transform, which is rotation and translation only
+struct MeshCopy {
+	int original;
+	int copy;
+	mat4 transform;
+};
+
+// what does not change when a mesh is moved, meshes of different keys are never compared
+struct DedupKey {
+	// 0 for meshes not deduplicated, those read in place from their file
+	unsigned long long key = 0;
+	// distance of the farthest vertex from the first one
+	float radius = 0;
+};
+
+// an original that copies are compared against: its first vertex and a frame of two more, chosen
+// far apart so the rotation is fitted from long edges
+struct DedupOriginal {
+	int mesh;
+	int farVertex = 0;
+	int sideVertex = 0;
+	// no side vertex, all vertices lie on a line or in one point, so only a translation is fitted
+	bool flat = false;
+};
+
+// originals with one key a mesh is compared against before it becomes an original itself, bounds
+// the work for many different meshes of the same topology such as quads
+const int DEDUP_MAX_ORIGINALS = 16;
+
+inline bool sameMaterial(const Material& a, const Material& b) {
+	return a.diffuse_texture == b.diffuse_texture && a.diffuse_color == b.diffuse_color && a.alpha_mode == b.alpha_mode &&
+		a.specular_texture == b.specular_texture && a.specular_color == b.specular_color &&
+		a.shininess == b.shininess && a.shininess_strength == b.shininess_strength;
+}
+
+// indices, texture coordinates and material hashed exactly, positions and normals are moved
+// with the mesh and only compared
+inline DedupKey dedupKey(const Mesh& mesh) {
+	DedupKey key;
+	const vector<Vertex>& vertices = mesh.vertices;
+	if (vertices.empty())
+		return key;
+
+	vector<vec2> texCoords(vertices.size());
+	vec3 first = vertices[0].Position;
+	float farthest = 0;
+	for (int i = 0; i < vertices.size(); i++) {
+		texCoords[i] = vertices[i].TexCoord;
+		vec3 d = vertices[i].Position - first;
+		farthest = glm::max(farthest, dot(d, d));
+	}
+	key.radius = sqrt(farthest);
+
+	const Material& mat = mesh.mat;
+	unsigned long long hash = MeshCache::mix(vertices.size() * 2 + (mesh.tangents.empty() ? 0 : 1));
+	hash = MeshCache::mix(hash ^ MeshCache::hashBytes(mesh.indices.data(), sizeof(unsigned int) * mesh.indices.size()));
+	hash = MeshCache::mix(hash ^ MeshCache::hashBytes(texCoords.data(), sizeof(vec2) * texCoords.size()));
+	hash = MeshCache::mix(hash ^ mat.diffuse_texture ^ ((unsigned long long)mat.specular_texture << 32));
+	// 0 marks meshes not deduplicated
+	key.key = hash != 0 ? hash : 1;
+	return key;
+}
+
+inline DedupOriginal dedupOriginal(const vector<Mesh>& meshes, int meshIndex) {
+	DedupOriginal original;
+	original.mesh = meshIndex;
+	const vector<Vertex>& vertices = meshes[meshIndex].vertices;
+	vec3 first = vertices[0].Position;
+	float farthest = 0;
+	for (int i = 1; i < vertices.size(); i++) {
+		vec3 d = vertices[i].Position - first;
+		if (dot(d, d) > farthest) {
+			farthest = dot(d, d);
+			original.farVertex = i;
+		}
+	}
+	vec3 axis = vertices[original.farVertex].Position - first;
+	float widest = 0;
+	for (int i = 1; i < vertices.size(); i++) {
+		vec3 side = cross(axis, vertices[i].Position - first);
+		if (dot(side, side) > widest) {
+			widest = dot(side, side);
+			original.sideVertex = i;
+		}
+	}
+	// the side is too short next to the axis to give a direction
+	original.flat = widest <= 1e-8f * farthest * farthest;
+	return original;
+}
+
+// orthonormal frame of a mesh's first vertex to its far and side vertices
+inline mat3 dedupFrame(const vector<Vertex>& vertices, const DedupOriginal& original) {
+	vec3 first = vertices[0].Position;
+	vec3 x = normalize(vertices[original.farVertex].Position - first);
+	vec3 z = normalize(cross(x, vertices[original.sideVertex].Position - first));
+	return mat3(x, cross(z, x), z);
+}
+
+// fits the rotation and translation taking the original onto the candidate from the frames and
+// checks it on every vertex
+inline bool matchCopy(const vector<Mesh>& meshes, const DedupOriginal& original, const DedupKey& originalKey, int candidate,
+		const DedupKey& candidateKey, const DedupSettings& settings, mat4& transform) {
+	const Mesh& a = meshes[original.mesh];
+	const Mesh& b = meshes[candidate];
+	if (a.vertices.size() != b.vertices.size() || a.indices.size() != b.indices.size() || a.tangents.size() != b.tangents.size())
+		return false;
+	if (!sameMaterial(a.mat, b.mat) || memcmp(a.indices.data(), b.indices.data(), sizeof(unsigned int) * a.indices.size()) != 0)
+		return false;
+
+	vec3 from = a.vertices[0].Position;
+	vec3 to = b.vertices[0].Position;
+	// rounding of the baked copies grows with their distance from the origin
+	float tolerance = settings.tolerance * originalKey.radius + 1e-6f * (length(from) + length(to));
+	if (abs(originalKey.radius - candidateKey.radius) > tolerance * 2)
+		return false;
+	mat3 rotation = mat3(1);
+	if (!original.flat)
+		rotation = dedupFrame(b.vertices, original) * transpose(dedupFrame(a.vertices, original));
+
+	for (int i = 0; i < a.vertices.size(); i++) {
+		const Vertex& va = a.vertices[i];
+		const Vertex& vb = b.vertices[i];
+		if (va.TexCoord != vb.TexCoord)
+			return false;
+		// written so a rotation of nan, from a candidate without a frame, fails
+		vec3 d = rotation * (va.Position - from) + to - vb.Position;
+		if (!(dot(d, d) <= tolerance * tolerance))
+			return false;
+		vec3 n = rotation * va.Normal - vb.Normal;
+		if (!(dot(n, n) <= settings.directionTolerance * settings.directionTolerance))
+			return false;
+	}
+	for (int i = 0; i < a.tangents.size(); i++) {
+		vec3 t = rotation * vec3(a.tangents[i]) - vec3(b.tangents[i]);
+		if (a.tangents[i].w != b.tangents[i].w || !(dot(t, t) <= settings.directionTolerance * settings.directionTolerance))
+			return false;
+	}
+
+	transform = translate(mat4(1), to) * mat4(rotation) * translate(mat4(1), -from);
+	return true;
+}
+
+// copies among meshes, each of a mesh that is not a copy itself and ordered by copy; the keys are
+// hashed and the meshes of a key compared on the thread pool, meshes without cpu vertices are
+// left alone
+vector<MeshCopy> findMeshCopies(const vector<Mesh>& meshes, const DedupSettings& settings) {
+	TraceZone zone("findMeshCopies");
+	vector<MeshCopy> copies;
+	if (!settings.enabled || meshes.size() < 2)
+		return copies;
+
+	vector<DedupKey> keys(meshes.size());
+	ThreadPool::instance().parallelFor(meshes.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			keys[i] = dedupKey(meshes[i]);
+		}
+	}, 1);
+
+	map<unsigned long long, vector<int>> keyMeshes;
+	for (int i = 0; i < meshes.size(); i++) {
+		if (keys[i].key != 0)
+			keyMeshes[keys[i].key].push_back(i);
+	}
+	vector<vector<int>*> groups;
+	for (auto& entry : keyMeshes) {
+		if (entry.second.size() > 1)
+			groups.push_back(&entry.second);
+	}
+
+	vector<vector<MeshCopy>> groupCopies(groups.size());
+	ThreadPool::instance().parallelFor(groups.size(), [&](int begin, int end) {
+		for (int g = begin; g < end; g++) {
+			vector<DedupOriginal> originals;
+			for (int mesh : *groups[g]) {
+				MeshCopy copy;
+				bool found = false;
+				for (const DedupOriginal& original : originals) {
+					found = matchCopy(meshes, original, keys[original.mesh], mesh, keys[mesh], settings, copy.transform);
+					if (found) {
+						copy.original = original.mesh;
+						copy.copy = mesh;
+						groupCopies[g].push_back(copy);
+						break;
+					}
+				}
+				if (!found && originals.size() < DEDUP_MAX_ORIGINALS)
+					originals.push_back(dedupOriginal(meshes, mesh));
+			}
+		}
+	}, 1);
+
+	for (auto& found : groupCopies) {
+		copies.insert(copies.end(), found.begin(), found.end());
+	}
+	sort(copies.begin(), copies.end(), [](const MeshCopy& a, const MeshCopy& b) {
+		return a.copy < b.copy;
+	});
+	return copies;
+}
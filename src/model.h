@@ -11,75 +11,699 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <cctype>
 #include <limits>
+#include <fstream>
 #include <math.h>
 
 #include "shader.h"
+#include "shaderPermutations.h"
 #include "mesh.h"
+#include "light.h"
+#include "stats.h"
+#include "instanceCuller.h"
+#include "alphaScan.h"
+#include "objLoader.h"
+#include "gltfLoader.h"
+#include "scanLoader.h"
+#include "normals.h"
+#include "nodeTree.h"
+#include "meshCache.h"
+#include "meshDedup.h"
+#include "interleave.h"
+#include "threadPool.h"
+#include "trace.h"
 #include "stb_image.h"
 
 using namespace std;
 using namespace glm;
 
+// time and size of each loading stage, for the load benchmark
+struct ModelLoadStats {
+	// import of the file, by assimp or a native reader
+	float parseMs = 0;
+	long long fileBytes = 0;
+	// assimp meshes to vertices, indices and materials, without the texture work
+	float convertMs = 0;
+	int vertices = 0;
+	int triangles = 0;
+	// stb_image decoding and alpha classification
+	float decodeMs = 0;
+	long long decodedBytes = 0;
+	int textures = 0;
+	// copies of other meshes found and drawn as instances of them
+	float dedupMs = 0;
+	int mergedMeshes = 0;
+	// mesh and model bounds
+	float boundsMs = 0;
+	// cpu time of the buffer and texture uploads, the driver may still be copying afterwards
+	float uploadMs = 0;
+	long long uploadedBytes = 0;
+};
+
 class Model {
 public:
 
-	Model(const char* path) {
+	// without upload nothing touches gl, for measuring the loading on machines without a context
+	Model(const char* path, bool upload = true) {
+		this->upload = upload;
 		loadModel(path);
+
+		CpuTimer timer;
+		timer.begin();
+		instanceCopies();
+		loadStats.dedupMs = timer.end();
+
+		timer.begin();
+		computeMeshBounds(path);
 		modelMat = calculateModelMat();
+		updateMeshBounds();
+		loadStats.boundsMs = timer.end();
+
+		if (upload) {
+			TraceZone zone("Model::upload");
+			timer.begin();
+			for (Mesh& mesh : meshes) {
+				mesh.setupMesh();
+				loadStats.uploadedBytes += mesh.bufferSize();
+			}
+			setupNodeInstances();
+			loadStats.uploadMs += timer.end();
+		}
+		// glb meshes were uploaded straight from the mapped file
+		delete rawSource;
+		rawSource = NULL;
 	};
 
-	void draw(Shader* shader) {
-		shader->setMat4("modelMat", modelMat);
-		for (Mesh mesh : meshes) {
-			mesh.draw(shader);
+	// draw meshes of one alpha mode, opaque and cutout front to back, blended back to front
+	// unless the order does not matter
+	// passKey holds the shader features of the pass, material features are added per mesh
+	// lights, when set, selects the forward lights reaching each mesh for its draw
+	void draw(ShaderPermutations* shaders, unsigned int passKey, AlphaMode mode, vec3 viewPos, LightSet* lights, bool sortByDistance = true) {
+		TraceZone zone("Model::draw");
+		// nothing survived culling
+		if (instances != NULL && instances->visibleCount == 0)
+			return;
+
+		bindCulledInstances();
+		Shader* lastShader = NULL;
+		sortMeshes(mode, viewPos, sortByDistance);
+		for (auto& entry : drawOrder) {
+			Mesh& mesh = meshes[entry.second];
+			Shader* shader = shaders->bind(passKey | materialFeatures(mesh.mat));
+			if (shader != lastShader) {
+				shader->setMat4("modelMat", modelMat);
+				lastShader = shader;
+			}
+			if (lights != NULL)
+				setupMeshLights(shader, lights, entry.second);
+			drawAtNodes(entry.second, shader, instances != NULL ? instances->visibleCount : 0, [shader](Mesh& mesh) {
+				mesh.draw(shader);
+			});
 		}
 	};
 
+	// shader variants this model needs with the given pass features, for warm up
+	void collectShaderKeys(unsigned int passKey, set<unsigned int>& keys) {
+		for (Mesh& mesh : meshes) {
+			unsigned int key = passKey | materialFeatures(mesh.mat);
+			if (mesh.mat.alpha_mode == ALPHA_CUTOUT)
+				key |= FEATURE_ALPHA_CUTOUT;
+			keys.insert(key);
+		}
+	}
+
+	// depth only pass of opaque and cutout meshes, see Mesh::drawDepth
+	void drawDepth(Shader* depthShader, vec3 viewPos) {
+		TraceZone zone("Model::drawDepth");
+		if (instances != NULL && instances->visibleCount == 0)
+			return;
+
+		bindCulledInstances();
+		depthShader->setMat4("modelMat", modelMat);
+		for (AlphaMode mode : { ALPHA_OPAQUE, ALPHA_CUTOUT }) {
+			sortMeshes(mode, viewPos);
+			for (auto& entry : drawOrder) {
+				drawAtNodes(entry.second, depthShader, instances != NULL ? instances->visibleCount : 0, [depthShader](Mesh& mesh) {
+					mesh.drawDepth(depthShader);
+				});
+			}
+		}
+	}
+
+	// opaque and cutout meshes from a light, all instances and not only those visible to the camera
+	void drawShadow(Shader* depthShader) {
+		depthShader->setMat4("modelMat", modelMat);
+		for (int i = 0; i < meshes.size(); i++) {
+			Mesh& mesh = meshes[i];
+			if (mesh.mat.alpha_mode == ALPHA_BLEND)
+				continue;
+			if (instances != NULL)
+				mesh.setInstanceBuffer(instances->sourceVBO);
+			drawAtNodes(i, depthShader, instances != NULL ? instances->transforms.size() : 0, [depthShader](Mesh& mesh) {
+				mesh.drawDepth(depthShader);
+			});
+			if (instances != NULL)
+				mesh.setInstanceBuffer(boundInstanceVBO);
+		}
+	}
+
+	bool hasMeshes(AlphaMode mode) {
+		for (Mesh& mesh : meshes) {
+			if (mesh.mat.alpha_mode == mode)
+				return true;
+		}
+		return false;
+	}
+
+	// draw the model once per transform, an empty list goes back to a single draw
+	void setInstances(const vector<mat4>& transforms) {
+		if (instances != NULL) {
+			for (Mesh& mesh : meshes) {
+				mesh.clearInstanceBuffer();
+			}
+			instances->release();
+			delete instances;
+			instances = NULL;
+		}
+
+		version++;
+		if (transforms.size() == 0) {
+			bindNodeInstances();
+			updateMeshBounds();
+			return;
+		}
+
+		instances = new InstanceSet(transforms);
+		boundInstanceVBO = instances->drawVBO();
+		for (Mesh& mesh : meshes) {
+			mesh.setInstanceBuffer(boundInstanceVBO);
+		}
+		updateMeshBounds();
+	}
+
+	// delete the gl objects, the model can not be drawn afterwards
+	void release() {
+		if (!upload)
+			return;
+		setInstances(vector<mat4>());
+		for (Mesh& mesh : meshes) {
+			mesh.release();
+		}
+		for (NodeInstances& nodeSet : nodeInstances) {
+			if (nodeSet.vbo == 0)
+				continue;
+			glDeleteBuffers(1, &nodeSet.vbo);
+			frameStats.bufferBytes -= sizeof(mat4) * nodeSet.count;
+			nodeSet.vbo = 0;
+		}
+		for (auto& entry : loadedTextures) {
+			// failed loads are stored as -1
+			if (entry.second != (unsigned int)-1)
+				glDeleteTextures(1, &entry.second);
+		}
+		frameStats.textureBytes -= textureBytes;
+		textureBytes = 0;
+	}
+
+	InstanceSet* getInstances() {
+		return instances;
+	}
+
+	const mat4& getModelMat() {
+		return modelMat;
+	}
+
+	// triangles of one instance, meshes count once per node drawing them
+	int getTriangleCount() {
+		int triangles = 0;
+		for (int i = 0; i < meshes.size(); i++) {
+			triangles += meshes[i].getIndexCount() / 3 * (hasNodes(i) ? meshNodes[i].size() : 1);
+		}
+		return triangles;
+	}
+
+	// the file's node hierarchy, empty for formats without one
+	const NodeTree& getNodeTree() {
+		return nodeTree;
+	}
+
+	// move a node relative to its parent, applied by the next updateNodes
+	void setNodeTransform(int node, const mat4& local) {
+		nodeTree.setLocal(node, local);
+	}
+
+	// world transforms of moved nodes and their subtrees, then the instance buffers and bounds
+	// depending on them, once per frame before drawing; nothing is done while no node moves
+	// the model matrix stays, so moving a node does not rescale the model
+	void updateNodes() {
+		vector<pair<int, int>> changed = nodeTree.update();
+		if (changed.empty())
+			return;
+		TraceZone zone("Model::updateNodes");
+
+		vector<char> moved(nodeTree.size(), 0);
+		for (auto& range : changed) {
+			fill(moved.begin() + range.first, moved.begin() + range.second, 1);
+		}
+		for (int i = 0; i < meshNodes.size() && upload; i++) {
+			if (meshNodes[i].size() < 2)
+				continue;
+			for (int node : meshNodes[i]) {
+				if (moved[node]) {
+					uploadNodeInstances(i);
+					break;
+				}
+			}
+		}
+		modelBounds = computeModelBounds();
+		updateBoundSphere(modelMat);
+		updateMeshBounds();
+		version++;
+	}
+
+	const ModelLoadStats& getLoadStats() {
+		return loadStats;
+	}
+
+	// changes whenever the world space geometry does
+	unsigned int getVersion() {
+		return version;
+	}
+
+	// world space bounding sphere of a single, not instanced, model
+	vec3 getBoundCenter() {
+		return boundCenter;
+	}
+
+	float getBoundRadius() {
+		return boundRadius;
+	}
+
+	// model space box and sphere of the whole model, before modelMat
+	const Bounds& getModelBounds() {
+		return modelBounds;
+	}
+
 private:
 	vector<Mesh> meshes;
 	string directory;
 	map<string, unsigned int> loadedTextures;
+	// alpha classification of loaded textures
+	map<unsigned int, AlphaMode> textureAlphaMode;
+	// scratch for draw ordering
+	vector<pair<float, int>> drawOrder;
+	// world space box of each mesh, covering all instances
+	vector<pair<vec3, vec3>> meshBounds;
+	// scratch for per mesh light lists
+	vector<int> meshLights;
 	mat4 modelMat;
+	InstanceSet* instances = NULL;
+	// instance buffer the meshes are bound to
+	unsigned int boundInstanceVBO = 0;
+	unsigned int version = 0;
+	bool upload;
+	ModelLoadStats loadStats;
+	// memory of the uploaded textures
+	long long textureBytes = 0;
+	// open until the meshes referring to its file are uploaded
+	GlbLoader* rawSource = NULL;
+	// node hierarchy of assimp and glb files
+	NodeTree nodeTree;
+	// nodes drawing each mesh, empty when the format has no nodes and the mesh is drawn as it is
+	vector<vector<int>> meshNodes;
 
-	mat4 calculateModelMat() {
-		float maxX, maxY, maxZ, minX, minY, minZ;
-		maxX = maxY = maxZ = numeric_limits<float>::min();
-		minX = minY = minZ = numeric_limits<float>::max();
-
-		for (auto mesh : meshes) {
-			for (auto vertex : mesh.vertices) {
-				if (vertex.Position.x > maxX)
-					maxX = vertex.Position.x;
-				if (vertex.Position.x < minX)
-					minX = vertex.Position.x;
-				if (vertex.Position.y > maxY)
-					maxY = vertex.Position.y;
-				if (vertex.Position.y < minY)
-					minY = vertex.Position.y;
-				if (vertex.Position.z > maxZ)
-					maxZ = vertex.Position.z;
-				if (vertex.Position.z < minZ)
-					minZ = vertex.Position.z;
+	// transforms of a mesh drawn at several nodes as instances, mirrored nodes after the others
+	// since they are drawn with the winding flipped
+	struct NodeInstances {
+		unsigned int vbo = 0;
+		int count = 0;
+		int mirroredStart = 0;
+	};
+	vector<NodeInstances> nodeInstances;
+
+	// pixels of an image, decoded and classified but not yet a texture
+	struct DecodedImage {
+		unsigned char* data = NULL;
+		int width;
+		int height;
+		// channels of data
+		int channels;
+		AlphaMode alphaMode = ALPHA_OPAQUE;
+	};
+
+	vec3 boundCenter;
+	float boundRadius;
+	// model space bounds of all meshes
+	Bounds modelBounds;
+
+	// fill drawOrder with meshes of the given mode, by distance of their center to the viewer
+	void sortMeshes(AlphaMode mode, vec3 viewPos, bool sortByDistance = true) {
+		drawOrder.clear();
+		for (int i = 0; i < meshes.size(); i++) {
+			if (meshes[i].mat.alpha_mode != mode)
+				continue;
+			if (!sortByDistance) {
+				drawOrder.push_back(make_pair(0.0f, i));
+				continue;
+			}
+			vec3 center = meshes[i].boundCenter;
+			if (hasNodes(i))
+				center = vec3(nodeTree.worlds[meshNodes[i][0]] * vec4(center, 1));
+			center = vec3(modelMat * vec4(center, 1));
+			float dist = glm::length(center - viewPos);
+			// blended meshes far to near
+			drawOrder.push_back(make_pair(mode == ALPHA_BLEND ? -dist : dist, i));
+		}
+		if (sortByDistance)
+			sort(drawOrder.begin(), drawOrder.end());
+	}
+
+	void setupMeshLights(Shader* shader, LightSet* lights, int meshIndex) {
+		CpuTimer timer;
+		timer.begin();
+		lights->selectLights(meshBounds[meshIndex].first, meshBounds[meshIndex].second, meshLights);
+		frameStats.lightCullMs += timer.end();
+		frameStats.lightRefs += meshLights.size();
+
+		shader->setInt("meshLightNum", meshLights.size());
+		if (meshLights.size() > 0)
+			shader->setIntArray("meshLights", &meshLights[0], meshLights.size());
+	}
+
+	// transforms do not change between frames, so the boxes are only rebuilt with the instances
+	// and when nodes move
+	void updateMeshBounds() {
+		vector<mat4> transforms;
+		if (instances != NULL)
+			transforms = instances->transforms;
+		else
+			transforms.push_back(mat4(1));
+
+		meshBounds.resize(meshes.size());
+		for (int i = 0; i < meshes.size(); i++) {
+			Bounds local = meshModelBounds(i);
+			vec3 lo = vec3(numeric_limits<float>::max());
+			vec3 hi = vec3(numeric_limits<float>::lowest());
+			for (const mat4& instanceMat : transforms) {
+				Bounds world = transformBounds(local, instanceMat * modelMat);
+				lo = glm::min(lo, world.min);
+				hi = glm::max(hi, world.max);
+			}
+			meshBounds[i] = make_pair(lo, hi);
+		}
+	}
+
+	// the culler switches the buffer the visible instances are drawn from between frames
+	void bindCulledInstances() {
+		if (instances == NULL || instances->drawVBO() == boundInstanceVBO)
+			return;
+		boundInstanceVBO = instances->drawVBO();
+		for (Mesh& mesh : meshes) {
+			mesh.setInstanceBuffer(boundInstanceVBO);
+		}
+	}
+
+	bool hasNodes(int meshIndex) {
+		return meshIndex < meshNodes.size() && !meshNodes[meshIndex].empty();
+	}
+
+	// model space bounds of a mesh at every node drawing it
+	Bounds meshModelBounds(int meshIndex) {
+		Bounds bounds = meshes[meshIndex].getBounds();
+		if (!hasNodes(meshIndex))
+			return bounds;
+		Bounds placed;
+		for (int node : meshNodes[meshIndex]) {
+			placed.add(transformBounds(bounds, nodeTree.worlds[node]));
+		}
+		return placed;
+	}
+
+	Bounds computeModelBounds() {
+		Bounds total;
+		for (int i = 0; i < meshes.size(); i++) {
+			total.add(meshModelBounds(i));
+		}
+		return total;
+	}
+
+	// world space sphere of the model, for culling its instances
+	void updateBoundSphere(const mat4& modelMat) {
+		boundCenter = vec3(modelMat * vec4(modelBounds.center(), 1));
+		// scales uniformly
+		boundRadius = modelMat[0][0] * modelBounds.radius;
+	}
+
+	// draw a mesh at every node drawing it, instanceCount is that of the model's own instances
+	// and 0 without them
+	// a mesh of several nodes is instanced over them while the model is not instanced itself,
+	// otherwise each node is a draw of its own with nodeMat; mirrored nodes flip the winding
+	void drawAtNodes(int meshIndex, Shader* shader, int instanceCount, const function<void(Mesh&)>& drawMesh) {
+		Mesh& mesh = meshes[meshIndex];
+		if (!hasNodes(meshIndex)) {
+			shader->setMat4("nodeMat", mat4(1));
+			mesh.setInstanceCount(instanceCount);
+			drawMesh(mesh);
+			return;
+		}
+
+		NodeInstances& nodeSet = nodeInstances[meshIndex];
+		if (instances == NULL && nodeSet.vbo != 0) {
+			shader->setMat4("nodeMat", mat4(1));
+			bool mixed = nodeSet.mirroredStart > 0 && nodeSet.mirroredStart < nodeSet.count;
+			if (nodeSet.mirroredStart > 0) {
+				if (mixed)
+					mesh.setInstanceBuffer(nodeSet.vbo, 0);
+				mesh.setInstanceCount(nodeSet.mirroredStart);
+				drawMesh(mesh);
+			}
+			if (nodeSet.mirroredStart < nodeSet.count) {
+				if (mixed)
+					mesh.setInstanceBuffer(nodeSet.vbo, nodeSet.mirroredStart);
+				mesh.setInstanceCount(nodeSet.count - nodeSet.mirroredStart);
+				drawMirrored([&]() {
+					drawMesh(mesh);
+				});
+			}
+			return;
+		}
+
+		for (int node : meshNodes[meshIndex]) {
+			const mat4& world = nodeTree.worlds[node];
+			shader->setMat4("nodeMat", world);
+			mesh.setInstanceCount(instanceCount);
+			if (determinant(mat3(world)) < 0)
+				drawMirrored([&]() {
+					drawMesh(mesh);
+				});
+			else
+				drawMesh(mesh);
+		}
+	}
+
+	// a mirroring transform turns front faces into back faces
+	static void drawMirrored(const function<void()>& draw) {
+		GLint frontFace;
+		glGetIntegerv(GL_FRONT_FACE, &frontFace);
+		glFrontFace(frontFace == GL_CCW ? GL_CW : GL_CCW);
+		draw();
+		glFrontFace(frontFace);
+	}
+
+	// instance buffers of the meshes drawn at several nodes
+	void setupNodeInstances() {
+		nodeInstances.resize(meshes.size());
+		for (int i = 0; i < meshNodes.size(); i++) {
+			if (meshNodes[i].size() > 1)
+				uploadNodeInstances(i);
+		}
+		bindNodeInstances();
+	}
+
+	// instances apply outside the model matrix and nodes inside it, so a node transform becomes
+	// modelMat * world * inverse(modelMat)
+	void uploadNodeInstances(int meshIndex) {
+		NodeInstances& nodeSet = nodeInstances[meshIndex];
+		mat4 inverseModelMat = inverse(modelMat);
+		vector<mat4> transforms;
+		for (bool mirrored : { false, true }) {
+			nodeSet.mirroredStart = transforms.size();
+			for (int node : meshNodes[meshIndex]) {
+				const mat4& world = nodeTree.worlds[node];
+				if ((determinant(mat3(world)) < 0) == mirrored)
+					transforms.push_back(modelMat * world * inverseModelMat);
+			}
+		}
+		// the node count of a mesh does not change, the buffer is only rewritten
+		if (nodeSet.vbo == 0) {
+			glGenBuffers(1, &nodeSet.vbo);
+			frameStats.bufferBytes += sizeof(mat4) * transforms.size();
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, nodeSet.vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * transforms.size(), &transforms[0], GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		nodeSet.count = transforms.size();
+	}
+
+	void bindNodeInstances() {
+		for (int i = 0; i < nodeInstances.size(); i++) {
+			if (nodeInstances[i].vbo != 0)
+				meshes[i].setInstanceBuffer(nodeInstances[i].vbo);
+		}
+	}
+
+	// a mesh that is a moved copy of another is removed and the other drawn in its place: at a new
+	// leaf under each node of the copy, or at a new root for formats without nodes, in which case
+	// the original gets a root of its own too
+	void instanceCopies() {
+		vector<MeshCopy> copies = findMeshCopies(meshes, dedupSettings);
+		if (copies.empty())
+			return;
+		TraceZone zone("Model::instanceCopies");
+
+		meshNodes.resize(meshes.size());
+		vector<pair<int, mat4>> leaves;
+		// mesh drawn at each leaf
+		vector<int> leafMeshes;
+		vector<char> isCopy(meshes.size(), 0);
+		vector<char> rooted(meshes.size(), 0);
+		for (const MeshCopy& copy : copies) {
+			isCopy[copy.copy] = 1;
+			if (meshNodes[copy.original].empty() && !rooted[copy.original]) {
+				rooted[copy.original] = 1;
+				leaves.push_back(make_pair(-1, mat4(1)));
+				leafMeshes.push_back(copy.original);
+			}
+			if (meshNodes[copy.copy].empty()) {
+				leaves.push_back(make_pair(-1, copy.transform));
+				leafMeshes.push_back(copy.original);
+			}
+			for (int node : meshNodes[copy.copy]) {
+				leaves.push_back(make_pair(node, copy.transform));
+				leafMeshes.push_back(copy.original);
+			}
+		}
+
+		vector<int> oldToNew;
+		vector<int> leafNodes = nodeTree.addLeaves(leaves, oldToNew);
+		for (vector<int>& nodes : meshNodes) {
+			for (int& node : nodes) {
+				node = oldToNew[node];
+			}
+		}
+		for (int i = 0; i < leaves.size(); i++) {
+			meshNodes[leafMeshes[i]].push_back(leafNodes[i]);
+		}
+
+		int kept = 0;
+		for (int i = 0; i < meshes.size(); i++) {
+			if (isCopy[i])
+				continue;
+			if (kept != i) {
+				meshes[kept] = move(meshes[i]);
+				meshNodes[kept] = move(meshNodes[i]);
+			}
+			kept++;
+		}
+		meshes.erase(meshes.begin() + kept, meshes.end());
+		meshNodes.resize(kept);
+		loadStats.mergedMeshes = copies.size();
+		cout << "instanced " << copies.size() << " copies of other meshes, " << kept << " meshes left" << endl;
+	}
+
+	// box and sphere of every mesh, the meshes in parallel, read from the mesh cache when the file
+	// and the settings did not change since they were computed and the positions still match
+	void computeMeshBounds(const string& path) {
+		TraceZone zone("Model::computeMeshBounds");
+		// dedup drops meshes and the normal and tangent generation splits vertices, both change what is bound
+		char dedup[64];
+		snprintf(dedup, sizeof(dedup), "dedup %d %g %g", dedupSettings.enabled, dedupSettings.tolerance, dedupSettings.directionTolerance);
+		string settings = string(dedup) + ", " + normalSettings.describe() + (normalSettings.generateTangents ? ", tangents" : "");
+		unsigned long long key = meshCache.fileKey(path, settings);
+
+		// hashed before the cache is read, the hashes are stored with newly computed bounds too
+		vector<unsigned long long> hashes(meshes.size(), 0);
+		if (key != 0 && meshCache.isEnabled()) {
+			ThreadPool::instance().parallelFor(meshes.size(), [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					hashes[i] = positionHash(meshes[i]);
+				}
+			}, 1);
+		}
+		vector<CachedBounds> cached;
+		if (meshCache.loadBounds(key, cached) && cached.size() == meshes.size()) {
+			bool matches = true;
+			for (int i = 0; i < meshes.size() && matches; i++) {
+				matches = cached[i].vertexCount == meshes[i].getVertexCount() && cached[i].positionHash == hashes[i];
+			}
+			if (matches) {
+				for (int i = 0; i < meshes.size(); i++) {
+					meshes[i].setBounds(cached[i].bounds);
+				}
+				return;
 			}
 		}
 
+		ThreadPool::instance().parallelFor(meshes.size(), [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				meshes[i].computeBounds();
+			}
+		}, 1);
+
+		cached.resize(meshes.size());
+		for (int i = 0; i < meshes.size(); i++) {
+			cached[i].vertexCount = meshes[i].getVertexCount();
+			cached[i].positionHash = hashes[i];
+			cached[i].bounds = meshes[i].getBounds();
+		}
+		meshCache.storeBounds(key, cached);
+	}
+
+	// hash of what the bounds of a mesh are computed from, the positions, or the box from the
+	// file for meshes whose vertices are not read on the cpu, their bounds are that box
+	static unsigned long long positionHash(Mesh& mesh) {
+		if (mesh.vertices.empty()) {
+			mesh.computeBounds();
+			Bounds bounds = mesh.getBounds();
+			return MeshCache::mix(MeshCache::hashBytes(&bounds.min, sizeof(vec3)) ^ MeshCache::hashBytes(&bounds.max, sizeof(vec3)) * 31);
+		}
+		vector<vec3> positions(mesh.vertices.size());
+		for (size_t i = 0; i < positions.size(); i++) {
+			positions[i] = mesh.vertices[i].Position;
+		}
+		return MeshCache::hashBytes(positions.data(), sizeof(vec3) * positions.size());
+	}
+
+	// from the mesh bounds at their nodes, no vertex is read
+	mat4 calculateModelMat() {
+		modelBounds = computeModelBounds();
+		vec3 center = modelBounds.center();
+
 		mat4 modelMat = glm::mat4(1);
 		// scale it to fill 10x10x10 cube
-		float xScale = 10 / (maxX - minX);
-		float yScale = 10 / (maxY - minY);
-		float zScale = 10 / (maxZ - minZ);
-		float scale = glm::min(xScale, glm::min(yScale, zScale));
+		vec3 size = modelBounds.max - modelBounds.min;
+		float scale = 10 / glm::max(size.x, glm::max(size.y, size.z));
 		modelMat = glm::scale(modelMat, vec3(scale, scale, scale));
 		// move model to center
-		modelMat = glm::translate(modelMat, vec3((minX + maxX)/2, -minY, (minZ + maxZ)/2));
+		modelMat = glm::translate(modelMat, vec3(center.x, -modelBounds.min.y, center.z));
 
+		updateBoundSphere(modelMat);
 		return modelMat;
 	}
 
 	void loadModel(string path);
-	void processNode(aiNode* node, const aiScene* scene);
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
+	bool loadObj(const string& path);
+	bool loadGlb(const string& path);
+	template<class ScanLoader>
+	bool loadScan(const string& path);
+	vector<unsigned int> loadGlbImages(GlbLoader& loader);
+	void processScene(const aiScene* scene);
+	void processNode(aiNode* node, const aiScene* scene, int parent, vector<int>& meshOfScene, vector<aiMesh*>& sceneMeshes);
+	static void processMesh(aiMesh* mesh, vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents);
+	static void completeVertexData(vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents, bool hasNormals, bool hasTexCoords);
 
 	void loadMaterials(aiMaterial* aiMtl, Material& mtl) {
 		// diffuse
@@ -90,6 +714,38 @@ private:
 		loadColor(aiMtl, mtl.specular_color, AI_MATKEY_COLOR_SPECULAR);
 		loadFloat(aiMtl, mtl.shininess, AI_MATKEY_SHININESS);
 		loadFloat(aiMtl, mtl.shininess_strength, AI_MATKEY_SHININESS_STRENGTH);
+		finishMaterial(mtl);
+	}
+
+	// same as loadMaterials for a material of the native obj reader
+	void loadObjMaterial(const ObjMaterial& objMtl, Material& mtl) {
+		if (!objMtl.diffuseTexture.empty())
+			loadTexture(objMtl.diffuseTexture, 4, mtl.diffuse_texture);
+		mtl.diffuse_color = objMtl.diffuse;
+		if (!objMtl.specularTexture.empty())
+			loadTexture(objMtl.specularTexture, 3, mtl.specular_texture);
+		mtl.specular_color = objMtl.specular;
+		mtl.shininess = objMtl.shininess;
+		finishMaterial(mtl);
+	}
+
+	// metallic roughness approximated for the phong shading: rough surfaces get a wide dim
+	// highlight, metals one tinted by their base color
+	void loadGlbMaterial(const GlbMaterial& glbMtl, const vector<unsigned int>& imageTextures, Material& mtl) {
+		if (glbMtl.baseColorImage >= 0 && imageTextures[glbMtl.baseColorImage] != EMPTY_TEX)
+			mtl.diffuse_texture = imageTextures[glbMtl.baseColorImage];
+		mtl.diffuse_color = vec3(glbMtl.baseColor);
+		float roughness = glm::clamp(glbMtl.roughness, 0.05f, 1.0f);
+		mtl.specular_color = mix(vec3(0.04f), vec3(glbMtl.baseColor), glbMtl.metallic) * (1 - roughness * 0.75f);
+		mtl.shininess = glm::clamp(2 / pow(roughness, 4.0f) - 2, 1.0f, 256.0f);
+		finishMaterial(mtl);
+		// the file states how alpha is used, the texture is not guessed from
+		mtl.alpha_mode = glbMtl.alphaMode;
+	}
+
+	void finishMaterial(Material& mtl) {
+		if (textureAlphaMode.find(mtl.diffuse_texture) != textureAlphaMode.end())
+			mtl.alpha_mode = textureAlphaMode[mtl.diffuse_texture];
 
 		// when diffuse texture is set, diffuse color should not be black
 		if (mtl.diffuse_texture != EMPTY_TEX && glm::length(vec3(mtl.diffuse_color)) < 0.01) {
@@ -117,127 +773,420 @@ private:
 		if (mat->GetTextureCount(type) > 0) {
 			aiString str;
 			mat->GetTexture(type, 0, &str);
-			string name = string(str.C_Str());
-			if (loadedTextures.find(name) != loadedTextures.end()) {
-				texture = loadedTextures[name];
-			}
-			else {
-				int numChannel = 0;
-				if (type == aiTextureType_DIFFUSE)
-					numChannel = 4;
-				else if (type == aiTextureType_SPECULAR)
-					numChannel = 3;
-				texture = readTextureFromFile(name.c_str(), directory, numChannel);
-				loadedTextures[name] = texture;
-			}
+			int numChannel = 0;
+			if (type == aiTextureType_DIFFUSE)
+				numChannel = 4;
+			else if (type == aiTextureType_SPECULAR)
+				numChannel = 3;
+			loadTexture(string(str.C_Str()), numChannel, texture);
+		}
+	}
+
+	// textures are shared by name within the model
+	void loadTexture(const string& name, int numChannel, unsigned int& texture) {
+		if (loadedTextures.find(name) != loadedTextures.end()) {
+			texture = loadedTextures[name];
+		}
+		else {
+			texture = readTextureFromFile(name.c_str(), directory, numChannel);
+			loadedTextures[name] = texture;
 		}
 	}
 
 	unsigned int readTextureFromFile(const char* path, string directory, int expectedChannels) {
 		string fileName = string(path);
 		fileName = directory + "\\" + fileName;
+		TraceZone zone("Model::readTextureFromFile", fileName.c_str());
 
-		unsigned int texture;
-		glGenTextures(1, &texture);
-		cout << "loading texture " << texture << endl;
-		// bind object, set target for following operation
-		glBindTexture(GL_TEXTURE_2D, texture);
-
+		CpuTimer timer;
+		timer.begin();
 		int width, height, nChannel;
 		// stbi_set_flip_vertically_on_load(true);
 		unsigned char* data = stbi_load(fileName.c_str(), &width, &height, &nChannel, expectedChannels);
+		DecodedImage image;
+		bool decoded = finishDecode(data, width, height, nChannel, expectedChannels, image);
+		loadStats.decodeMs += timer.end();
+		if (!decoded)
+			return -1;
+		return createTexture(image);
+	}
 
+	// checks what stb_image returned and classifies the alpha, safe on worker threads
+	static bool finishDecode(unsigned char* data, int width, int height, int nChannel, int expectedChannels, DecodedImage& image) {
 		if (expectedChannels == 0)
 			expectedChannels = nChannel;
 
-		if (data) {
-			GLenum format;
-			if (expectedChannels == 3) {
-				format = GL_RGB;
-			}
-			else if (expectedChannels == 4) {
-				format = GL_RGBA;
-			}
-			else {
-				std::cout << "unknown image format, number of channel: " << nChannel << std::endl;
-				return -1;
-			}
+		if (!data) {
+			std::cout << "fail to load image" << std::endl;
+			return false;
+		}
 
+		if (expectedChannels != 3 && expectedChannels != 4) {
+			std::cout << "unknown image format, number of channel: " << nChannel << std::endl;
+			stbi_image_free(data);
+			return false;
+		}
+
+		image.data = data;
+		image.width = width;
+		image.height = height;
+		image.channels = expectedChannels;
+		if (expectedChannels == 4)
+			image.alphaMode = classifyAlpha(data, width * height);
+		return true;
+	}
+
+	// upload on the main thread, frees the pixels
+	unsigned int createTexture(DecodedImage& image) {
+		int width = image.width;
+		int height = image.height;
+		int expectedChannels = image.channels;
+		AlphaMode alphaMode = image.alphaMode;
+		unsigned char* data = image.data;
+		GLenum format = expectedChannels == 3 ? GL_RGB : GL_RGBA;
+		loadStats.decodedBytes += (long long)width * height * expectedChannels;
+		loadStats.textures++;
+
+		CpuTimer timer;
+		unsigned int texture;
+		if (upload) {
+			timer.begin();
+			glGenTextures(1, &texture);
+			cout << "loading texture " << texture << endl;
+			// bind object, set target for following operation
+			glBindTexture(GL_TEXTURE_2D, texture);
 			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 			glGenerateMipmap(GL_TEXTURE_2D);
-			stbi_image_free(data);
+			long long bytes = textureMemory(width, height, expectedChannels, true);
+			frameStats.textureBytes += bytes;
+			textureBytes += bytes;
+			loadStats.uploadMs += timer.end();
+			loadStats.uploadedBytes += bytes;
 		}
 		else {
-			std::cout << "fail to load image" << std::endl;
-			return -1;
+			// stand in name, distinct per file so materials still share and classify textures
+			texture = EMPTY_TEX + 1 + loadedTextures.size();
 		}
 
+		if (expectedChannels == 4)
+			textureAlphaMode[texture] = alphaMode;
+		stbi_image_free(data);
 		return texture;
 	}
 };
 
 void Model::loadModel(string path) {
+	TraceZone zone("Model::loadModel", path.c_str());
+	directory = path.substr(0, path.find_last_of('\\'));
+
+	// obj, glb, ply and stl files are read natively, assimp stays the reader of everything else
+	string extension = path.substr(path.find_last_of('.') + 1);
+	transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == "obj") {
+		if (loadObj(path))
+			return;
+		cout << "falling back to assimp for " << path << endl;
+	}
+	else if (extension == "glb") {
+		if (loadGlb(path))
+			return;
+		cout << "falling back to assimp for " << path << endl;
+	}
+	else if (extension == "ply" || extension == "stl") {
+		if (extension == "ply" ? loadScan<PlyLoader>(path) : loadScan<StlLoader>(path))
+			return;
+		cout << "falling back to assimp for " << path << endl;
+	}
+
 	Assimp::Importer importer;
+	CpuTimer timer;
+	timer.begin();
 	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+	loadStats.parseMs = timer.end();
+	ifstream file(path, ios::binary | ios::ate);
+	if (file)
+		loadStats.fileBytes = file.tellg();
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 		cout << "assimp loading error " << importer.GetErrorString() << endl;
+		return;
 	}
 
-	directory = path.substr(0, path.find_last_of('\\'));
+	// texture decoding and upload run inside, they are counted in their own stages
+	timer.begin();
+	processScene(scene);
+	loadStats.convertMs = timer.end() - loadStats.decodeMs - loadStats.uploadMs;
+}
+
+bool Model::loadObj(const string& path) {
+	CpuTimer timer;
+	timer.begin();
+	ObjLoader loader;
+	if (!loader.load(path))
+		return false;
+	loadStats.parseMs = timer.end();
+	loadStats.fileBytes = loader.getFileSize();
+
+	// texture decoding and upload run inside, they are counted in their own stages
+	timer.begin();
+	loader.buildMeshes();
+	vector<vector<vec4>> tangents(loader.meshes.size());
+	ThreadPool::instance().parallelFor(loader.meshes.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			ObjMesh& objMesh = loader.meshes[i];
+			completeVertexData(objMesh.vertices, objMesh.indices, tangents[i], objMesh.hasNormals, objMesh.hasTexCoords);
+		}
+	}, 1);
+	vector<Material> materials(loader.materials.size());
+	for (int i = 0; i < materials.size(); i++) {
+		loadObjMaterial(loader.materials[i], materials[i]);
+	}
+	Material defaultMaterial;
+	loadObjMaterial(ObjMaterial(), defaultMaterial);
 
-	processNode(scene->mRootNode, scene);
+	for (int i = 0; i < loader.meshes.size(); i++) {
+		ObjMesh& objMesh = loader.meshes[i];
+		loadStats.vertices += objMesh.vertices.size();
+		loadStats.triangles += objMesh.indices.size() / 3;
+		Material& material = objMesh.material >= 0 ? materials[objMesh.material] : defaultMaterial;
+		meshes.push_back(Mesh(move(objMesh.vertices), move(objMesh.indices), material, move(tangents[i])));
+	}
+	loadStats.convertMs = timer.end() - loadStats.decodeMs - loadStats.uploadMs;
+	return true;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene) {
-	for (int i = 0; i < node->mNumMeshes; i++) {
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+bool Model::loadGlb(const string& path) {
+	CpuTimer timer;
+	timer.begin();
+	GlbLoader* loader = new GlbLoader();
+	if (!loader->load(path)) {
+		delete loader;
+		return false;
 	}
+	loadStats.parseMs = timer.end();
+	loadStats.fileBytes = loader->getFileSize();
 
-	for (int i = 0; i < node->mNumChildren; i++) {
-		processNode(node->mChildren[i], scene);
+	// image decoding and upload run inside, they are counted in their own stages
+	timer.begin();
+	vector<unsigned int> imageTextures = loadGlbImages(*loader);
+	vector<Material> materials(loader->materials.size());
+	for (int i = 0; i < materials.size(); i++) {
+		loadGlbMaterial(loader->materials[i], imageTextures, materials[i]);
 	}
+	Material defaultMaterial;
+	loadGlbMaterial(GlbMaterial(), imageTextures, defaultMaterial);
+
+	// primitives decoded for their missing normals
+	vector<vector<vec4>> tangents(loader->primitives.size());
+	ThreadPool::instance().parallelFor(loader->primitives.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			GlbPrimitive& primitive = loader->primitives[i];
+			if (!primitive.vertices.empty())
+				completeVertexData(primitive.vertices, primitive.indices, tangents[i], false, primitive.hasTexCoords);
+		}
+	}, 1);
+
+	for (int i = 0; i < loader->primitives.size(); i++) {
+		GlbPrimitive& primitive = loader->primitives[i];
+		Material& material = primitive.material >= 0 ? materials[primitive.material] : defaultMaterial;
+		if (!primitive.vertices.empty())
+			meshes.push_back(Mesh(move(primitive.vertices), move(primitive.indices), material, move(tangents[i])));
+		else
+			meshes.push_back(Mesh(primitive.raw, move(primitive.indices), material));
+		meshNodes.push_back(primitive.mesh >= 0 ? loader->meshNodes[primitive.mesh] : vector<int>());
+		loadStats.vertices += meshes.back().getVertexCount();
+		loadStats.triangles += meshes.back().getIndexCount() / 3;
+	}
+	loadStats.convertMs = timer.end() - loadStats.decodeMs - loadStats.uploadMs;
+
+	nodeTree = move(loader->nodeTree);
+	// the buffers are uploaded from the mapped file by the constructor
+	rawSource = loader;
+	return true;
+}
+
+// images used by the materials are decoded on the thread pool and uploaded afterwards,
+// gives the texture of every image, EMPTY_TEX for those not used or not decoded
+vector<unsigned int> Model::loadGlbImages(GlbLoader& loader) {
+	vector<unsigned int> textures(loader.images.size(), EMPTY_TEX);
+	vector<bool> used(loader.images.size(), false);
+	for (const GlbMaterial& material : loader.materials) {
+		if (material.baseColorImage >= 0)
+			used[material.baseColorImage] = true;
+	}
+
+	CpuTimer timer;
+	timer.begin();
+	vector<DecodedImage> images(loader.images.size());
+	vector<char> decoded(loader.images.size(), 0);
+	ThreadPool::instance().parallelFor(loader.images.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			if (!used[i])
+				continue;
+			TraceZone zone("Model::decodeImage");
+			const GlbImage& image = loader.images[i];
+			int width, height, nChannel;
+			unsigned char* data;
+			if (image.data != NULL)
+				data = stbi_load_from_memory(image.data, (int)image.bytes, &width, &height, &nChannel, 4);
+			else
+				data = stbi_load((directory + "\\" + image.uri).c_str(), &width, &height, &nChannel, 4);
+			decoded[i] = finishDecode(data, width, height, nChannel, 4, images[i]);
+		}
+	}, 1);
+	loadStats.decodeMs += timer.end();
+
+	for (int i = 0; i < images.size(); i++) {
+		if (!decoded[i])
+			continue;
+		textures[i] = createTexture(images[i]);
+		// kept with the file textures so release deletes it
+		loadedTextures["#image" + to_string(i)] = textures[i];
+	}
+	return textures;
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
-	vector<Vertex> vertices;
-	vector<unsigned int> indices;
-	Material material;
-	
-	// vertices
-	for (int i = 0; i < mesh->mNumVertices; i++) {
-		Vertex vertex;
-		vertex.Position.x = mesh->mVertices[i].x;
-		vertex.Position.y = mesh->mVertices[i].y;
-		vertex.Position.z = mesh->mVertices[i].z;
+// binary ply and stl scans become a single mesh of the default material
+template<class ScanLoader>
+bool Model::loadScan(const string& path) {
+	CpuTimer timer;
+	timer.begin();
+	ScanLoader loader;
+	if (!loader.load(path))
+		return false;
+	loadStats.parseMs = timer.end();
+	loadStats.fileBytes = loader.getFileSize();
+	if (loader.indices.empty()) {
+		cout << path << " has no triangles" << endl;
+		return false;
+	}
 
-		vertex.Normal.x = mesh->mNormals[i].x;
-		vertex.Normal.y = mesh->mNormals[i].y;
-		vertex.Normal.z = mesh->mNormals[i].z;
+	timer.begin();
+	vector<vec4> tangents;
+	completeVertexData(loader.vertices, loader.indices, tangents, loader.hasNormals, loader.hasTexCoords);
+	loadStats.vertices += loader.vertices.size();
+	loadStats.triangles += loader.indices.size() / 3;
+	meshes.push_back(Mesh(move(loader.vertices), move(loader.indices), Material(), move(tangents)));
+	loadStats.convertMs = timer.end();
+	return true;
+}
 
-		if (mesh->mTextureCoords[0]) {
-			vertex.TexCoord.x = mesh->mTextureCoords[0][i].x;
-			vertex.TexCoord.y = mesh->mTextureCoords[0][i].y;
+void Model::processScene(const aiScene* scene) {
+	TraceZone zone("Model::processScene");
+	// a mesh referenced by several nodes is converted once and drawn at each
+	vector<int> meshOfScene(scene->mNumMeshes, -1);
+	vector<aiMesh*> sceneMeshes;
+	processNode(scene->mRootNode, scene, -1, meshOfScene, sceneMeshes);
+
+	// geometry of the meshes is independent and converted on the thread pool, materials
+	// load textures into gl and stay on this thread
+	vector<vector<Vertex>> vertices(sceneMeshes.size());
+	vector<vector<unsigned int>> indices(sceneMeshes.size());
+	vector<vector<vec4>> tangents(sceneMeshes.size());
+	ThreadPool::instance().parallelFor(sceneMeshes.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			processMesh(sceneMeshes[i], vertices[i], indices[i], tangents[i]);
 		}
-		vertices.push_back(vertex);
+	}, 1);
+
+	// meshes of only points and lines have nothing to draw and are dropped with their nodes
+	vector<vector<int>> sceneMeshNodes;
+	sceneMeshNodes.swap(meshNodes);
+	for (int i = 0; i < sceneMeshes.size(); i++) {
+		if (indices[i].empty())
+			continue;
+		Material material;
+		if (sceneMeshes[i]->mMaterialIndex >= 0)
+			loadMaterials(scene->mMaterials[sceneMeshes[i]->mMaterialIndex], material);
+		loadStats.vertices += vertices[i].size();
+		loadStats.triangles += indices[i].size() / 3;
+		meshes.push_back(Mesh(move(vertices[i]), move(indices[i]), material, move(tangents[i])));
+		meshNodes.push_back(move(sceneMeshNodes[i]));
 	}
+}
 
-	// indices
-	for (int i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
-		for (int j = 0; j < face.mNumIndices; j++) {
-			indices.push_back(face.mIndices[j]);
+// flattens the hierarchy into nodeTree depth first, the meshes of a node are added to
+// sceneMeshes on their first reference and every reference to meshNodes
+void Model::processNode(aiNode* node, const aiScene* scene, int parent, vector<int>& meshOfScene, vector<aiMesh*>& sceneMeshes) {
+	// assimp matrices are row major, and packed so they are copied rather than pointed to
+	mat4 local;
+	memcpy(value_ptr(local), &node->mTransformation, sizeof(mat4));
+	int treeNode = nodeTree.addNode(parent, transpose(local));
+	for (int i = 0; i < node->mNumMeshes; i++) {
+		int sceneMesh = node->mMeshes[i];
+		if (meshOfScene[sceneMesh] < 0) {
+			meshOfScene[sceneMesh] = sceneMeshes.size();
+			sceneMeshes.push_back(scene->mMeshes[sceneMesh]);
+			meshNodes.push_back(vector<int>());
 		}
+		meshNodes[meshOfScene[sceneMesh]].push_back(treeNode);
 	}
 
-	// textures
-	if (mesh->mMaterialIndex >= 0) {
-		aiMaterial* aiMat = scene->mMaterials[mesh->mMaterialIndex];
-		loadMaterials(aiMat, material);
+	for (int i = 0; i < node->mNumChildren; i++) {
+		processNode(node->mChildren[i], scene, treeNode, meshOfScene, sceneMeshes);
 	}
+}
+
+// safe on worker threads, a big mesh is split over the pool again
+void Model::processMesh(aiMesh* mesh, vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents) {
+	TraceZone zone("Model::processMesh", mesh->mName.C_Str());
+	static_assert(sizeof(aiVector3D) == sizeof(vec3), "assimp is built with float vectors");
 
-	return Mesh(vertices, indices, material);
+	// vertices, normals and texture coordinates are optional
+	vertices.resize(mesh->mNumVertices);
+	const float* positions = (const float*)mesh->mVertices;
+	const float* normals = (const float*)mesh->mNormals;
+	const float* texCoords = (const float*)mesh->mTextureCoords[0];
+	Vertex* out = vertices.empty() ? NULL : &vertices[0];
+	ThreadPool::instance().parallelFor(mesh->mNumVertices, [=](int begin, int end) {
+		interleaveVertices(positions, normals, texCoords, out, begin, end);
+	}, 65536);
+
+	// indices, triangulated by assimp, points and lines are not drawn
+	if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+		indices.resize((size_t)mesh->mNumFaces * 3);
+		unsigned int* faceIndices = indices.empty() ? NULL : &indices[0];
+		ThreadPool::instance().parallelFor(mesh->mNumFaces, [=](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				const unsigned int* face = mesh->mFaces[i].mIndices;
+				faceIndices[i * 3] = face[0];
+				faceIndices[i * 3 + 1] = face[1];
+				faceIndices[i * 3 + 2] = face[2];
+			}
+		}, 65536);
+	}
+	else {
+		indices.reserve((size_t)mesh->mNumFaces * 3);
+		for (int i = 0; i < mesh->mNumFaces; i++) {
+			const aiFace& face = mesh->mFaces[i];
+			if (face.mNumIndices == 3)
+				indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
+		}
+	}
+
+	completeVertexData(vertices, indices, tangents, mesh->mNormals != NULL, mesh->mTextureCoords[0] != NULL);
 }
 
+// normals of meshes read without them and tangents when they are asked for, taken from the
+// mesh cache when this mesh was generated before, safe on worker threads
+// a mesh missing some of its normals has them all generated
+void Model::completeVertexData(vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents, bool hasNormals, bool hasTexCoords) {
+	bool needTangents = normalSettings.generateTangents && hasTexCoords;
+	if ((hasNormals && !needTangents) || vertices.empty() || indices.empty())
+		return;
+	TraceZone zone("Model::completeVertexData");
 
+	unsigned long long key = 0;
+	if (meshCache.isEnabled()) {
+		string settings = (hasNormals ? string("file normals") : normalSettings.describe()) + (needTangents ? ", tangents" : "");
+		key = meshCache.meshKey(vertices, indices, settings);
+		if (meshCache.load(key, vertices, indices, tangents))
+			return;
+	}
+
+	if (!hasNormals)
+		generateNormals(vertices, indices, normalSettings);
+	if (needTangents)
+		generateTangents(vertices, indices, tangents);
+	meshCache.store(key, vertices, indices, tangents);
+}
@@ -8,16 +8,29 @@
 
 #include "camera.h"
 #include "shader.h"
+#include "shaderPermutations.h"
 #include "plain.h"
 #include "model.h"
 #include "light.h"
+#include "clusteredLights.h"
+#include "shadowAtlas.h"
+#include "deferred.h"
+#include "instanceCuller.h"
+#include "stats.h"
+#include "trace.h"
+#include "oit.h"
 #include "global.h"
 
 class ModelViewer {
 public:
 	ModelViewer(Camera* camera) {
 		this->camera = camera;
-		this->shader = new Shader("shaders/vt.glsl", "shaders/fg.glsl");
+		this->shaders = new ShaderPermutations("shaders/vt.glsl", "shaders/fg.glsl");
+		shaders->setFrameSetup([this](Shader* shader) {
+			setupFrameUniforms(shader);
+		});
+		this->depthShader = new Shader("shaders/depth_vt.glsl", "shaders/depth_fg.glsl");
+		this->gpuTimer = new GpuTimer();
 
 		// create an 1x1 texture, the id should be 1 if it creates first
 		createEmptyTexture();
@@ -28,13 +41,25 @@ public:
 		glEnable(GL_CULL_FACE);
 		glfwWindowHint(GLFW_SAMPLES, 4);
 		glEnable(GL_MULTISAMPLE);
-		glEnable(GL_BLEND);
+		// blending is only enabled for the translucent pass
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+		// not instanced meshes read the current value of the instance attributes, keep it identity
+		for (int i = 0; i < 4; i++) {
+			vec4 column = vec4(0);
+			column[i] = 1;
+			glVertexAttrib4fv(3 + i, glm::value_ptr(column));
+		}
+
 		lights.addLight(Light::createSpotlight(vec3(10, 2, 10), vec3(-1, 0.5, -1), 90));
 		lights.addLight(Light::createSpotlight(vec3(-10, 2, 10), vec3(1, 0.5, -1), 90));
 
 		this->plain = new Plain();
+		this->culler = new InstanceCuller();
+		this->oit = new OitTarget();
+		this->clusters = new LightClusters();
+		this->shadows = new ShadowAtlas();
+		this->deferredRenderer = new DeferredRenderer();
 
 		if (modelPaths.size() == 0) {
 			cout << "no model specified" << endl;
@@ -43,24 +68,118 @@ public:
 		for (string path : modelPaths) {
 			models.push_back(Model(path.c_str()));
 		}
+
+		// compile the variants of the default state now instead of during the first frames
+		set<unsigned int> keys;
+		for (Model& model : models) {
+			model.collectShaderKeys(lightingKey(0), keys);
+		}
+		shaders->warmUp(vector<unsigned int>(keys.begin(), keys.end()));
 	}
 
 	void renderLoop() {
+		TraceZone zone("ModelViewer::renderLoop");
+		cpuTimer.begin();
+		gpuTimer->begin();
+		frameStats.beginFrame();
+		frameStats.depthPrepass = depthPrepass;
+		frameStats.lights = lights.size();
+		frameStats.lightingPath = deferred ? "deferred" : clusteredLighting ? "clustered" : "forward";
+		frameStats.shadedLights = deferred || clusteredLighting ? lights.size() : lights.forwardCount();
+
 		glClearColor(bgColor.r, bgColor.g, bgColor.b, bgColor.a);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		shader->use();
-		shader->setVec3("viewPos", camera->getViewPos());
-		shader->setMat4("viewMat", camera->getViewMat());
-		shader->setMat4("projectMat", camera->getProjectMat());
-		shader->setVec3("fog_color", bgColor);
-		shader->setBool("flip_y", flipY);
+		shaders->beginFrame();
+		if (clusteredLighting)
+			clusters->update(&lights, camera);
 
-		lights.setupLights(shader);
-		
-		plain->draw(shader);
+		Model& model = models[curModel];
+		// moved nodes, before anything reads the model's transforms or bounds
+		model.updateNodes();
+
+		// cached, only renders when a light or the model changed
+		CpuTimer stageTimer;
+		stageTimer.begin();
+		depthShader->use();
+		depthShader->setBool("flip_y", flipY);
+		shadows->update(&lights, &model, depthShader);
+		frameStats.addStageTime(frameStats.shadowMs, stageTimer.end());
+
+		plain->draw(camera, &lights, bgColor);
+
+		stageTimer.begin();
+		InstanceSet* instances = model.getInstances();
+		if (instances != NULL) {
+			culler->cull(instances, model.getBoundCenter(), model.getBoundRadius(), camera);
+			frameStats.trianglesCulled = model.getTriangleCount() * (instances->transforms.size() - instances->visibleCount);
+		}
+		frameStats.addStageTime(frameStats.cullMs, stageTimer.end());
+
+		stageTimer.begin();
+
+		// lay down depth first, so the lighting shader runs once per visible pixel
+		if (depthPrepass) {
+			depthShader->use();
+			depthShader->setMat4("viewMat", camera->getViewMat());
+			depthShader->setMat4("projectMat", camera->getProjectMat());
+			depthShader->setBool("flip_y", flipY);
+
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			model.drawDepth(depthShader, camera->getViewPos());
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+			glDepthFunc(GL_LEQUAL);
+			glDepthMask(GL_FALSE);
+		}
 
-		models[curModel].draw(shader);
+		vec3 viewPos = camera->getViewPos();
+		unsigned int passKey = lightingKey(flipY ? FEATURE_FLIP_Y : 0);
+		// forward variants get the lights of each mesh per draw
+		LightSet* meshLights = clusteredLighting ? NULL : &lights;
+
+		if (deferred) {
+			// opaque and alpha tested into the G-buffer, then lit once per light
+			unsigned int gbufferKey = shaderKey((flipY ? FEATURE_FLIP_Y : 0) | FEATURE_GBUFFER, 0);
+			deferredRenderer->beginGeometry();
+			model.draw(shaders, gbufferKey, ALPHA_OPAQUE, viewPos, NULL);
+			model.draw(shaders, gbufferKey | FEATURE_ALPHA_CUTOUT, ALPHA_CUTOUT, viewPos, NULL);
+			deferredRenderer->light(&lights, camera, bgColor);
+		}
+		else {
+			// opaque
+			model.draw(shaders, passKey, ALPHA_OPAQUE, viewPos, meshLights);
+
+			// alpha tested
+			model.draw(shaders, passKey | FEATURE_ALPHA_CUTOUT, ALPHA_CUTOUT, viewPos, meshLights);
+		}
+
+		// translucent, last and without depth writes
+		if (model.hasMeshes(ALPHA_BLEND)) {
+			if (oitEnabled) {
+				oit->begin();
+				// blending is commutative, no sorting needed
+				model.draw(shaders, passKey | FEATURE_OIT, ALPHA_BLEND, viewPos, meshLights, false);
+				oit->composite();
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			}
+			else {
+				glEnable(GL_BLEND);
+				glDepthMask(GL_FALSE);
+				model.draw(shaders, passKey, ALPHA_BLEND, viewPos, meshLights);
+				glDisable(GL_BLEND);
+			}
+			glDepthMask(depthPrepass ? GL_FALSE : GL_TRUE);
+		}
+
+		if (depthPrepass) {
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+		frameStats.addStageTime(frameStats.submitMs, stageTimer.end());
+
+		float gpuMs = gpuTimer->end();
+		frameStats.endFrame(cpuTimer.end(), gpuMs);
 	}
 
 	// continuous event during press
@@ -76,6 +195,8 @@ public:
 
 		if (key == GLFW_KEY_Y && action == GLFW_PRESS) {
 			flipY = !flipY;
+			// cutout texture coordinates of the shadow casters changed
+			shadows->invalidate();
 		}
 
 		if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS) {
@@ -88,40 +209,136 @@ public:
 				curModel = models.size() - 1;
 		}
 
-		if (key == GLFW_KEY_B && action == GLFW_PRESS) {
-			if (blendEnabled) {
-				glDisable(GL_BLEND);
-				blendEnabled = false;
-			}
-			else {
-				glEnable(GL_BLEND);
-				blendEnabled = true;
+		if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+			instanceGrid = !instanceGrid;
+			for (Model& model : models) {
+				model.setInstances(instanceGrid ? createInstanceGrid() : vector<mat4>());
 			}
 		}
+
+		if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+			culler->setGpuCulling(!culler->isGpuCulling());
+			cout << "instance culling on " << (culler->isGpuCulling() ? "gpu" : "cpu") << endl;
+		}
+
+		if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+			depthPrepass = !depthPrepass;
+		}
+
+		if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+			clusteredLighting = !clusteredLighting;
+		}
+
+		if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+			deferred = !deferred;
+		}
+
+		if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+			if (lights.size() > 2)
+				lights.removePointlights();
+			else
+				addRandomPointlights(256);
+		}
+
+		if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+			plain->setInfinite(!plain->isInfinite());
+		}
+
+		if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+			oitEnabled = !oitEnabled;
+		}
 	}
 
 	void mouseCallback(GLFWwindow* window, float xpos, float ypos) {
 		camera->mouseCallBack(window, xpos, ypos);
 	}
 
+	int modelCount() {
+		return models.size();
+	}
+
+	void setCurrentModel(int index) {
+		curModel = index;
+	}
+
 	void windowSizeChangeCallback(int nWidth, int nHeight) {
 		camera->windowSizeChanged(nWidth, nHeight);
 	}
 
 private:
 	Camera* camera;
-	Shader* shader;
+	ShaderPermutations* shaders;
+	Shader* depthShader;
+
+	CpuTimer cpuTimer;
+	GpuTimer* gpuTimer;
 
 	LightSet lights;
 
 	Plain* plain;
+	InstanceCuller* culler;
+	OitTarget* oit;
+	LightClusters* clusters;
+	ShadowAtlas* shadows;
+	DeferredRenderer* deferredRenderer;
 
 	vector<Model> models;
 	int curModel = 0;
 
 	vec4 bgColor = vec4(0.1, 0.1, 0.1, 1);
 	bool flipY = false;
-	bool blendEnabled = true;
+	// translucent meshes: sorted alpha blending or weighted blended oit
+	bool oitEnabled = false;
+	bool instanceGrid = false;
+	bool depthPrepass = false;
+	bool clusteredLighting = false;
+	// translucent meshes stay forward shaded
+	bool deferred = false;
+
+	// uniforms shared by all variants of the model shader
+	void setupFrameUniforms(Shader* shader) {
+		shader->setVec3("viewPos", camera->getViewPos());
+		shader->setMat4("viewMat", camera->getViewMat());
+		shader->setMat4("projectMat", camera->getProjectMat());
+		shader->setVec3("fog_color", bgColor);
+		lights.setupLights(shader);
+		if (clusteredLighting)
+			clusters->setupShader(shader);
+	}
+
+	// shader key of the lighting path, forward uses a uniform array of LIGHT_COUNT lights
+	unsigned int lightingKey(unsigned int features) {
+		if (clusteredLighting)
+			return shaderKey(features | FEATURE_CLUSTERED, 0);
+		return shaderKey(features, lights.forwardCount());
+	}
+
+	// small colored lights scattered over the floor, for lighting scalability tests
+	void addRandomPointlights(int count) {
+		// fixed seed, so runs are comparable
+		srand(1234);
+		for (int i = 0; i < count; i++) {
+			vec3 pos = vec3(randomRange(-20, 20), randomRange(0.5, 4), randomRange(-20, 20));
+			vec3 color = vec3(randomRange(0.2, 1), randomRange(0.2, 1), randomRange(0.2, 1));
+			lights.addLight(Light::createPointlight(pos, color, randomRange(2, 5)));
+		}
+	}
+
+	float randomRange(float lo, float hi) {
+		return lo + (hi - lo) * rand() / RAND_MAX;
+	}
+
+	// copies of the model on the ground, spaced by more than the 10x10x10 model size
+	vector<mat4> createInstanceGrid(int rows = 32, float spacing = 12) {
+		vector<mat4> transforms;
+		for (int i = 0; i < rows; i++) {
+			for (int j = 0; j < rows; j++) {
+				vec3 offset = vec3(i - rows / 2, 0, j - rows / 2) * spacing;
+				transforms.push_back(glm::translate(mat4(1), offset));
+			}
+		}
+		return transforms;
+	}
 
 	void createEmptyTexture() {
 		glGenTextures(1, &EMPTY_TEX);
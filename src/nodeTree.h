@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// node hierarchy of a file flattened in depth first order: a parent comes before its children
+// and the subtree of node i is the range [i, subtreeEnds[i]), so all world transforms are one
+// forward pass over the arrays and a moved node only recomputes its own range
+class NodeTree {
+public:
+	// transform relative to the parent, the parent is -1 for roots
+	vector<mat4> locals;
+	vector<int> parents;
+	vector<int> subtreeEnds;
+	// model space transform, up to date after update
+	vector<mat4> worlds;
+
+	int size() const {
+		return locals.size();
+	}
+
+	// nodes are added depth first, the subtree of a node right after it
+	int addNode(int parent, const mat4& local) {
+		int node = locals.size();
+		locals.push_back(local);
+		parents.push_back(parent);
+		subtreeEnds.push_back(node + 1);
+		worlds.push_back(parent >= 0 ? worlds[parent] * local : local);
+		for (int ancestor = parent; ancestor >= 0; ancestor = parents[ancestor]) {
+			subtreeEnds[ancestor] = node + 1;
+		}
+		return node;
+	}
+
+	// new leaves under existing nodes, or roots for parent -1, each right after its parent to keep
+	// the depth first order, which renumbers the nodes: oldToNew maps the existing ones and the
+	// new index of every leaf is returned in the order given
+	vector<int> addLeaves(const vector<pair<int, mat4>>& leaves, vector<int>& oldToNew) {
+		vector<vector<int>> leavesOf(size());
+		vector<int> roots;
+		for (int i = 0; i < leaves.size(); i++) {
+			if (leaves[i].first >= 0)
+				leavesOf[leaves[i].first].push_back(i);
+			else
+				roots.push_back(i);
+		}
+
+		NodeTree tree;
+		vector<int> leafNodes(leaves.size());
+		oldToNew.resize(size());
+		for (int i = 0; i < size(); i++) {
+			oldToNew[i] = tree.addNode(parents[i] >= 0 ? oldToNew[parents[i]] : -1, locals[i]);
+			for (int leaf : leavesOf[i]) {
+				leafNodes[leaf] = tree.addNode(oldToNew[i], leaves[leaf].second);
+			}
+		}
+		for (int leaf : roots) {
+			leafNodes[leaf] = tree.addNode(-1, leaves[leaf].second);
+		}
+		for (int node : dirty) {
+			tree.dirty.push_back(oldToNew[node]);
+		}
+		*this = move(tree);
+		return leafNodes;
+	}
+
+	void setLocal(int node, const mat4& local) {
+		locals[node] = local;
+		dirty.push_back(node);
+	}
+
+	// recompute the world transforms under the nodes set since the last update, gives the
+	// ranges of nodes whose world transform changed, sorted and not overlapping
+	vector<pair<int, int>> update() {
+		vector<pair<int, int>> changed;
+		if (dirty.empty())
+			return changed;
+
+		sort(dirty.begin(), dirty.end());
+		int coveredEnd = 0;
+		for (int node : dirty) {
+			// inside a subtree recomputed already
+			if (node < coveredEnd)
+				continue;
+			int end = subtreeEnds[node];
+			for (int i = node; i < end; i++) {
+				worlds[i] = parents[i] >= 0 ? worlds[parents[i]] * locals[i] : locals[i];
+			}
+			changed.push_back(make_pair(node, end));
+			coveredEnd = end;
+		}
+		dirty.clear();
+		return changed;
+	}
+
+private:
+	// set since the last update
+	vector<int> dirty;
+};
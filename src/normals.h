@@ -0,0 +1,419 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NORMALS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include "mesh.h"
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+#ifdef NORMALS_SSE2
+// x, y and z lanes of a vec3 loaded with the float after it
+const __m128 NORMALS_XYZ_MASK = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+// Vertex keeps Position and Normal followed by another float, so 4 lanes can be loaded and
+// stored at once as long as the 4th is masked
+static_assert(offsetof(Vertex, Normal) + sizeof(vec3) < sizeof(Vertex), "Normal is followed by TexCoord");
+
+inline __m128 loadVec3(const vec3& v) {
+	return _mm_loadu_ps(&v.x);
+}
+
+inline __m128 crossVec3(__m128 a, __m128 b) {
+	__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#endif
+
+// how normals and tangents are generated for meshes read without them
+struct NormalSettings {
+	// corners weigh by their angle, so the result does not depend on how a surface is
+	// tessellated, otherwise by the area of their face
+	bool angleWeighted = true;
+	// faces meeting at a sharper angle in degrees keep their own normals, 180 smooths everything
+	float creaseAngle = 180;
+	// tangents of meshes with texture coordinates, only normal maps need them
+	bool generateTangents = false;
+
+	// the normal settings as part of a mesh cache key
+	string describe() const {
+		return string(angleWeighted ? "angle" : "area") + " weighted, crease " + to_string(creaseAngle);
+	}
+};
+
+NormalSettings normalSettings;
+
+// a vertex that gets a normal of a position's corners, kept while its corners are assigned
+struct NormalSplit {
+	unsigned int source;
+	unsigned int vertex;
+	vec3 normal;
+};
+
+inline vec3 safeNormalize(const vec3& v) {
+	float length = glm::length(v);
+	return length > 0 ? v / length : vec3(0);
+}
+
+// angle of a triangle at each of its corners, the triangle is not degenerate
+inline vec3 cornerAngles(const vec3& a, const vec3& b, const vec3& c) {
+	vec3 ab = normalize(b - a);
+	vec3 bc = normalize(c - b);
+	vec3 ca = normalize(a - c);
+	float angleA = acos(glm::clamp(-dot(ca, ab), -1.0f, 1.0f));
+	float angleB = acos(glm::clamp(-dot(ab, bc), -1.0f, 1.0f));
+	return vec3(angleA, angleB, glm::pi<float>() - angleA - angleB);
+}
+
+// unit normal of every face and the weight of each of its corners, degenerate faces get neither
+void computeFaceNormals(const vector<Vertex>& vertices, const vector<unsigned int>& indices, bool angleWeighted,
+	vector<vec3>& faceNormals, vector<vec3>& cornerWeights) {
+	size_t faceNum = indices.size() / 3;
+	faceNormals.resize(faceNum);
+	cornerWeights.resize(faceNum);
+	const Vertex* v = &vertices[0];
+	ThreadPool::instance().parallelFor(faceNum, [&, v](int begin, int end) {
+		for (int f = begin; f < end; f++) {
+			const vec3& a = v[indices[f * 3]].Position;
+			const vec3& b = v[indices[f * 3 + 1]].Position;
+			const vec3& c = v[indices[f * 3 + 2]].Position;
+#ifdef NORMALS_SSE2
+			__m128 pa = loadVec3(a);
+			__m128 face = crossVec3(_mm_sub_ps(loadVec3(b), pa), _mm_sub_ps(loadVec3(c), pa));
+			float lanes[4];
+			_mm_storeu_ps(lanes, face);
+			vec3 normal(lanes[0], lanes[1], lanes[2]);
+#else
+			vec3 normal = cross(b - a, c - a);
+#endif
+			// twice the triangle area
+			float length = glm::length(normal);
+			if (!(length > 0)) {
+				faceNormals[f] = vec3(0);
+				cornerWeights[f] = vec3(0);
+				continue;
+			}
+			faceNormals[f] = normal / length;
+			cornerWeights[f] = angleWeighted ? cornerAngles(a, b, c) : vec3(length);
+		}
+	}, 16384);
+}
+
+// vertices at the same position share an id, so normals are smoothed across uv seams,
+// gives the number of distinct positions
+unsigned int weldPositions(const vector<Vertex>& vertices, vector<unsigned int>& positionIds) {
+	TraceZone zone("weldPositions");
+	const unsigned int EMPTY_SLOT = 0xFFFFFFFF;
+	size_t capacity = 16;
+	while (capacity < vertices.size() * 2)
+		capacity *= 2;
+	// first vertex of every position
+	vector<unsigned int> table(capacity, EMPTY_SLOT);
+	positionIds.resize(vertices.size());
+	unsigned int positionNum = 0;
+	for (unsigned int i = 0; i < vertices.size(); i++) {
+		// adding zero turns -0 into 0, they are the same position
+		vec3 position = vertices[i].Position + vec3(0.0f);
+		unsigned int bits[3];
+		memcpy(bits, &position, sizeof(bits));
+		unsigned long long h = bits[0] * 0x9E3779B97F4A7C15ULL ^ bits[1] * 0xC2B2AE3D27D4EB4FULL ^ bits[2] * 0x165667B19E3779F9ULL;
+		size_t slot = (size_t)(h ^ (h >> 29)) & (capacity - 1);
+		while (table[slot] != EMPTY_SLOT && vertices[table[slot]].Position != position)
+			slot = (slot + 1) & (capacity - 1);
+		if (table[slot] == EMPTY_SLOT) {
+			table[slot] = i;
+			positionIds[i] = positionNum++;
+		}
+		else {
+			positionIds[i] = positionIds[table[slot]];
+		}
+	}
+	return positionNum;
+}
+
+// the corners of every element as one list, element i's in [start[i], start[i + 1]) in the
+// order of the indices, so the sums over them do not depend on the thread count
+void groupCorners(const vector<unsigned int>& elementOfVertex, const vector<unsigned int>& indices, unsigned int elementNum,
+	vector<unsigned int>& start, vector<unsigned int>& corners) {
+	start.assign(elementNum + 1, 0);
+	for (unsigned int index : indices) {
+		start[elementOfVertex[index] + 1]++;
+	}
+	for (unsigned int i = 0; i < elementNum; i++) {
+		start[i + 1] += start[i];
+	}
+	corners.resize(indices.size());
+	vector<unsigned int> cursor(start.begin(), start.end() - 1);
+	for (unsigned int c = 0; c < indices.size(); c++) {
+		corners[cursor[elementOfVertex[indices[c]]]++] = c;
+	}
+}
+
+// vertex of every corner of one position: the first normal a vertex gets is written into it,
+// a corner with a different one gets a copy numbered from next, or counts it when vertices is NULL,
+// gives the number of copies
+unsigned int splitCorners(const unsigned int* corners, unsigned int cornerNum, const vec3* cornerNormals,
+	unsigned int* indices, vector<Vertex>* vertices, unsigned int next, vector<NormalSplit>& splits) {
+	splits.clear();
+	unsigned int copyNum = 0;
+	for (unsigned int k = 0; k < cornerNum; k++) {
+		unsigned int c = corners[k];
+		unsigned int source = indices[c];
+		const vec3& normal = cornerNormals[c];
+		bool used = false;
+		int match = -1;
+		for (int s = 0; s < splits.size() && match < 0; s++) {
+			if (splits[s].source != source)
+				continue;
+			used = true;
+			// a fraction of a degree apart, the same normal
+			if (dot(splits[s].normal, normal) > 0.9999f || splits[s].normal == normal)
+				match = s;
+		}
+		if (match >= 0) {
+			if (vertices != NULL)
+				indices[c] = splits[match].vertex;
+			continue;
+		}
+
+		NormalSplit split;
+		split.source = source;
+		split.normal = normal;
+		if (!used) {
+			split.vertex = source;
+			if (vertices != NULL)
+				(*vertices)[source].Normal = normal;
+		}
+		else {
+			split.vertex = next + copyNum++;
+			if (vertices != NULL) {
+				(*vertices)[split.vertex] = (*vertices)[source];
+				(*vertices)[split.vertex].Normal = normal;
+				indices[c] = split.vertex;
+			}
+		}
+		splits.push_back(split);
+	}
+	return copyNum;
+}
+
+// vertex normals of an indexed triangle mesh, overwrites Normal
+// faces get their normals on the thread pool, then every position sums the weighted normals
+// of the faces around it, positions are independent and summed on the pool as well
+// with a crease angle below 180 a corner only sums the faces close enough to its own, and a
+// vertex whose corners get different normals is split, the new vertices go after the others
+void generateNormals(vector<Vertex>& vertices, vector<unsigned int>& indices, const NormalSettings& settings) {
+	TraceZone zone("generateNormals");
+	if (vertices.empty() || indices.size() < 3)
+		return;
+	indices.resize(indices.size() / 3 * 3);
+	vector<vec3> faceNormals, cornerWeights;
+	computeFaceNormals(vertices, indices, settings.angleWeighted, faceNormals, cornerWeights);
+
+	vector<unsigned int> positionIds;
+	unsigned int positionNum = weldPositions(vertices, positionIds);
+	vector<unsigned int> cornerStart, positionCorners;
+	groupCorners(positionIds, indices, positionNum, cornerStart, positionCorners);
+	const vec3* face = &faceNormals[0];
+	const float* weight = &cornerWeights[0].x;
+	const unsigned int* corners = &positionCorners[0];
+
+	if (settings.creaseAngle >= 180) {
+		Vertex* v = &vertices[0];
+		const unsigned int* index = &indices[0];
+		ThreadPool::instance().parallelFor(positionNum, [&, v, index](int begin, int end) {
+			for (int p = begin; p < end; p++) {
+				vec3 sum(0);
+				for (unsigned int k = cornerStart[p]; k < cornerStart[p + 1]; k++) {
+					sum += face[corners[k] / 3] * weight[corners[k]];
+				}
+				vec3 normal = safeNormalize(sum);
+				for (unsigned int k = cornerStart[p]; k < cornerStart[p + 1]; k++) {
+					v[index[corners[k]]].Normal = normal;
+				}
+			}
+		}, 4096);
+		return;
+	}
+
+	// normal of every corner, then the copies each position needs are counted so they can be
+	// numbered before they are written
+	float minCos = cos(radians(glm::max(settings.creaseAngle, 0.0f)));
+	vector<vec3> cornerNormals(indices.size());
+	vector<unsigned int> copyStart(positionNum + 1, 0);
+	ThreadPool::instance().parallelFor(positionNum, [&](int begin, int end) {
+		vector<NormalSplit> splits;
+		for (int p = begin; p < end; p++) {
+			for (unsigned int k = cornerStart[p]; k < cornerStart[p + 1]; k++) {
+				// a degenerate face has no direction to compare, its corners are smoothed over all
+				const vec3& own = face[corners[k] / 3];
+				bool degenerate = own == vec3(0);
+				vec3 sum(0);
+				for (unsigned int j = cornerStart[p]; j < cornerStart[p + 1]; j++) {
+					const vec3& other = face[corners[j] / 3];
+					if (degenerate || dot(own, other) >= minCos)
+						sum += other * weight[corners[j]];
+				}
+				cornerNormals[corners[k]] = safeNormalize(sum);
+			}
+			copyStart[p + 1] = splitCorners(corners + cornerStart[p], cornerStart[p + 1] - cornerStart[p], &cornerNormals[0],
+				&indices[0], NULL, 0, splits);
+		}
+	}, 4096);
+	for (unsigned int p = 0; p < positionNum; p++) {
+		copyStart[p + 1] += copyStart[p];
+	}
+
+	unsigned int originalNum = vertices.size();
+	vertices.resize(originalNum + copyStart[positionNum]);
+	ThreadPool::instance().parallelFor(positionNum, [&](int begin, int end) {
+		vector<NormalSplit> splits;
+		for (int p = begin; p < end; p++) {
+			splitCorners(corners + cornerStart[p], cornerStart[p + 1] - cornerStart[p], &cornerNormals[0],
+				&indices[0], &vertices, originalNum + copyStart[p], splits);
+		}
+	}, 4096);
+}
+
+// tangent of every vertex for normal mapping, xyz points along increasing u and w is the sign
+// of the bitangent, the normals have to be there already
+// built like MikkTSpace builds them: the tangent and bitangent of every face are projected into
+// the plane of the vertex normal, normalized and summed weighted by the corner angle, the sign
+// comes from the summed bitangent; where the uv mapping mirrors the corners of a vertex disagree
+// on the sign and the vertex is split, the new vertices go after the others
+void generateTangents(vector<Vertex>& vertices, vector<unsigned int>& indices, vector<vec4>& tangents) {
+	TraceZone zone("generateTangents");
+	size_t faceNum = indices.size() / 3;
+	if (faceNum == 0) {
+		tangents.assign(vertices.size(), vec4(1, 0, 0, 1));
+		return;
+	}
+	indices.resize(faceNum * 3);
+
+	// directions of increasing u and v on every face, zero where the uvs are degenerate
+	vector<vec3> faceTangents(faceNum), faceBitangents(faceNum), angles(faceNum);
+	const Vertex* v = &vertices[0];
+	ThreadPool::instance().parallelFor(faceNum, [&, v](int begin, int end) {
+		for (int f = begin; f < end; f++) {
+			const Vertex& a = v[indices[f * 3]];
+			const Vertex& b = v[indices[f * 3 + 1]];
+			const Vertex& c = v[indices[f * 3 + 2]];
+			vec3 e1 = b.Position - a.Position;
+			vec3 e2 = c.Position - a.Position;
+			vec2 d1 = b.TexCoord - a.TexCoord;
+			vec2 d2 = c.TexCoord - a.TexCoord;
+			float uvArea = d1.x * d2.y - d2.x * d1.y;
+			bool degenerate = !(length(cross(e1, e2)) > 0);
+			if (degenerate || uvArea == 0) {
+				faceTangents[f] = vec3(0);
+				faceBitangents[f] = vec3(0);
+				angles[f] = vec3(0);
+				continue;
+			}
+			// only the direction matters, the sign of the uv area instead of the division
+			float sign = uvArea > 0 ? 1.0f : -1.0f;
+			faceTangents[f] = (e1 * d2.y - e2 * d1.y) * sign;
+			faceBitangents[f] = (e2 * d1.x - e1 * d2.x) * sign;
+			angles[f] = cornerAngles(a.Position, b.Position, c.Position);
+		}
+	}, 16384);
+
+	unsigned int originalNum = vertices.size();
+	vector<unsigned int> identity(originalNum);
+	for (unsigned int i = 0; i < originalNum; i++) {
+		identity[i] = i;
+	}
+	vector<unsigned int> cornerStart, vertexCorners;
+	groupCorners(identity, indices, originalNum, cornerStart, vertexCorners);
+
+	// sign of every corner, 0 on faces without uv directions, they go with either side;
+	// a vertex with corners of both signs gets one copy, counted first so it can be numbered
+	vector<signed char> cornerSigns(indices.size());
+	vector<unsigned int> copyStart(originalNum + 1, 0);
+	ThreadPool::instance().parallelFor(originalNum, [&, v](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			vec3 n = v[i].Normal;
+			bool positive = false, negative = false;
+			for (unsigned int k = cornerStart[i]; k < cornerStart[i + 1]; k++) {
+				unsigned int c = vertexCorners[k];
+				const vec3& t = faceTangents[c / 3];
+				float handedness = dot(cross(n, t), faceBitangents[c / 3]);
+				cornerSigns[c] = t == vec3(0) ? 0 : handedness < 0 ? -1 : 1;
+				positive |= cornerSigns[c] > 0;
+				negative |= cornerSigns[c] < 0;
+			}
+			copyStart[i + 1] = positive && negative ? 1 : 0;
+		}
+	}, 16384);
+	for (unsigned int i = 0; i < originalNum; i++) {
+		copyStart[i + 1] += copyStart[i];
+	}
+
+	// the corners with the sign of the first signed corner keep the vertex, the others move to the copy
+	if (copyStart[originalNum] > 0) {
+		vertices.resize(originalNum + copyStart[originalNum]);
+		Vertex* out = &vertices[0];
+		ThreadPool::instance().parallelFor(originalNum, [&, out](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				if (copyStart[i + 1] == copyStart[i])
+					continue;
+				unsigned int copy = originalNum + copyStart[i];
+				out[copy] = out[i];
+				signed char kept = 0;
+				for (unsigned int k = cornerStart[i]; k < cornerStart[i + 1]; k++) {
+					unsigned int c = vertexCorners[k];
+					if (kept == 0)
+						kept = cornerSigns[c];
+					if (cornerSigns[c] != 0 && cornerSigns[c] != kept)
+						indices[c] = copy;
+				}
+			}
+		}, 16384);
+		identity.resize(vertices.size());
+		for (unsigned int i = originalNum; i < identity.size(); i++) {
+			identity[i] = i;
+		}
+		groupCorners(identity, indices, vertices.size(), cornerStart, vertexCorners);
+		v = &vertices[0];
+	}
+
+	tangents.assign(vertices.size(), vec4(1, 0, 0, 1));
+	vec4* out = &tangents[0];
+	ThreadPool::instance().parallelFor(vertices.size(), [&, v, out](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			vec3 n = v[i].Normal;
+			vec3 tangent(0), bitangent(0);
+			for (unsigned int k = cornerStart[i]; k < cornerStart[i + 1]; k++) {
+				unsigned int c = vertexCorners[k];
+				float w = angles[c / 3][c % 3];
+				const vec3& t = faceTangents[c / 3];
+				const vec3& b = faceBitangents[c / 3];
+				tangent += safeNormalize(t - n * dot(n, t)) * w;
+				bitangent += safeNormalize(b - n * dot(n, b)) * w;
+			}
+			tangent = safeNormalize(tangent - n * dot(n, tangent));
+			// any direction in the plane of the normal when the uvs give none
+			if (tangent == vec3(0)) {
+				vec3 axis = abs(n.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+				tangent = safeNormalize(axis - n * dot(n, axis));
+			}
+			out[i] = vec4(tangent, dot(cross(n, tangent), bitangent) < 0 ? -1.0f : 1.0f);
+		}
+	}, 16384);
+}
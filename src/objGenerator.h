@@ -0,0 +1,230 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace glm;
+
+// what ObjGenerator writes
+struct ObjGeneratorSettings {
+	// total, split evenly between the meshes, rounded up to whole quads
+	long long triangles = 100000;
+	int meshes = 16;
+	int materials = 4;
+	// 0 for untextured materials, material i uses texture i % textures
+	int textures = 4;
+	int textureSize = 512;
+	// share of triangles indexing the vertices of their grid, the others get 3 vertices of their own
+	float vertexSharing = 1;
+	// share of the textures with a translucent alpha channel, the materials using them are blended
+	float transparency = 0;
+	unsigned int seed = 1;
+};
+
+// writes a reproducible OBJ/MTL set with TGA textures for scaling tests: every mesh is a
+// rippled grid patch, the patches are laid out side by side on a square
+// files are streamed, so the triangle count is only limited by disk space
+class ObjGenerator {
+public:
+	ObjGenerator(const ObjGeneratorSettings& settings) {
+		this->settings = settings;
+		this->settings.meshes = glm::max(settings.meshes, 1);
+		this->settings.materials = glm::max(settings.materials, 1);
+		this->settings.textures = glm::max(settings.textures, 0);
+		this->settings.textureSize = glm::max(settings.textureSize, 1);
+	}
+
+	// objPath ends with .obj, the .mtl and textures are written next to it
+	bool write(const string& objPath) {
+		size_t nameStart = objPath.find_last_of("/\\") + 1;
+		directory = objPath.substr(0, nameStart);
+		name = objPath.substr(nameStart, objPath.find_last_of('.') - nameStart);
+		random.seed(settings.seed);
+
+		for (int i = 0; i < settings.textures; i++) {
+			if (!writeTexture(i))
+				return false;
+		}
+		if (!writeMaterials())
+			return false;
+		if (!writeMeshes(objPath))
+			return false;
+
+		cout << "generated " << objPath << ": " << written << " triangles, " << settings.meshes << " meshes, "
+			<< settings.materials << " materials, " << settings.textures << " textures" << endl;
+		return true;
+	}
+
+private:
+	ObjGeneratorSettings settings;
+	string directory;
+	string name;
+	mt19937 random;
+	long long written = 0;
+
+	string textureName(int index) {
+		return name + "_tex" + to_string(index) + ".tga";
+	}
+
+	bool isTranslucent(int textureIndex) {
+		return textureIndex < (int)round(settings.transparency * settings.textures);
+	}
+
+	// uncompressed 32 bit tga, top row first, read by stb_image
+	bool writeTexture(int index) {
+		string path = directory + textureName(index);
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == NULL) {
+			cout << "can not write " << path << endl;
+			return false;
+		}
+
+		int size = settings.textureSize;
+		unsigned char header[18] = {};
+		header[2] = 2;
+		header[12] = size & 0xff;
+		header[13] = (size >> 8) & 0xff;
+		header[14] = size & 0xff;
+		header[15] = (size >> 8) & 0xff;
+		header[16] = 32;
+		// 8 alpha bits, top left origin
+		header[17] = 0x28;
+		fwrite(header, 1, sizeof(header), file);
+
+		// checker pattern in a color of its own, translucent ones fade between 30% and 70% alpha
+		uniform_int_distribution<int> channel(64, 255);
+		int color[3] = { channel(random), channel(random), channel(random) };
+		bool translucent = isTranslucent(index);
+		int cell = glm::max(size / 8, 1);
+		vector<unsigned char> row(size * 4);
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				bool dark = ((x / cell) + (y / cell)) % 2 == 1;
+				unsigned char* pixel = &row[x * 4];
+				// bgra
+				for (int c = 0; c < 3; c++) {
+					pixel[2 - c] = (unsigned char)(dark ? color[c] / 2 : color[c]);
+				}
+				pixel[3] = translucent ? (unsigned char)(77 + 102 * x / glm::max(size - 1, 1)) : 255;
+			}
+			fwrite(&row[0], 1, row.size(), file);
+		}
+		fclose(file);
+		return true;
+	}
+
+	bool writeMaterials() {
+		string path = directory + name + ".mtl";
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == NULL) {
+			cout << "can not write " << path << endl;
+			return false;
+		}
+
+		uniform_real_distribution<float> unit(0.2f, 1.0f);
+		for (int i = 0; i < settings.materials; i++) {
+			fprintf(file, "newmtl %s_mat%d\n", name.c_str(), i);
+			fprintf(file, "Kd %.3f %.3f %.3f\n", unit(random), unit(random), unit(random));
+			fprintf(file, "Ks 0.5 0.5 0.5\n");
+			fprintf(file, "Ns %d\n", 8 << (i % 4));
+			if (settings.textures > 0)
+				fprintf(file, "map_Kd %s\n", textureName(i % settings.textures).c_str());
+			fprintf(file, "\n");
+		}
+		fclose(file);
+		return true;
+	}
+
+	bool writeMeshes(const string& objPath) {
+		FILE* file = fopen(objPath.c_str(), "w");
+		if (file == NULL) {
+			cout << "can not write " << objPath << endl;
+			return false;
+		}
+		// large writes, the file can be gigabytes
+		vector<char> buffer(1 << 20);
+		setvbuf(file, &buffer[0], _IOFBF, buffer.size());
+
+		fprintf(file, "# generated: %lld triangles, %d meshes, %d materials, %d textures of %d, sharing %.2f, transparency %.2f, seed %u\n",
+			settings.triangles, settings.meshes, settings.materials, settings.textures, settings.textureSize,
+			settings.vertexSharing, settings.transparency, settings.seed);
+		fprintf(file, "mtllib %s.mtl\n", name.c_str());
+
+		long long quadsPerMesh = glm::max((settings.triangles / settings.meshes + 1) / 2, 1LL);
+		int meshColumns = (int)ceil(sqrt((double)settings.meshes));
+		uniform_real_distribution<float> unit(0.0f, 1.0f);
+		// 1 based and shared by v, vt and vn
+		long long vertexBase = 1;
+
+		for (int m = 0; m < settings.meshes; m++) {
+			fprintf(file, "o %s_mesh%d\n", name.c_str(), m);
+			fprintf(file, "usemtl %s_mat%d\n", name.c_str(), m % settings.materials);
+
+			// unit patch of the scene square
+			vec2 origin = vec2(m % meshColumns, m / meshColumns);
+			long long columns = (long long)ceil(sqrt((double)quadsPerMesh));
+			long long rows = (quadsPerMesh + columns - 1) / columns;
+			for (long long z = 0; z <= rows; z++) {
+				for (long long x = 0; x <= columns; x++) {
+					writeVertex(file, origin, vec2((float)x / columns, (float)z / rows));
+				}
+			}
+
+			long long gridBase = vertexBase;
+			vertexBase += (columns + 1) * (rows + 1);
+			for (long long q = 0; q < quadsPerMesh; q++) {
+				long long x = q % columns, z = q / columns;
+				long long corners[4] = {
+					gridBase + z * (columns + 1) + x,
+					gridBase + z * (columns + 1) + x + 1,
+					gridBase + (z + 1) * (columns + 1) + x + 1,
+					gridBase + (z + 1) * (columns + 1) + x,
+				};
+				// counter clockwise seen from above
+				long long triangles[2][3] = { { corners[0], corners[3], corners[2] }, { corners[0], corners[2], corners[1] } };
+				for (auto& triangle : triangles) {
+					if (unit(random) >= settings.vertexSharing) {
+						// own copies of the corners
+						for (int c = 0; c < 3; c++) {
+							long long local = triangle[c] - gridBase;
+							writeVertex(file, origin, vec2((float)(local % (columns + 1)) / columns, (float)(local / (columns + 1)) / rows));
+							triangle[c] = vertexBase++;
+						}
+					}
+					fprintf(file, "f %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\n", triangle[0], triangle[0], triangle[0],
+						triangle[1], triangle[1], triangle[1], triangle[2], triangle[2], triangle[2]);
+					written++;
+				}
+			}
+		}
+
+		bool ok = !ferror(file);
+		fclose(file);
+		if (!ok)
+			cout << "writing " << objPath << " failed" << endl;
+		return ok;
+	}
+
+	// position, texture coordinate and normal of a point of a patch, uv in [0, 1]
+	void writeVertex(FILE* file, vec2 origin, vec2 uv) {
+		const float frequency = 6.283f * 2;
+		const float amplitude = 0.05f;
+		vec2 pos = origin + uv * 0.9f;
+		float height = amplitude * sin(pos.x * frequency) * cos(pos.y * frequency);
+		// gradient of the height
+		float dx = amplitude * frequency * cos(pos.x * frequency) * cos(pos.y * frequency);
+		float dz = -amplitude * frequency * sin(pos.x * frequency) * sin(pos.y * frequency);
+		vec3 normal = normalize(vec3(-dx, 1, -dz));
+
+		fprintf(file, "v %.5f %.5f %.5f\n", pos.x, height, pos.y);
+		fprintf(file, "vt %.5f %.5f\n", uv.x, uv.y);
+		fprintf(file, "vn %.4f %.4f %.4f\n", normal.x, normal.y, normal.z);
+	}
+};
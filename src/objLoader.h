@@ -0,0 +1,648 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <atomic>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+#include "mappedFile.h"
+#include "mesh.h"
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// material of a .mtl file, defaults are those of assimp's obj importer so both paths look the same
+struct ObjMaterial {
+	vec3 diffuse = vec3(0.6f);
+	vec3 specular = vec3(0);
+	float shininess = 0;
+	// file names relative to the model, empty when not set
+	string diffuseTexture;
+	string specularTexture;
+};
+
+// faces of one object and material, vertices are unique per position, uv and normal
+struct ObjMesh {
+	string name;
+	// index into ObjLoader::materials, -1 for the default material
+	int material = -1;
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	// false when a face corner has no vn, the normals of the mesh are generated then
+	bool hasNormals = true;
+	bool hasTexCoords = false;
+};
+
+// .obj and .mtl reader: the mapped file is split into line aligned chunks, the chunks are
+// counted and then parsed on the thread pool, every chunk writing its v/vt/vn lines straight
+// into the shared arrays, faces are fan triangulated and deduplicated per mesh
+// meshes are split by object (o and g) and material like assimp does
+class ObjLoader {
+public:
+	vector<ObjMesh> meshes;
+	vector<ObjMaterial> materials;
+
+	// parse the file and its material libraries, false when it can not be read or is not
+	// valid obj, buildMeshes fills meshes afterwards
+	bool load(const string& path) {
+		TraceZone zone("ObjLoader::load", path.c_str());
+		if (!file.open(path)) {
+			cout << "can not read " << path << endl;
+			return false;
+		}
+
+		splitChunks();
+		ThreadPool& pool = ThreadPool::instance();
+		{
+			TraceZone countZone("ObjLoader::countLines");
+			pool.parallelFor(chunks.size(), [this](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					countLines(chunks[i]);
+				}
+			}, 1);
+		}
+
+		// chunk counts to offsets into the shared arrays
+		size_t positionNum = 0, texCoordNum = 0, normalNum = 0;
+		for (Chunk& chunk : chunks) {
+			size_t counts[3] = { chunk.positionBase, chunk.texCoordBase, chunk.normalBase };
+			chunk.positionBase = positionNum;
+			chunk.texCoordBase = texCoordNum;
+			chunk.normalBase = normalNum;
+			positionNum += counts[0];
+			texCoordNum += counts[1];
+			normalNum += counts[2];
+		}
+		positions.resize(positionNum);
+		texCoords.resize(texCoordNum);
+		normals.resize(normalNum);
+
+		atomic<bool> valid(true);
+		{
+			TraceZone parseZone("ObjLoader::parseChunks");
+			pool.parallelFor(chunks.size(), [this, &valid](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					if (!parseChunk(chunks[i]))
+						valid = false;
+				}
+			}, 1);
+		}
+		if (!valid) {
+			cout << path << " has faces referring to missing vertices" << endl;
+			return false;
+		}
+
+		// material libraries are resolved next to the model
+		string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		for (Chunk& chunk : chunks) {
+			for (const string& library : chunk.materialLibraries) {
+				loadMaterials(directory + library);
+			}
+		}
+
+		file.close();
+		return true;
+	}
+
+	// group the faces by object and material and deduplicate their vertices, meshes by thread
+	void buildMeshes() {
+		TraceZone zone("ObjLoader::buildMeshes");
+
+		// segments in file order decide the object and material of every corner
+		vector<vector<CornerSpan>> meshSpans;
+		map<pair<string, string>, int> meshIndices;
+		string object, material;
+		for (const Chunk& chunk : chunks) {
+			for (size_t s = 0; s < chunk.segments.size(); s++) {
+				const Segment& segment = chunk.segments[s];
+				if (segment.setsObject)
+					object = segment.object;
+				if (segment.setsMaterial)
+					material = segment.material;
+
+				size_t end = s + 1 < chunk.segments.size() ? chunk.segments[s + 1].firstCorner : chunk.corners.size();
+				if (end == segment.firstCorner)
+					continue;
+
+				pair<string, string> key = make_pair(object, material);
+				auto found = meshIndices.find(key);
+				int meshIndex;
+				if (found == meshIndices.end()) {
+					meshIndex = meshes.size();
+					meshIndices[key] = meshIndex;
+					meshes.push_back(ObjMesh());
+					meshes.back().name = object;
+					auto materialIndex = materialIndices.find(material);
+					meshes.back().material = materialIndex != materialIndices.end() ? materialIndex->second : -1;
+					meshSpans.push_back(vector<CornerSpan>());
+				}
+				else {
+					meshIndex = found->second;
+				}
+				CornerSpan span = { &chunk, segment.firstCorner, end };
+				meshSpans[meshIndex].push_back(span);
+			}
+		}
+
+		ThreadPool::instance().parallelFor(meshes.size(), [this, &meshSpans](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				deduplicate(meshSpans[i], meshes[i]);
+			}
+		}, 1);
+
+		// only the meshes are needed from here on
+		vector<Chunk>().swap(chunks);
+		vector<vec3>().swap(positions);
+		vector<vec2>().swap(texCoords);
+		vector<vec3>().swap(normals);
+	}
+
+	size_t getFileSize() {
+		return fileSize;
+	}
+
+private:
+	// zero based indices into the shared arrays, -1 when the face has none
+	struct Corner {
+		int position;
+		int texCoord;
+		int normal;
+	};
+
+	// faces from firstCorner on belong to the object and material set here, or to those
+	// of the segment before when not set
+	struct Segment {
+		size_t firstCorner;
+		bool setsObject = false;
+		bool setsMaterial = false;
+		string object;
+		string material;
+	};
+
+	struct Chunk {
+		const char* begin;
+		const char* end;
+		// line counts after the counting pass, then offsets into the shared arrays
+		size_t positionBase = 0;
+		size_t texCoordBase = 0;
+		size_t normalBase = 0;
+		vector<Corner> corners;
+		vector<Segment> segments;
+		vector<string> materialLibraries;
+	};
+
+	// deduplication table slot, vertex EMPTY_SLOT when free
+	struct Entry {
+		Corner corner;
+		unsigned int vertex;
+	};
+	static const unsigned int EMPTY_SLOT = 0xffffffff;
+
+	// corners of one mesh, spread over chunks
+	struct CornerSpan {
+		const Chunk* chunk;
+		size_t begin;
+		size_t end;
+	};
+
+	enum LineType { LINE_OTHER, LINE_POSITION, LINE_TEXCOORD, LINE_NORMAL, LINE_FACE, LINE_OBJECT, LINE_MATERIAL, LINE_LIBRARY };
+
+	MappedFile file;
+	size_t fileSize = 0;
+	vector<Chunk> chunks;
+	vector<vec3> positions;
+	vector<vec2> texCoords;
+	vector<vec3> normals;
+	map<string, int> materialIndices;
+
+	void splitChunks() {
+		const char* data = file.getData();
+		fileSize = file.getSize();
+
+		// a few chunks per thread so uneven chunks even out, but not tiny ones
+		const size_t minChunkSize = 1 << 20;
+		size_t chunkNum = (size_t)(ThreadPool::instance().workerCount() + 1) * 4;
+		chunkNum = glm::max(glm::min(chunkNum, fileSize / minChunkSize), (size_t)1);
+
+		const char* end = data + fileSize;
+		const char* begin = data;
+		for (size_t i = 1; i <= chunkNum && begin < end; i++) {
+			const char* chunkEnd = i == chunkNum ? end : data + fileSize * i / chunkNum;
+			if (chunkEnd < begin)
+				chunkEnd = begin;
+			// lines stay whole, the chunk ends after a newline
+			const char* newline = chunkEnd < end ? (const char*)memchr(chunkEnd, '\n', end - chunkEnd) : NULL;
+			chunkEnd = newline != NULL ? newline + 1 : end;
+
+			Chunk chunk;
+			chunk.begin = begin;
+			chunk.end = chunkEnd;
+			chunks.push_back(chunk);
+			begin = chunkEnd;
+		}
+	}
+
+	static bool isBlank(char c) {
+		return c == ' ' || c == '\t';
+	}
+
+	static const char* skipBlanks(const char* p, const char* end) {
+		while (p < end && isBlank(*p))
+			p++;
+		return p;
+	}
+
+	static const char* lineEnd(const char* p, const char* end) {
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		return newline != NULL ? newline : end;
+	}
+
+	static bool startsWord(const char* p, const char* end, const char* word, size_t length) {
+		return (size_t)(end - p) > length && memcmp(p, word, length) == 0 && isBlank(p[length]);
+	}
+
+	// p at the first non blank character of a line, moved past the keyword
+	static LineType lineType(const char*& p, const char* end) {
+		if (end - p < 2)
+			return LINE_OTHER;
+		switch (p[0]) {
+		case 'v':
+			if (isBlank(p[1])) {
+				p += 1;
+				return LINE_POSITION;
+			}
+			if (end - p > 2 && isBlank(p[2])) {
+				p += 2;
+				if (p[-1] == 't')
+					return LINE_TEXCOORD;
+				if (p[-1] == 'n')
+					return LINE_NORMAL;
+			}
+			return LINE_OTHER;
+		case 'f':
+			if (isBlank(p[1])) {
+				p += 1;
+				return LINE_FACE;
+			}
+			return LINE_OTHER;
+		case 'o':
+		case 'g':
+			if (isBlank(p[1])) {
+				p += 1;
+				return LINE_OBJECT;
+			}
+			return LINE_OTHER;
+		case 'u':
+			if (startsWord(p, end, "usemtl", 6)) {
+				p += 6;
+				return LINE_MATERIAL;
+			}
+			return LINE_OTHER;
+		case 'm':
+			if (startsWord(p, end, "mtllib", 6)) {
+				p += 6;
+				return LINE_LIBRARY;
+			}
+			return LINE_OTHER;
+		}
+		return LINE_OTHER;
+	}
+
+	void countLines(Chunk& chunk) {
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* line = skipBlanks(p, chunk.end);
+			LineType type = lineType(line, chunk.end);
+			if (type == LINE_POSITION)
+				chunk.positionBase++;
+			else if (type == LINE_TEXCOORD)
+				chunk.texCoordBase++;
+			else if (type == LINE_NORMAL)
+				chunk.normalBase++;
+			p = lineEnd(line, chunk.end) + 1;
+		}
+	}
+
+	// decimal float with optional sign, fraction and exponent, no locale and no allocation
+	static const char* parseFloat(const char* p, const char* end, float& value) {
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		p = skipBlanks(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+
+		unsigned long long mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++) {
+			// digits past 19 do not fit and do not matter for a float
+			if (digits++ < 19)
+				mantissa = mantissa * 10 + (*p - '0');
+			else
+				exponent++;
+		}
+		if (p < end && *p == '.') {
+			for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+				if (digits++ < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+				}
+			}
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			p++;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+')) {
+				negativeExponent = *p == '-';
+				p++;
+			}
+			int e = 0;
+			for (; p < end && *p >= '0' && *p <= '9'; p++) {
+				if (e < 10000)
+					e = e * 10 + (*p - '0');
+			}
+			exponent += negativeExponent ? -e : e;
+		}
+
+		double result = (double)mantissa;
+		if (exponent < 0)
+			result = exponent >= -22 ? result / powers[-exponent] : result * pow(10.0, exponent);
+		else if (exponent > 0)
+			result = exponent <= 22 ? result * powers[exponent] : result * pow(10.0, exponent);
+		value = (float)(negative ? -result : result);
+
+		// skip what is left of an unusual token (nan, inf)
+		while (p < end && !isBlank(*p) && *p != '\n' && *p != '\r')
+			p++;
+		return p;
+	}
+
+	static const char* parseInt(const char* p, const char* end, long long& value) {
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+		value = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++) {
+			value = value * 10 + (*p - '0');
+		}
+		if (negative)
+			value = -value;
+		return p;
+	}
+
+	// obj indices are 1 based, or negative from the last element read
+	static int resolveIndex(long long index, size_t readNum, size_t totalNum, bool& valid) {
+		long long resolved = index > 0 ? index - 1 : (long long)readNum + index;
+		if (index == 0 || resolved < 0 || resolved >= (long long)totalNum) {
+			valid = false;
+			return -1;
+		}
+		return (int)resolved;
+	}
+
+	// rest of the line without surrounding blanks
+	static string lineText(const char* p, const char* end) {
+		p = skipBlanks(p, end);
+		while (end > p && (isBlank(end[-1]) || end[-1] == '\r'))
+			end--;
+		return string(p, end);
+	}
+
+	bool parseChunk(Chunk& chunk) {
+		size_t positionNum = chunk.positionBase;
+		size_t texCoordNum = chunk.texCoordBase;
+		size_t normalNum = chunk.normalBase;
+		bool valid = true;
+		vector<Corner> polygon;
+
+		// faces before the first o, g or usemtl of the chunk continue the chunk before
+		chunk.segments.push_back(Segment());
+		chunk.segments.back().firstCorner = 0;
+
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* line = skipBlanks(p, chunk.end);
+			LineType type = lineType(line, chunk.end);
+			const char* end = lineEnd(line, chunk.end);
+
+			if (type == LINE_POSITION) {
+				vec3& position = positions[positionNum++];
+				line = parseFloat(line, end, position.x);
+				line = parseFloat(line, end, position.y);
+				parseFloat(line, end, position.z);
+			}
+			else if (type == LINE_TEXCOORD) {
+				vec2& texCoord = texCoords[texCoordNum++];
+				line = parseFloat(line, end, texCoord.x);
+				parseFloat(line, end, texCoord.y);
+			}
+			else if (type == LINE_NORMAL) {
+				vec3& normal = normals[normalNum++];
+				line = parseFloat(line, end, normal.x);
+				line = parseFloat(line, end, normal.y);
+				parseFloat(line, end, normal.z);
+			}
+			else if (type == LINE_FACE) {
+				polygon.clear();
+				line = skipBlanks(line, end);
+				while (line < end && *line != '\r') {
+					Corner corner = { -1, -1, -1 };
+					long long index;
+					line = parseInt(line, end, index);
+					corner.position = resolveIndex(index, positionNum, positions.size(), valid);
+					if (line < end && *line == '/') {
+						line++;
+						if (line < end && *line != '/') {
+							line = parseInt(line, end, index);
+							corner.texCoord = resolveIndex(index, texCoordNum, texCoords.size(), valid);
+						}
+						if (line < end && *line == '/') {
+							line = parseInt(line + 1, end, index);
+							corner.normal = resolveIndex(index, normalNum, normals.size(), valid);
+						}
+					}
+					polygon.push_back(corner);
+					while (line < end && !isBlank(*line) && *line != '\r')
+						line++;
+					line = skipBlanks(line, end);
+				}
+				// fan, like aiProcess_Triangulate for convex polygons
+				for (size_t i = 2; i < polygon.size(); i++) {
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+					chunk.corners.push_back(polygon[i]);
+				}
+			}
+			else if (type == LINE_OBJECT || type == LINE_MATERIAL) {
+				if (chunk.segments.back().firstCorner != chunk.corners.size()) {
+					chunk.segments.push_back(Segment());
+					chunk.segments.back().firstCorner = chunk.corners.size();
+				}
+				Segment& segment = chunk.segments.back();
+				if (type == LINE_OBJECT) {
+					segment.setsObject = true;
+					segment.object = lineText(line, end);
+				}
+				else {
+					segment.setsMaterial = true;
+					segment.material = lineText(line, end);
+				}
+			}
+			else if (type == LINE_LIBRARY) {
+				chunk.materialLibraries.push_back(lineText(line, end));
+			}
+			p = end + 1;
+		}
+		return valid;
+	}
+
+	void loadMaterials(const string& path) {
+		ifstream mtlFile(path);
+		if (!mtlFile) {
+			cout << "can not read material library " << path << endl;
+			return;
+		}
+
+		int current = -1;
+		string line;
+		while (getline(mtlFile, line)) {
+			const char* p = skipBlanks(line.c_str(), line.c_str() + line.size());
+			const char* end = line.c_str() + line.size();
+			string keyword;
+			while (p < end && !isBlank(*p) && *p != '\r')
+				keyword += *p++;
+
+			if (keyword == "newmtl") {
+				string name = lineText(p, end);
+				if (materialIndices.find(name) == materialIndices.end()) {
+					materialIndices[name] = materials.size();
+					materials.push_back(ObjMaterial());
+				}
+				current = materialIndices[name];
+				continue;
+			}
+			if (current < 0)
+				continue;
+
+			ObjMaterial* material = &materials[current];
+			if (keyword == "Kd" || keyword == "Ks") {
+				vec3& color = keyword == "Kd" ? material->diffuse : material->specular;
+				p = parseFloat(p, end, color.r);
+				p = parseFloat(p, end, color.g);
+				parseFloat(p, end, color.b);
+			}
+			else if (keyword == "Ns") {
+				parseFloat(p, end, material->shininess);
+			}
+			else if (keyword == "map_Kd") {
+				material->diffuseTexture = textureName(p, end);
+			}
+			else if (keyword == "map_Ks") {
+				material->specularTexture = textureName(p, end);
+			}
+		}
+	}
+
+	// file name of a map_ line, options such as -bm 1 come before it
+	static string textureName(const char* p, const char* end) {
+		string text = lineText(p, end);
+		if (text.empty() || text[0] != '-')
+			return text;
+		size_t lastBlank = text.find_last_of(" \t");
+		return lastBlank == string::npos ? text : text.substr(lastBlank + 1);
+	}
+
+	// one vertex per distinct position, uv and normal triple, through an open addressing table
+	void deduplicate(const vector<CornerSpan>& spans, ObjMesh& mesh) {
+		TraceZone zone("ObjLoader::deduplicate", mesh.name.c_str());
+		size_t cornerNum = 0;
+		for (const CornerSpan& span : spans) {
+			cornerNum += span.end - span.begin;
+		}
+		mesh.indices.reserve(cornerNum);
+
+		// grows to stay at most half full, starts at a guess of a few corners per vertex
+		size_t capacity = 1024;
+		while (capacity < cornerNum / 2)
+			capacity *= 2;
+		vector<Entry> table;
+		resizeTable(table, capacity);
+
+		for (const CornerSpan& span : spans) {
+			for (size_t c = span.begin; c < span.end; c++) {
+				const Corner& corner = span.chunk->corners[c];
+				size_t slot = hashCorner(corner) & (capacity - 1);
+				while (table[slot].vertex != EMPTY_SLOT && !sameCorner(table[slot].corner, corner))
+					slot = (slot + 1) & (capacity - 1);
+
+				unsigned int vertex = table[slot].vertex;
+				if (vertex == EMPTY_SLOT) {
+					vertex = mesh.vertices.size();
+					table[slot].corner = corner;
+					table[slot].vertex = vertex;
+					mesh.vertices.push_back(makeVertex(corner));
+					if (corner.normal < 0)
+						mesh.hasNormals = false;
+					if (corner.texCoord >= 0)
+						mesh.hasTexCoords = true;
+					if (mesh.vertices.size() * 2 > capacity) {
+						capacity *= 2;
+						resizeTable(table, capacity);
+					}
+				}
+				mesh.indices.push_back(vertex);
+			}
+		}
+	}
+
+	static void resizeTable(vector<Entry>& table, size_t capacity) {
+		vector<Entry> resized(capacity);
+		for (Entry& entry : resized) {
+			entry.vertex = EMPTY_SLOT;
+		}
+		for (const Entry& entry : table) {
+			if (entry.vertex == EMPTY_SLOT)
+				continue;
+			size_t slot = hashCorner(entry.corner) & (capacity - 1);
+			while (resized[slot].vertex != EMPTY_SLOT)
+				slot = (slot + 1) & (capacity - 1);
+			resized[slot] = entry;
+		}
+		table.swap(resized);
+	}
+
+	static size_t hashCorner(const Corner& corner) {
+		unsigned long long h = (unsigned long long)(unsigned int)corner.position * 0x9E3779B97F4A7C15ULL;
+		h ^= (unsigned long long)(unsigned int)corner.texCoord * 0xC2B2AE3D27D4EB4FULL;
+		h ^= (unsigned long long)(unsigned int)corner.normal * 0x165667B19E3779F9ULL;
+		return (size_t)(h ^ (h >> 29));
+	}
+
+	static bool sameCorner(const Corner& a, const Corner& b) {
+		return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+	}
+
+	Vertex makeVertex(const Corner& corner) {
+		Vertex vertex;
+		vertex.Position = positions[corner.position];
+		vertex.Normal = corner.normal >= 0 ? normals[corner.normal] : vec3(0);
+		// flipped like aiProcess_FlipUVs
+		vertex.TexCoord = corner.texCoord >= 0 ? vec2(texCoords[corner.texCoord].x, 1 - texCoords[corner.texCoord].y) : vec2(0);
+		return vertex;
+	}
+};
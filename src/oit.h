@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#include "shader.h"
+#include "stats.h"
+
+using namespace std;
+
+// weighted blended order independent transparency (McGuire & Bavoil 2013)
+// translucent meshes accumulate into two float targets in any order, then one
+// full screen pass resolves them over the opaque image
+//
+// GL 3.3 has no per target blend function, so both targets share
+// glBlendFuncSeparate(ONE, ONE, ZERO, ONE_MINUS_SRC_ALPHA):
+//   accum.rgb  = sum(color * alpha * weight)
+//   accum.a    = product(1 - alpha), the revealage, cleared to 1
+//   weight.r   = sum(alpha * weight)
+class OitTarget {
+public:
+	OitTarget() {
+		compositeShader = new Shader("shaders/fullscreen_vt.glsl", "shaders/oit_fg.glsl");
+		glGenVertexArrays(1, &quadVAO);
+	}
+
+	~OitTarget() {
+		releaseTargets();
+		glDeleteVertexArrays(1, &quadVAO);
+		glDeleteProgram(compositeShader->ID);
+		delete compositeShader;
+	}
+
+	// redirect drawing into the accumulation targets, depth is copied from the current framebuffer
+	void begin() {
+		// before createTargets, which leaves framebuffer 0 bound
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] != width || viewport[3] != height)
+			createTargets(viewport[2], viewport[3]);
+
+		// opaque depth, so translucent surfaces behind it are rejected
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, targetFBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		float accumClear[] = { 0, 0, 0, 1 };
+		float weightClear[] = { 0, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, accumClear);
+		glClearBufferfv(GL_COLOR, 1, weightClear);
+
+		glEnable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+		glDepthMask(GL_FALSE);
+	}
+
+	// resolve the accumulated layers over the framebuffer that was bound in begin
+	void composite() {
+		glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDisable(GL_DEPTH_TEST);
+
+		compositeShader->use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accumTex);
+		compositeShader->setInt("accumTex", 0);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, weightTex);
+		compositeShader->setInt("weightTex", 1);
+
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+
+		glActiveTexture(GL_TEXTURE0);
+		glEnable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+	}
+
+private:
+	Shader* compositeShader;
+	unsigned int quadVAO;
+
+	unsigned int FBO = 0;
+	unsigned int accumTex = 0;
+	unsigned int weightTex = 0;
+	unsigned int depthRBO = 0;
+	int width = 0;
+	int height = 0;
+
+	// framebuffer the result is composited into
+	int targetFBO = 0;
+
+	void createTargets(int width, int height) {
+		releaseTargets();
+		this->width = width;
+		this->height = height;
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		accumTex = createTexture(GL_RGBA16F, GL_RGBA);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTex, 0);
+		weightTex = createTexture(GL_R16F, GL_RED);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightTex, 0);
+
+		// same format as the default framebuffer, required by the depth blit
+		glGenRenderbuffers(1, &depthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		frameStats.textureBytes += targetMemory();
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+		unsigned int drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, drawBuffers);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			cout << "oit framebuffer is not complete" << endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	unsigned int createTexture(GLenum internalFormat, GLenum format) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return texture;
+	}
+
+	// accum RGBA16F, weight R16F and depth
+	long long targetMemory() {
+		return textureMemory(width, height, 8 + 2 + 4);
+	}
+
+	void releaseTargets() {
+		if (FBO == 0)
+			return;
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteTextures(1, &accumTex);
+		glDeleteTextures(1, &weightTex);
+		glDeleteRenderbuffers(1, &depthRBO);
+		frameStats.textureBytes -= targetMemory();
+		FBO = 0;
+	}
+};
@@ -4,151 +4,68 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <vector>
-
+#include "camera.h"
+#include "shader.h"
+#include "light.h"
 #include "global.h"
 
 using namespace std;
 
+// ground plane with grid lines, one quad generated in the vertex shader,
+// lines are computed per fragment in shaders/grid_fg.glsl
 class Plain {
 public:
 	Plain(float plainSize = 50, float lineInterval = 1, float lineWidth = 0.1) {
 		this->plainSize = plainSize;
 		this->lineWidth = lineWidth;
 		this->lineInterval = lineInterval;
-		setupPlainVAO();
-		setupLineVAO();
+		this->shader = new Shader("shaders/grid_vt.glsl", "shaders/grid_fg.glsl");
+
+		// core profile needs a bound VAO even without vertex attributes
+		glGenVertexArrays(1, &VAO);
 	}
-	void draw(Shader* shader) {
-		glDepthFunc(GL_ALWAYS);
 
-		shader->setMat4("modelMat", glm::mat4(1));
-		Material mat;
+	~Plain() {
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteProgram(shader->ID);
+		delete shader;
+	}
 
-		// plain
-		glBindVertexArray(plainVAO);
-		unsigned int texUnit = 0;
-		mat.diffuse_color = plainColor;
-		shader->setDiffuse(mat, texUnit);
-		shader->setSpecular(mat, texUnit);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+	void draw(Camera* camera, LightSet* lights, vec3 fogColor) {
+		shader->use();
+		shader->setVec3("viewPos", camera->getViewPos());
+		shader->setMat4("viewMat", camera->getViewMat());
+		shader->setMat4("projectMat", camera->getProjectMat());
+		shader->setVec3("fog_color", fogColor);
+		// infinite plane follows the camera and reaches the far plane
+		shader->setFloat("plainSize", infinite ? camera->getFarPlane() : plainSize);
+		shader->setBool("followView", infinite);
+		shader->setFloat("lineInterval", lineInterval);
+		shader->setFloat("lineWidth", lineWidth);
+		shader->setVec3("plainColor", plainColor);
+		lights->setupLights(shader);
+
+		glBindVertexArray(VAO);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindVertexArray(0);
+	}
 
-		// line
-		glBindVertexArray(lineVAO);
-		texUnit = 0;
-		glDisable(GL_CULL_FACE);
-		mat.diffuse_color = vec3(1);
-		shader->setDiffuse(mat, texUnit);
-		shader->setSpecular(mat, texUnit);
-		glDrawElements(GL_TRIANGLES, 6*lineCount, GL_UNSIGNED_INT, (void*)0);
-		glEnable(GL_CULL_FACE);
+	bool isInfinite() {
+		return infinite;
+	}
 
-		glDepthFunc(GL_LESS);
+	void setInfinite(bool infinite) {
+		this->infinite = infinite;
 	}
+
 private:
 	const vec3 plainColor = vec3(22.0f / 256, 121.0f / 256, 113.0f / 256);
 
 	float plainSize;
 	float lineWidth;
 	float lineInterval;
-	unsigned int plainVAO;
-	unsigned int lineVAO;
-	int lineCount;
-
-	void setupPlainVAO() {
-		float vertices[] = {
-			// pos						// normal
-			-plainSize, 0, -plainSize,  0,1,0,
-			plainSize,  0, -plainSize,	0,1,0,
-			-plainSize, 0, plainSize,	0,1,0,
-			plainSize,  0, plainSize,	0,1,0,
-		};
-
-		unsigned int elements[] = {
-			0, 2, 1,
-			1, 2, 3,
-		};
-
-		glGenVertexArrays(1, &plainVAO);
-		glBindVertexArray(plainVAO);
-
-		unsigned int VBO;
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)(sizeof(float)*3));
-
-		unsigned int EBO;
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 6, &elements, GL_STATIC_DRAW);
-	}
+	bool infinite = false;
 
-	void setupLineVAO() {
-		lineCount = 0;
-
-		vector<glm::vec3> vertices;
-		vector<glm::uvec3> indices;
-
-		float hlw = lineWidth / 2;
-		for(float x = -plainSize + lineInterval; x <= plainSize - (lineInterval/2); x += lineInterval) {
-			// z direction line
-			vertices.push_back(glm::vec3(x-hlw, 0, -plainSize));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(x+hlw, 0, -plainSize));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(x-hlw, 0, plainSize));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(x+hlw, 0, plainSize));
-			vertices.push_back(glm::vec3(0, 1, 0));
-
-			// x direction line
-			vertices.push_back(glm::vec3(-plainSize, 0, x-hlw));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(plainSize, 0, x-hlw));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(-plainSize, 0, x+hlw));
-			vertices.push_back(glm::vec3(0, 1, 0));
-			vertices.push_back(glm::vec3(plainSize, 0, x+hlw));
-			vertices.push_back(glm::vec3(0, 1, 0));
-
-			lineCount += 2;
-		}
-
-		int indOffset = 0;
-		for (float x = -plainSize + lineInterval; x <= plainSize - (lineInterval / 2); x += lineInterval) {
-			// z direction line
-			indices.push_back(glm::uvec3(indOffset + 0, indOffset + 2, indOffset + 1));
-			indices.push_back(glm::uvec3(indOffset + 1, indOffset + 2, indOffset + 3));
-			indOffset += 4;
-
-			// x direction line
-			indices.push_back(glm::uvec3(indOffset + 0, indOffset + 2, indOffset + 1));
-			indices.push_back(glm::uvec3(indOffset + 1, indOffset + 2, indOffset + 3));
-			indOffset += 4;
-		}
-
-
-		glGenVertexArrays(1, &lineVAO);
-		glBindVertexArray(lineVAO);
-
-		unsigned int VBO;
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * vertices.size(), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
-
-		unsigned int EBO;
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3) * indices.size(), glm::value_ptr(indices[0]), GL_STATIC_DRAW);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)(sizeof(float)*3));
-	}
+	Shader* shader;
+	unsigned int VAO;
 };
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// GL_ARB_get_program_binary, core in 4.1, not part of the 3.3 glad loader
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+// linked programs saved to disk, keyed by a hash of their sources and the driver,
+// so later launches skip compile and link
+class ProgramBinaryCache {
+public:
+	// statistics of this launch
+	int hits = 0;
+	int misses = 0;
+	int rejected = 0;
+	// time spent building programs in ms, with or without the cache
+	float buildMs = 0;
+
+	ProgramBinaryCache(string directory = "shader_cache") {
+		this->directory = directory;
+	}
+
+	// load entry points, the cache stays disabled when the driver does not support binaries
+	void init(GLADloadproc loader) {
+		getProgramBinary = (PFNGLGETPROGRAMBINARYPROC)loader("glGetProgramBinary");
+		programBinary = (PFNGLPROGRAMBINARYPROC)loader("glProgramBinary");
+		programParameteri = (PFNGLPROGRAMPARAMETERIPROC)loader("glProgramParameteri");
+
+		int formatNum = 0;
+		if (hasExtension("GL_ARB_get_program_binary") || GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatNum);
+
+		enabled = getProgramBinary && programBinary && programParameteri && formatNum > 0;
+		if (!enabled) {
+			cout << "program binary cache not supported by driver" << endl;
+			return;
+		}
+
+		driver = string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+		makeDirectory(directory);
+	}
+
+	bool isEnabled() {
+		return enabled;
+	}
+
+	// key of a program: sources with defines inserted, feedback varyings and driver
+	unsigned long long programKey(const vector<pair<GLenum, string>>& stages, const vector<string>& feedbackVaryings) {
+		unsigned long long hash = FNV_OFFSET;
+		hash = fnv1a(hash, driver);
+		for (auto& stage : stages) {
+			hash = fnv1a(hash, to_string(stage.first));
+			hash = fnv1a(hash, stage.second);
+		}
+		for (const string& varying : feedbackVaryings) {
+			hash = fnv1a(hash, varying);
+		}
+		return hash;
+	}
+
+	// call before glLinkProgram, so the driver keeps a retrievable binary
+	void prepareLink(unsigned int program) {
+		if (enabled)
+			programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// try to link program from the cached binary, false when missing or rejected
+	bool load(unsigned int program, unsigned long long key) {
+		if (!enabled)
+			return false;
+
+		ifstream file(entryPath(key), ios::binary);
+		if (!file) {
+			misses++;
+			return false;
+		}
+
+		Header header;
+		file.read((char*)&header, sizeof(header));
+		vector<char> binary;
+		bool valid = file && memcmp(header.magic, MAGIC, 4) == 0 && header.key == key && header.length > 0;
+		if (valid) {
+			binary.resize(header.length);
+			file.read(&binary[0], header.length);
+			valid = file.gcount() == header.length;
+		}
+		file.close();
+
+		int linked = 0;
+		if (valid) {
+			programBinary(program, header.format, &binary[0], header.length);
+			glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		}
+
+		// a driver update invalidates binaries, drop the entry and compile from source
+		if (!linked) {
+			rejected++;
+			remove(entryPath(key).c_str());
+			return false;
+		}
+		hits++;
+		return true;
+	}
+
+	void store(unsigned int program, unsigned long long key) {
+		if (!enabled)
+			return;
+
+		Header header;
+		memcpy(header.magic, MAGIC, 4);
+		header.key = key;
+		int length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		vector<char> binary(length);
+		GLsizei written = 0;
+		getProgramBinary(program, length, &written, &header.format, &binary[0]);
+		header.length = written;
+
+		ofstream file(entryPath(key), ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write(&binary[0], written);
+	}
+
+	void printStats() {
+		cout << "shader programs: " << hits << " from binary cache, " << misses + rejected << " compiled";
+		if (rejected > 0)
+			cout << " (" << rejected << " cached binaries rejected)";
+		cout << ", " << buildMs << " ms" << endl;
+	}
+
+private:
+	struct Header {
+		char magic[4];
+		unsigned int format;
+		unsigned long long key;
+		int length;
+	};
+	const char* MAGIC = "OMVB";
+	static const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+	static const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+	string directory;
+	string driver;
+	bool enabled = false;
+
+	PFNGLGETPROGRAMBINARYPROC getProgramBinary = NULL;
+	PFNGLPROGRAMBINARYPROC programBinary = NULL;
+	PFNGLPROGRAMPARAMETERIPROC programParameteri = NULL;
+
+	unsigned long long fnv1a(unsigned long long hash, const string& data) {
+		for (unsigned char c : data) {
+			hash ^= c;
+			hash *= FNV_PRIME;
+		}
+		// separator, so concatenations do not collide
+		hash ^= 0xFF;
+		hash *= FNV_PRIME;
+		return hash;
+	}
+
+	string entryPath(unsigned long long key) {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", key);
+		return directory + "/" + name;
+	}
+
+	bool hasExtension(const char* name) {
+		int extensionNum = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionNum);
+		for (int i = 0; i < extensionNum; i++) {
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	static void makeDirectory(const string& path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+};
+
+ProgramBinaryCache programBinaryCache;
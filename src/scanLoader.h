@@ -0,0 +1,599 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+#include "mappedFile.h"
+#include "mesh.h"
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// value types of ply properties
+enum PlyType {
+	PLY_INVALID,
+	PLY_INT8,
+	PLY_UINT8,
+	PLY_INT16,
+	PLY_UINT16,
+	PLY_INT32,
+	PLY_UINT32,
+	PLY_FLOAT32,
+	PLY_FLOAT64,
+};
+
+// binary little endian .ply reader for scan data: positions, normals and texture coordinates
+// of the vertices and polygon faces, other properties and elements are skipped
+// vertices are converted on the thread pool straight into the final array, triangle faces
+// are too when every face has 3 corners, pages already converted leave the resident set
+class PlyLoader {
+public:
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	bool hasNormals = false;
+	bool hasTexCoords = false;
+
+	// false when the file can not be read, is not binary little endian or its faces refer to
+	// missing vertices, assimp takes those
+	bool load(const string& path) {
+		TraceZone zone("PlyLoader::load", path.c_str());
+		if (!file.open(path)) {
+			cout << "can not read " << path << endl;
+			return false;
+		}
+		data = (const unsigned char*)file.getData();
+		size = file.getSize();
+		size_t offset;
+		if (!readHeader(offset)) {
+			cout << path << " is not a binary little endian ply file" << endl;
+			return false;
+		}
+
+		for (Element& element : elements) {
+			bool read;
+			if (element.name == "vertex")
+				read = readVertices(element, offset);
+			else if (element.name == "face")
+				read = readFaces(element, offset);
+			else
+				read = skipElement(element, offset);
+			if (!read) {
+				cout << path << " has invalid " << element.name << " data" << endl;
+				return false;
+			}
+		}
+		fileSize = size;
+		file.close();
+		return true;
+	}
+
+	size_t getFileSize() {
+		return fileSize;
+	}
+
+private:
+	struct Property {
+		string name;
+		PlyType type;
+		// list properties have a count of countType in front of their values
+		bool isList = false;
+		PlyType countType = PLY_INVALID;
+	};
+
+	struct Element {
+		string name;
+		size_t count;
+		vector<Property> properties;
+	};
+
+	MappedFile file;
+	const unsigned char* data;
+	size_t size;
+	size_t fileSize = 0;
+	vector<Element> elements;
+
+	static PlyType parseType(const string& name) {
+		if (name == "char" || name == "int8")
+			return PLY_INT8;
+		if (name == "uchar" || name == "uint8")
+			return PLY_UINT8;
+		if (name == "short" || name == "int16")
+			return PLY_INT16;
+		if (name == "ushort" || name == "uint16")
+			return PLY_UINT16;
+		if (name == "int" || name == "int32")
+			return PLY_INT32;
+		if (name == "uint" || name == "uint32")
+			return PLY_UINT32;
+		if (name == "float" || name == "float32")
+			return PLY_FLOAT32;
+		if (name == "double" || name == "float64")
+			return PLY_FLOAT64;
+		return PLY_INVALID;
+	}
+
+	static int typeSize(PlyType type) {
+		switch (type) {
+		case PLY_INT8:
+		case PLY_UINT8:
+			return 1;
+		case PLY_INT16:
+		case PLY_UINT16:
+			return 2;
+		case PLY_INT32:
+		case PLY_UINT32:
+		case PLY_FLOAT32:
+			return 4;
+		case PLY_FLOAT64:
+			return 8;
+		default:
+			return 0;
+		}
+	}
+
+	static double readValue(const unsigned char* p, PlyType type) {
+		switch (type) {
+		case PLY_INT8: return (signed char)*p;
+		case PLY_UINT8: return *p;
+		case PLY_INT16: { short v; memcpy(&v, p, 2); return v; }
+		case PLY_UINT16: { unsigned short v; memcpy(&v, p, 2); return v; }
+		case PLY_INT32: { int v; memcpy(&v, p, 4); return v; }
+		case PLY_UINT32: { unsigned int v; memcpy(&v, p, 4); return v; }
+		case PLY_FLOAT32: { float v; memcpy(&v, p, 4); return v; }
+		case PLY_FLOAT64: { double v; memcpy(&v, p, 8); return v; }
+		default: return 0;
+		}
+	}
+
+	// indices are read as unsigned, a negative one fails the range check
+	static unsigned int readIndex(const unsigned char* p, PlyType type) {
+		if (type == PLY_UINT32 || type == PLY_INT32) {
+			unsigned int v;
+			memcpy(&v, p, 4);
+			return v;
+		}
+		return (unsigned int)(long long)readValue(p, type);
+	}
+
+	// offset is set to the first byte after end_header
+	bool readHeader(size_t& offset) {
+		const char* text = (const char*)data;
+		const char* end = NULL;
+		const char* marker = "end_header";
+		// the header is text and short, it is searched in the first 64 KB
+		size_t limit = std::min(size, (size_t)65536);
+		for (size_t i = 0; i + 10 <= limit; i++) {
+			if (memcmp(text + i, marker, 10) == 0) {
+				end = text + i + 10;
+				break;
+			}
+		}
+		if (size < 4 || memcmp(text, "ply", 3) != 0 || end == NULL)
+			return false;
+		// the header line ends with \n, sometimes \r\n
+		if (end < text + size && *end == '\r')
+			end++;
+		if (end >= text + size || *end != '\n')
+			return false;
+		offset = end + 1 - text;
+
+		istringstream header(string(text, end));
+		string line;
+		bool littleEndian = false;
+		while (getline(header, line)) {
+			istringstream words(line);
+			string keyword;
+			words >> keyword;
+			if (keyword == "format") {
+				string format;
+				words >> format;
+				littleEndian = format == "binary_little_endian";
+			}
+			else if (keyword == "element") {
+				Element element;
+				words >> element.name >> element.count;
+				elements.push_back(element);
+			}
+			else if (keyword == "property") {
+				if (elements.empty())
+					return false;
+				Property property;
+				string type;
+				words >> type;
+				if (type == "list") {
+					string countType;
+					words >> countType >> type;
+					property.isList = true;
+					property.countType = parseType(countType);
+					if (property.countType == PLY_INVALID)
+						return false;
+				}
+				property.type = parseType(type);
+				words >> property.name;
+				if (property.type == PLY_INVALID)
+					return false;
+				elements.back().properties.push_back(property);
+			}
+		}
+		return littleEndian;
+	}
+
+	// size of every instance of an element, 0 when it has list properties
+	static size_t fixedStride(const Element& element) {
+		size_t stride = 0;
+		for (const Property& property : element.properties) {
+			if (property.isList)
+				return 0;
+			stride += typeSize(property.type);
+		}
+		return stride;
+	}
+
+	// byte offset of a property in a fixed stride element, -1 when it does not have it
+	static int propertyOffset(const Element& element, const char* const* names) {
+		int offset = 0;
+		for (const Property& property : element.properties) {
+			for (const char* const* name = names; *name != NULL; name++) {
+				if (property.name == *name)
+					return offset;
+			}
+			offset += typeSize(property.type);
+		}
+		return -1;
+	}
+
+	static PlyType propertyType(const Element& element, int offset) {
+		int current = 0;
+		for (const Property& property : element.properties) {
+			if (current == offset)
+				return property.type;
+			current += typeSize(property.type);
+		}
+		return PLY_INVALID;
+	}
+
+	bool skipElement(const Element& element, size_t& offset) {
+		size_t stride = fixedStride(element);
+		if (stride > 0) {
+			offset += stride * element.count;
+			return offset <= size;
+		}
+		for (size_t i = 0; i < element.count; i++) {
+			for (const Property& property : element.properties) {
+				if (!skipProperty(property, offset))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	bool skipProperty(const Property& property, size_t& offset) {
+		size_t count = 1;
+		if (property.isList) {
+			if (offset + typeSize(property.countType) > size)
+				return false;
+			count = (size_t)readValue(data + offset, property.countType);
+			offset += typeSize(property.countType);
+		}
+		offset += count * typeSize(property.type);
+		return offset <= size;
+	}
+
+	bool readVertices(const Element& element, size_t& offset) {
+		size_t stride = fixedStride(element);
+		if (stride == 0 || offset + stride * element.count > size)
+			return false;
+
+		static const char* const xNames[] = { "x", NULL };
+		static const char* const yNames[] = { "y", NULL };
+		static const char* const zNames[] = { "z", NULL };
+		static const char* const nxNames[] = { "nx", NULL };
+		static const char* const nyNames[] = { "ny", NULL };
+		static const char* const nzNames[] = { "nz", NULL };
+		static const char* const uNames[] = { "u", "s", "texture_u", "texture_s", NULL };
+		static const char* const vNames[] = { "v", "t", "texture_v", "texture_t", NULL };
+		const char* const* names[8] = { xNames, yNames, zNames, nxNames, nyNames, nzNames, uNames, vNames };
+		int offsets[8];
+		PlyType types[8];
+		for (int i = 0; i < 8; i++) {
+			offsets[i] = propertyOffset(element, names[i]);
+			types[i] = propertyType(element, offsets[i]);
+		}
+		if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0)
+			return false;
+		hasNormals = offsets[3] >= 0 && offsets[4] >= 0 && offsets[5] >= 0;
+		hasTexCoords = offsets[6] >= 0 && offsets[7] >= 0;
+		// the common layout of float positions first is read without conversion
+		bool floatPositions = offsets[0] == 0 && offsets[1] == 4 && offsets[2] == 8 &&
+			types[0] == PLY_FLOAT32 && types[1] == PLY_FLOAT32 && types[2] == PLY_FLOAT32;
+
+		vertices.resize(element.count);
+		const unsigned char* base = data + offset;
+		ThreadPool::instance().parallelFor(element.count, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				const unsigned char* p = base + stride * i;
+				Vertex& vertex = vertices[i];
+				if (floatPositions) {
+					memcpy(&vertex.Position, p, sizeof(vec3));
+				}
+				else {
+					for (int c = 0; c < 3; c++) {
+						vertex.Position[c] = (float)readValue(p + offsets[c], types[c]);
+					}
+				}
+				vertex.Normal = vec3(0);
+				if (hasNormals) {
+					for (int c = 0; c < 3; c++) {
+						vertex.Normal[c] = (float)readValue(p + offsets[3 + c], types[3 + c]);
+					}
+				}
+				vertex.TexCoord = vec2(0);
+				if (hasTexCoords) {
+					// flipped like assimp's aiProcess_FlipUVs
+					vertex.TexCoord.x = (float)readValue(p + offsets[6], types[6]);
+					vertex.TexCoord.y = 1 - (float)readValue(p + offsets[7], types[7]);
+				}
+			}
+			file.discard(offset + stride * begin, stride * (end - begin));
+		}, 65536);
+		offset += stride * element.count;
+		return true;
+	}
+
+	bool readFaces(const Element& element, size_t& offset) {
+		// the corner list, other properties (colors, flags) are skipped
+		int listIndex = -1;
+		for (int i = 0; i < element.properties.size(); i++) {
+			const string& name = element.properties[i].name;
+			if (element.properties[i].isList && (name == "vertex_indices" || name == "vertex_index"))
+				listIndex = i;
+		}
+		if (listIndex < 0)
+			return false;
+
+		const Property& list = element.properties[listIndex];
+		if (element.properties.size() == 1 && readTriangles(element, list, offset))
+			return true;
+
+		// mixed polygons, one after another, fan triangulated
+		indices.clear();
+		indices.reserve(element.count * 3);
+		int countSize = typeSize(list.countType);
+		int indexSize = typeSize(list.type);
+		for (size_t i = 0; i < element.count; i++) {
+			for (int p = 0; p < element.properties.size(); p++) {
+				if (p != listIndex) {
+					if (!skipProperty(element.properties[p], offset))
+						return false;
+					continue;
+				}
+				if (offset + countSize > size)
+					return false;
+				size_t count = (size_t)readValue(data + offset, list.countType);
+				offset += countSize;
+				if (offset + count * indexSize > size)
+					return false;
+				const unsigned char* corners = data + offset;
+				for (size_t c = 2; c < count; c++) {
+					unsigned int triangle[3] = { readIndex(corners, list.type),
+						readIndex(corners + (c - 1) * indexSize, list.type), readIndex(corners + c * indexSize, list.type) };
+					for (unsigned int index : triangle) {
+						if (index >= vertices.size())
+							return false;
+						indices.push_back(index);
+					}
+				}
+				offset += count * indexSize;
+			}
+		}
+		return true;
+	}
+
+	// faces that are all triangles have a fixed stride and are read in parallel, false when
+	// one is not a triangle, nothing is consumed then
+	bool readTriangles(const Element& element, const Property& list, size_t& offset) {
+		int countSize = typeSize(list.countType);
+		int indexSize = typeSize(list.type);
+		size_t stride = countSize + 3 * indexSize;
+		if (offset + stride * element.count > size)
+			return false;
+
+		indices.resize(element.count * 3);
+		const unsigned char* base = data + offset;
+		size_t vertexNum = vertices.size();
+		atomic<bool> triangles(true), valid(true);
+		ThreadPool::instance().parallelFor(element.count, [&](int begin, int end) {
+			for (int i = begin; i < end && triangles; i++) {
+				const unsigned char* p = base + stride * i;
+				if ((size_t)readValue(p, list.countType) != 3) {
+					triangles = false;
+					break;
+				}
+				for (int c = 0; c < 3; c++) {
+					unsigned int index = readIndex(p + countSize + c * indexSize, list.type);
+					if (index >= vertexNum)
+						valid = false;
+					indices[i * 3 + c] = index;
+				}
+			}
+			if (triangles)
+				file.discard(offset + stride * begin, stride * (end - begin));
+		}, 65536);
+		if (!triangles || !valid) {
+			indices.clear();
+			return false;
+		}
+		offset += stride * element.count;
+		return true;
+	}
+};
+
+// binary .stl reader: the unindexed triangles are welded into shared vertices on the thread
+// pool, corners are bucketed by a hash of their position, so every bucket can be welded on
+// its own, then the buckets are laid out one after another
+// facet normals are ignored, normals are computed from the welded mesh
+class StlLoader {
+public:
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	const bool hasNormals = false;
+	const bool hasTexCoords = false;
+
+	// false when the file can not be read or is ascii stl, assimp takes those
+	bool load(const string& path) {
+		TraceZone zone("StlLoader::load", path.c_str());
+		if (!file.open(path)) {
+			cout << "can not read " << path << endl;
+			return false;
+		}
+		data = (const unsigned char*)file.getData();
+		fileSize = file.getSize();
+		// 80 byte header, triangle count and 50 bytes per triangle: normal, 3 corners, attribute
+		if (fileSize >= 84)
+			memcpy(&triangleNum, data + 80, 4);
+		if (fileSize < 84 || fileSize != 84 + (size_t)triangleNum * 50) {
+			cout << path << " is not a binary stl file" << endl;
+			return false;
+		}
+
+		weld();
+		file.close();
+		return true;
+	}
+
+	size_t getFileSize() {
+		return fileSize;
+	}
+
+private:
+	static const int BUCKET_BITS = 8;
+	static const int BUCKET_NUM = 1 << BUCKET_BITS;
+	// triangles per chunk of the counting passes
+	static const int CHUNK_TRIANGLES = 65536;
+
+	MappedFile file;
+	const unsigned char* data;
+	size_t fileSize = 0;
+	unsigned int triangleNum = 0;
+
+	// -0 is welded with 0
+	vec3 cornerPosition(size_t corner) {
+		vec3 position;
+		memcpy(&position, data + 84 + corner / 3 * 50 + 12 + corner % 3 * 12, sizeof(vec3));
+		return position + vec3(0.0f);
+	}
+
+	static size_t hashPosition(const vec3& position) {
+		unsigned int bits[3];
+		memcpy(bits, &position, sizeof(bits));
+		unsigned long long h = bits[0] * 0x9E3779B97F4A7C15ULL;
+		h ^= bits[1] * 0xC2B2AE3D27D4EB4FULL;
+		h ^= bits[2] * 0x165667B19E3779F9ULL;
+		return (size_t)(h ^ (h >> 29));
+	}
+
+	static int bucketOf(size_t hash) {
+		return (int)(hash >> 56) & (BUCKET_NUM - 1);
+	}
+
+	void weld() {
+		TraceZone zone("StlLoader::weld");
+		ThreadPool& pool = ThreadPool::instance();
+		size_t cornerNum = (size_t)triangleNum * 3;
+		int chunkNum = (triangleNum + CHUNK_TRIANGLES - 1) / CHUNK_TRIANGLES;
+
+		// corners per chunk and bucket, then where each chunk writes into each bucket
+		vector<size_t> counts((size_t)chunkNum * BUCKET_NUM, 0);
+		pool.parallelFor(chunkNum, [&](int begin, int end) {
+			for (int chunk = begin; chunk < end; chunk++) {
+				size_t* chunkCounts = &counts[(size_t)chunk * BUCKET_NUM];
+				size_t last = glm::min(cornerNum, (size_t)(chunk + 1) * CHUNK_TRIANGLES * 3);
+				for (size_t corner = (size_t)chunk * CHUNK_TRIANGLES * 3; corner < last; corner++) {
+					chunkCounts[bucketOf(hashPosition(cornerPosition(corner)))]++;
+				}
+			}
+		}, 1);
+		vector<size_t> bucketStart(BUCKET_NUM + 1, 0);
+		size_t total = 0;
+		for (int bucket = 0; bucket < BUCKET_NUM; bucket++) {
+			bucketStart[bucket] = total;
+			for (int chunk = 0; chunk < chunkNum; chunk++) {
+				size_t count = counts[(size_t)chunk * BUCKET_NUM + bucket];
+				counts[(size_t)chunk * BUCKET_NUM + bucket] = total;
+				total += count;
+			}
+		}
+		bucketStart[BUCKET_NUM] = total;
+
+		// corners sorted by bucket, in file order within a bucket
+		vector<unsigned int> bucketCorners(cornerNum);
+		pool.parallelFor(chunkNum, [&](int begin, int end) {
+			for (int chunk = begin; chunk < end; chunk++) {
+				size_t* next = &counts[(size_t)chunk * BUCKET_NUM];
+				size_t last = glm::min(cornerNum, (size_t)(chunk + 1) * CHUNK_TRIANGLES * 3);
+				for (size_t corner = (size_t)chunk * CHUNK_TRIANGLES * 3; corner < last; corner++) {
+					bucketCorners[next[bucketOf(hashPosition(cornerPosition(corner)))]++] = (unsigned int)corner;
+				}
+			}
+		}, 1);
+		vector<size_t>().swap(counts);
+
+		// every bucket welds its corners with a table of its own, indices are local to the
+		// bucket until the vertex counts of all buckets are known
+		indices.resize(cornerNum);
+		vector<vector<unsigned int>> uniqueCorners(BUCKET_NUM);
+		pool.parallelFor(BUCKET_NUM, [&](int begin, int end) {
+			for (int bucket = begin; bucket < end; bucket++) {
+				size_t first = bucketStart[bucket], last = bucketStart[bucket + 1];
+				size_t capacity = 16;
+				while (capacity < (last - first) * 2)
+					capacity *= 2;
+				// local vertex + 1, 0 is empty
+				vector<unsigned int> table(capacity, 0);
+				vector<unsigned int>& unique = uniqueCorners[bucket];
+				for (size_t i = first; i < last; i++) {
+					unsigned int corner = bucketCorners[i];
+					vec3 position = cornerPosition(corner);
+					size_t slot = hashPosition(position) & (capacity - 1);
+					while (table[slot] != 0 && cornerPosition(unique[table[slot] - 1]) != position)
+						slot = (slot + 1) & (capacity - 1);
+					if (table[slot] == 0) {
+						unique.push_back(corner);
+						table[slot] = unique.size();
+					}
+					indices[corner] = table[slot] - 1;
+				}
+			}
+		}, 1);
+
+		vector<size_t> vertexStart(BUCKET_NUM + 1, 0);
+		for (int bucket = 0; bucket < BUCKET_NUM; bucket++) {
+			vertexStart[bucket + 1] = vertexStart[bucket] + uniqueCorners[bucket].size();
+		}
+		vertices.resize(vertexStart[BUCKET_NUM]);
+		pool.parallelFor(BUCKET_NUM, [&](int begin, int end) {
+			for (int bucket = begin; bucket < end; bucket++) {
+				unsigned int base = (unsigned int)vertexStart[bucket];
+				const vector<unsigned int>& unique = uniqueCorners[bucket];
+				for (size_t i = 0; i < unique.size(); i++) {
+					Vertex& vertex = vertices[base + i];
+					vertex.Position = cornerPosition(unique[i]);
+					vertex.Normal = vec3(0);
+					vertex.TexCoord = vec2(0);
+				}
+				for (size_t i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++) {
+					indices[bucketCorners[i]] += base;
+				}
+				vector<unsigned int>().swap(uniqueCorners[bucket]);
+			}
+		}, 1);
+	}
+};
@@ -9,7 +9,13 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <chrono>
 
+#include "programBinary.h"
+#include "stats.h"
+#include "trace.h"
 #include "global.h"
 
 using namespace std;
@@ -21,6 +27,12 @@ public:
 
 	// init shader from file
 	Shader(const char* vertexPath, const char* fragmentPath);
+	// init shader from file, each define ("NAME" or "NAME VALUE") is inserted after #version
+	Shader(const char* vertexPath, const char* fragmentPath, const vector<string>& defines);
+	// init a transform feedback program (no fragment stage), captured varyings are
+	// written interleaved into the buffer bound at index 0
+	// NULL when it does not compile or link, callers fall back to the cpu rather than exit
+	static Shader* createFeedbackShader(const char* vertexPath, const char* geometryPath, const vector<string>& feedbackVaryings);
 	// use this shader
 	void use();
 	
@@ -28,6 +40,7 @@ public:
 	void setBool(const std::string &name, bool value);
 	void setInt(const std::string& name, int value);
 	void setFloat(const std::string& name, float value);
+	void setIntArray(const std::string& name, const int* values, int count);
 
 	void setMat4(const std::string& name, const glm::mat4& mat) {
 		int location = glGetUniformLocation(ID, name.c_str());
@@ -45,9 +58,16 @@ public:
 		glUniform3fv(location, 1, values);
 	}
 
+	void setVec4(const std::string& name, glm::vec4 vec) {
+		int location = glGetUniformLocation(ID, name.c_str());
+		glUseProgram(ID);
+		glUniform4fv(location, 1, glm::value_ptr(vec));
+	}
+
 	void setDiffuse(Material& mat, unsigned int& texUnit) {
 		glActiveTexture(GL_TEXTURE0 + texUnit);
 		glBindTexture(GL_TEXTURE_2D, mat.diffuse_texture);
+		frameStats.textureBinds++;
 		setInt(DIFF_TEX, texUnit);
 		texUnit++;
 
@@ -57,6 +77,7 @@ public:
 	void setSpecular(Material& mat, unsigned int& texUnit) {
 		glActiveTexture(GL_TEXTURE0 + texUnit);
 		glBindTexture(GL_TEXTURE_2D, mat.specular_texture);
+		frameStats.textureBinds++;
 		setInt(SPEC_TEX, texUnit);
 		texUnit++;
 
@@ -74,79 +95,171 @@ private:
 	const string SPEC_SHINE = "mtl.tex_spec_shininess";
 	const string SPEC_SHINE_S = "mtl.tex_spec_scale";
 
+	Shader() {}
+
+	string readSource(const char* path);
+	string insertDefines(const string& source, const vector<string>& defines);
+	// 0 when the source does not compile
+	unsigned int compileShader(GLenum type, const string& source);
+	bool linkProgram(const vector<unsigned int>& shaders, const vector<string>& feedbackVaryings);
+	// link from the program binary cache, or compile and link the stages, false when that fails
+	bool build(const vector<pair<GLenum, string>>& stages, const vector<string>& feedbackVaryings);
 };
 
 Shader::Shader(const char* vertexPath, const char* fragmentPath) {
-	// 1. read source code from files
-	std::string vShaderCodeString;
-	std::string  fShaderCodeString;
-	std::ifstream vShaderFile;
-	std::ifstream fShaderFile;
+	if (!build({ { GL_VERTEX_SHADER, readSource(vertexPath) }, { GL_FRAGMENT_SHADER, readSource(fragmentPath) } }, {}))
+		exit(1);
+}
 
-	vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const vector<string>& defines) {
+	bool built = build({
+		{ GL_VERTEX_SHADER, insertDefines(readSource(vertexPath), defines) },
+		{ GL_FRAGMENT_SHADER, insertDefines(readSource(fragmentPath), defines) }
+	}, {});
+	if (!built)
+		exit(1);
+}
 
-	try {
-		vShaderFile.open(vertexPath);
-		fShaderFile.open(fragmentPath);
+Shader* Shader::createFeedbackShader(const char* vertexPath, const char* geometryPath, const vector<string>& feedbackVaryings) {
+	Shader* shader = new Shader();
+	if (!shader->build({ { GL_VERTEX_SHADER, shader->readSource(vertexPath) }, { GL_GEOMETRY_SHADER, shader->readSource(geometryPath) } }, feedbackVaryings)) {
+		delete shader;
+		return NULL;
+	}
+	return shader;
+}
 
-		std::stringstream vShaderStream, fShaderStream;
-		vShaderStream << vShaderFile.rdbuf();
-		fShaderStream << fShaderFile.rdbuf();
+bool Shader::build(const vector<pair<GLenum, string>>& stages, const vector<string>& feedbackVaryings) {
+	TraceZone zone("Shader::build");
+	auto start = chrono::high_resolution_clock::now();
 
-		vShaderFile.close();
-		fShaderFile.close();
+	unsigned long long key = 0;
+	bool cached = false;
+	if (programBinaryCache.isEnabled()) {
+		key = programBinaryCache.programKey(stages, feedbackVaryings);
+		ID = glCreateProgram();
+		cached = programBinaryCache.load(ID, key);
+		if (!cached)
+			glDeleteProgram(ID);
+	}
 
-		vShaderCodeString = vShaderStream.str();
-		fShaderCodeString = fShaderStream.str();
+	bool built = true;
+	if (!cached) {
+		vector<unsigned int> shaders;
+		for (auto& stage : stages) {
+			unsigned int shader = compileShader(stage.first, stage.second);
+			if (shader != 0)
+				shaders.push_back(shader);
+			else
+				built = false;
+		}
+		if (built)
+			built = linkProgram(shaders, feedbackVaryings);
+		else {
+			for (unsigned int shader : shaders) {
+				glDeleteShader(shader);
+			}
+		}
+		if (built)
+			programBinaryCache.store(ID, key);
+	}
+
+	programBinaryCache.buildMs += chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	return built;
+}
+
+string Shader::readSource(const char* path) {
+	std::ifstream shaderFile;
+	shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+	try {
+		shaderFile.open(path);
+		std::stringstream shaderStream;
+		shaderStream << shaderFile.rdbuf();
+		shaderFile.close();
+		return shaderStream.str();
 	}
 	catch (std::ifstream::failure e) {
-		std::cout << "read shader souce code fail" << std::endl;
+		std::cout << "read shader souce code fail: " << path << std::endl;
+	}
+	return "";
+}
+
+string Shader::insertDefines(const string& source, const vector<string>& defines) {
+	string defineLines;
+	for (const string& define : defines) {
+		defineLines += "#define " + define + "\n";
 	}
-	const char* vShaderCode = vShaderCodeString.c_str();
-	const char* fShaderCode = fShaderCodeString.c_str();
 
-	// 2. compile and link shader
+	// #version has to stay the first line
+	size_t versionEnd = 0;
+	if (source.compare(0, 8, "#version") == 0) {
+		versionEnd = source.find('\n');
+		versionEnd = versionEnd == string::npos ? source.size() : versionEnd + 1;
+	}
+	return source.substr(0, versionEnd) + defineLines + source.substr(versionEnd);
+}
+
+unsigned int Shader::compileShader(GLenum type, const string& source) {
+	TraceZone zone("Shader::compileShader");
 	int success;
 	char infoLog[512];
+	const char* code = source.c_str();
 
-	int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vShaderCode, NULL);
-	glCompileShader(vertexShader);
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+	unsigned int shader = glCreateShader(type);
+	glShaderSource(shader, 1, &code, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+		glGetShaderInfoLog(shader, 512, NULL, infoLog);
 		std::cout << "shader compiling failed\n" << infoLog << std::endl;
+		glDeleteShader(shader);
+		return 0;
 	}
+	return shader;
+}
 
-	int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
-	glCompileShader(fragmentShader);
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		std::cout << "shader compiling failed\n" << infoLog << std::endl;
-		exit(1);
-	}
+bool Shader::linkProgram(const vector<unsigned int>& shaders, const vector<string>& feedbackVaryings) {
+	TraceZone zone("Shader::linkProgram");
+	int success;
+	char infoLog[512];
 
 	ID = glCreateProgram();
-	glAttachShader(ID, vertexShader);
-	glAttachShader(ID, fragmentShader);
+	for (unsigned int shader : shaders) {
+		glAttachShader(ID, shader);
+	}
+
+	// varyings have to be declared before link
+	if (feedbackVaryings.size() > 0) {
+		vector<const char*> names;
+		for (const string& name : feedbackVaryings) {
+			names.push_back(name.c_str());
+		}
+		glTransformFeedbackVaryings(ID, names.size(), &names[0], GL_INTERLEAVED_ATTRIBS);
+	}
+
+	programBinaryCache.prepareLink(ID);
 	glLinkProgram(ID);
 	glGetProgramiv(ID, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(ID, 512, NULL, infoLog);
 		std::cout << "shader program linking failed\n" << infoLog << std::endl;
-		exit(1);
 	}
 
 	// delete shaders after link
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+	for (unsigned int shader : shaders) {
+		glDeleteShader(shader);
+	}
+	if (!success) {
+		glDeleteProgram(ID);
+		ID = 0;
+	}
+	return success;
 }
 
 void Shader::use() {
 	glUseProgram(ID);
+	frameStats.programBinds++;
 }
 
 void Shader::setBool(const std::string& name, bool value) {
@@ -166,3 +279,9 @@ void Shader::setFloat(const std::string& name, float value) {
 	glUseProgram(ID);
 	glUniform1f(location, value);
 }
+
+void Shader::setIntArray(const std::string& name, const int* values, int count) {
+	int location = glGetUniformLocation(ID, name.c_str());
+	glUseProgram(ID);
+	glUniform1iv(location, count, values);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <iostream>
+
+#include "shader.h"
+#include "global.h"
+
+using namespace std;
+
+// compile time features of shaders/fg.glsl, each maps to a #define
+enum ShaderFeature {
+	FEATURE_DIFFUSE_TEX = 1 << 0,	// HAS_DIFFUSE_TEX
+	FEATURE_SPECULAR_TEX = 1 << 1,	// HAS_SPEC_TEX
+	FEATURE_SPECULAR = 1 << 2,		// HAS_SPECULAR, shininess > 0
+	FEATURE_FLIP_Y = 1 << 3,		// FLIP_Y
+	FEATURE_ALPHA_CUTOUT = 1 << 4,	// ALPHA_CUTOUT
+	FEATURE_OIT = 1 << 5,			// OIT_PASS
+	FEATURE_CLUSTERED = 1 << 6,		// CLUSTERED_LIGHTING
+	FEATURE_GBUFFER = 1 << 7,		// GBUFFER_PASS
+};
+
+const char* FEATURE_DEFINES[] = {
+	"HAS_DIFFUSE_TEX",
+	"HAS_SPEC_TEX",
+	"HAS_SPECULAR",
+	"FLIP_Y",
+	"ALPHA_CUTOUT",
+	"OIT_PASS",
+	"CLUSTERED_LIGHTING",
+	"GBUFFER_PASS",
+};
+const int FEATURE_NUM = 8;
+
+// light count is stored above the feature bits
+const int LIGHT_COUNT_SHIFT = 16;
+
+// features decided by a material
+unsigned int materialFeatures(const Material& mat) {
+	unsigned int features = 0;
+	if (mat.diffuse_texture != EMPTY_TEX)
+		features |= FEATURE_DIFFUSE_TEX;
+	if (mat.specular_texture != EMPTY_TEX)
+		features |= FEATURE_SPECULAR_TEX;
+	if (mat.shininess > 0)
+		features |= FEATURE_SPECULAR;
+	return features;
+}
+
+unsigned int shaderKey(unsigned int features, int lightCount) {
+	return features | (lightCount << LIGHT_COUNT_SHIFT);
+}
+
+// variants of one vertex/fragment shader pair, compiled on first use and cached by key
+class ShaderPermutations {
+public:
+	ShaderPermutations(const char* vertexPath, const char* fragmentPath) {
+		this->vertexPath = vertexPath;
+		this->fragmentPath = fragmentPath;
+	}
+
+	// called with a variant the first time it is bound in a frame, to set per frame uniforms
+	void setFrameSetup(function<void(Shader*)> frameSetup) {
+		this->frameSetup = frameSetup;
+	}
+
+	void beginFrame() {
+		frame++;
+	}
+
+	// compile or find the variant, without binding it
+	Shader* get(unsigned int key) {
+		auto it = variants.find(key);
+		if (it != variants.end())
+			return it->second.shader;
+
+		vector<string> defines = keyDefines(key);
+		string name;
+		for (string& define : defines) {
+			name += define + " ";
+		}
+		cout << "compiling shader variant: " << name << endl;
+
+		Variant variant;
+		variant.shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines);
+		variants[key] = variant;
+		return variant.shader;
+	}
+
+	// use the variant, per frame uniforms are set on its first use in a frame
+	Shader* bind(unsigned int key) {
+		Shader* shader = get(key);
+		shader->use();
+
+		Variant& variant = variants[key];
+		if (variant.frame != frame) {
+			variant.frame = frame;
+			if (frameSetup)
+				frameSetup(shader);
+		}
+		return shader;
+	}
+
+	// compile a list of variants ahead of time, so the first frames do not hitch
+	void warmUp(const vector<unsigned int>& keys) {
+		for (unsigned int key : keys) {
+			get(key);
+		}
+	}
+
+	int variantCount() {
+		return variants.size();
+	}
+
+	static vector<string> keyDefines(unsigned int key) {
+		vector<string> defines;
+		for (int i = 0; i < FEATURE_NUM; i++) {
+			if (key & (1 << i))
+				defines.push_back(FEATURE_DEFINES[i]);
+		}
+		defines.push_back("LIGHT_COUNT " + to_string(key >> LIGHT_COUNT_SHIFT));
+		return defines;
+	}
+
+private:
+	struct Variant {
+		Shader* shader;
+		// last frame the per frame uniforms were set
+		int frame = -1;
+	};
+
+	string vertexPath;
+	string fragmentPath;
+	map<unsigned int, Variant> variants;
+	function<void(Shader*)> frameSetup;
+	int frame = 0;
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+
+#include "shader.h"
+#include "light.h"
+#include "model.h"
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+using namespace glm;
+
+// spotlight shadow maps packed into one depth texture, kept bound on SHADOW_TEX_UNIT
+// a map is rendered again only when its light, its tile or the model changed, so a
+// static scene pays for shadows once
+class ShadowAtlas {
+public:
+	// the atlas area is the resolution budget shared by all shadowed lights
+	ShadowAtlas(int size = 2048) {
+		this->size = size;
+
+		glGenTextures(1, &depthTex);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		frameStats.textureBytes += textureMemory(size, size, 4);
+		// hardware comparison, linear filtering makes every tap a 2x2 pcf
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "shadow atlas framebuffer is incomplete" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// shaders sampling the atlas need a depth texture on the unit even without shadows
+		glActiveTexture(GL_TEXTURE0 + SHADOW_TEX_UNIT);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	~ShadowAtlas() {
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteTextures(1, &depthTex);
+		frameStats.textureBytes -= textureMemory(size, size, 4);
+	}
+
+	// render the shadow maps that are out of date, depthShader is the depth pre-pass shader
+	void update(LightSet* lights, Model* model, Shader* depthShader) {
+		TraceZone zone("ShadowAtlas::update");
+		vector<pair<int, int>> tiles = allocateTiles(lights);
+		cached.resize(lights->forwardCount());
+
+		bool rendering = false;
+		int viewport[4];
+		int targetFBO;
+		for (int i = 0; i < lights->forwardCount(); i++) {
+			Light& light = lights->getLight(i);
+			int resolution = tiles[i].second;
+			if (resolution == 0) {
+				light.clearShadow();
+				cached[i].valid = false;
+				continue;
+			}
+			ivec3 tile = ivec3(tileOrigin(tiles[i].first, resolution), resolution);
+
+			CachedShadow state;
+			state.valid = true;
+			state.pos = light.getPos();
+			state.di = light.getDi();
+			state.cutoffCos = light.getCutoffCos();
+			state.range = light.getRange();
+			state.tile = tile;
+			state.model = model;
+			state.modelVersion = model->getVersion();
+			state.modelMat = model->getModelMat();
+			if (cached[i] == state && light.hasShadow())
+				continue;
+			cached[i] = state;
+
+			if (!rendering) {
+				rendering = true;
+				glGetIntegerv(GL_VIEWPORT, viewport);
+				glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+				glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+				glEnable(GL_SCISSOR_TEST);
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(2, 4);
+				depthShader->use();
+			}
+
+			mat4 viewMat, projectMat;
+			lightMatrices(light, viewMat, projectMat);
+			glViewport(tile.x, tile.y, tile.z, tile.z);
+			glScissor(tile.x, tile.y, tile.z, tile.z);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			depthShader->setMat4("viewMat", viewMat);
+			depthShader->setMat4("projectMat", projectMat);
+			model->drawShadow(depthShader);
+			frameStats.shadowUpdates++;
+
+			// ndc to the uv and depth range of the tile
+			float scale = (float)tile.z / size;
+			vec2 offset = vec2(tile.x, tile.y) / (float)size;
+			mat4 tileMat = glm::translate(mat4(1), vec3(offset + scale / 2, 0.5f)) * glm::scale(mat4(1), vec3(scale / 2, scale / 2, 0.5f));
+			// pcf taps are kept half a texel inside the tile
+			float halfTexel = 0.5f / size;
+			light.setShadow(tileMat * projectMat * viewMat, vec4(offset + halfTexel, offset + scale - halfTexel));
+		}
+
+		if (rendering) {
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glDisable(GL_SCISSOR_TEST);
+			glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		}
+	}
+
+	// render every shadow map again on the next update
+	void invalidate() {
+		cached.clear();
+	}
+
+private:
+	int size;
+	unsigned int depthTex;
+	unsigned int FBO;
+
+	// what a shadow map was rendered with
+	struct CachedShadow {
+		bool valid = false;
+		vec3 pos;
+		vec3 di;
+		float cutoffCos;
+		float range;
+		ivec3 tile;
+		Model* model;
+		unsigned int modelVersion;
+		mat4 modelMat;
+
+		bool operator==(const CachedShadow& other) const {
+			return valid && other.valid && pos == other.pos && di == other.di && cutoffCos == other.cutoffCos
+				&& range == other.range && tile == other.tile && model == other.model
+				&& modelVersion == other.modelVersion && modelMat == other.modelMat;
+		}
+	};
+	vector<CachedShadow> cached;
+
+	// (slot, resolution) per forward light, resolution 0 means no shadow
+	// requested resolutions are halved, largest first, until they fit into the atlas
+	vector<pair<int, int>> allocateTiles(LightSet* lights) {
+		vector<pair<int, int>> tiles(lights->forwardCount(), make_pair(0, 0));
+		vector<int> shadowed;
+		long long area = 0;
+		for (int i = 0; i < lights->forwardCount(); i++) {
+			const Light& light = lights->getLight(i);
+			if (!light.isSpotlight() || light.getShadowResolution() <= 0)
+				continue;
+			int resolution = 1;
+			while (resolution * 2 <= std::min(light.getShadowResolution(), size))
+				resolution *= 2;
+			tiles[i].second = resolution;
+			area += (long long)resolution * resolution;
+			shadowed.push_back(i);
+		}
+
+		// largest first, ties by light index so the layout is stable
+		auto larger = [&tiles](int a, int b) {
+			return tiles[a].second != tiles[b].second ? tiles[a].second > tiles[b].second : a < b;
+		};
+		sort(shadowed.begin(), shadowed.end(), larger);
+		while (area > (long long)size * size) {
+			int& resolution = tiles[shadowed[0]].second;
+			area -= (long long)resolution * resolution * 3 / 4;
+			resolution /= 2;
+			sort(shadowed.begin(), shadowed.end(), larger);
+		}
+
+		// power of two squares in decreasing size never overlap along a z-order curve
+		long long used = 0;
+		for (int i : shadowed) {
+			long long tileArea = (long long)tiles[i].second * tiles[i].second;
+			tiles[i].first = (int)(used / tileArea);
+			used += tileArea;
+		}
+		return tiles;
+	}
+
+	// texel origin of the slot-th tile of this resolution along the z-order curve
+	ivec2 tileOrigin(int slot, int resolution) {
+		ivec2 origin = ivec2(0);
+		for (int bit = 0; bit < 16; bit++) {
+			origin.x |= ((slot >> (2 * bit)) & 1) << bit;
+			origin.y |= ((slot >> (2 * bit + 1)) & 1) << bit;
+		}
+		return origin * resolution;
+	}
+
+	void lightMatrices(const Light& light, mat4& viewMat, mat4& projectMat) {
+		vec3 di = light.getDi();
+		vec3 up = abs(di.y) > 0.99f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+		viewMat = glm::lookAt(light.getPos(), light.getPos() + di, up);
+
+		// outer cone, the range of spotlights is unbounded so far is kept to the scene size
+		float angle = glm::min(2 * acos(glm::clamp(light.getCutoffCos(), -1.0f, 1.0f)), radians(170.0f));
+		projectMat = glm::perspective(angle, 1.0f, 0.1f, glm::min(light.getRange(), 100.0f));
+	}
+};
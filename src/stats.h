@@ -0,0 +1,156 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <chrono>
+
+using namespace std;
+
+// counters of the current frame, drawn by the UI
+struct FrameStats {
+	// smoothed frame times in ms
+	float cpuMs = 0;
+	float gpuMs = 0;
+	// unsmoothed, cpu time of this frame and gpu time of the previous one (-1 when not available)
+	float lastCpuMs = 0;
+	float lastGpuMs = -1;
+
+	int drawCalls = 0;
+	int triangles = 0;
+	// triangles of the instances dropped by culling, counted once per frame
+	int trianglesCulled = 0;
+
+	// state changes while drawing meshes
+	int programBinds = 0;
+	int textureBinds = 0;
+	int vertexArrayBinds = 0;
+
+	// gpu memory allocated by the viewer in bytes, render targets count as textures
+	long long textureBytes = 0;
+	long long bufferBytes = 0;
+
+	// smoothed cpu time of the frame stages in ms, ui is drawn after the frame so it lags one frame
+	float cullMs = 0;
+	float shadowMs = 0;
+	float submitMs = 0;
+	float uiMs = 0;
+
+	// raw frame times of the last HISTORY_SIZE frames for the graph, historyPos is the oldest
+	static const int HISTORY_SIZE = 120;
+	float cpuHistory[HISTORY_SIZE] = {};
+	float gpuHistory[HISTORY_SIZE] = {};
+	int historyPos = 0;
+
+	bool depthPrepass = false;
+
+	// lighting
+	int lights = 0;
+	// forward, clustered or deferred
+	const char* lightingPath = "forward";
+	// lights the path shades, forward stops at the size of the uniform array while clustered and
+	// deferred shade all of them, so paths are only compared at equal counts
+	int shadedLights = 0;
+	float lightCullMs = 0;
+	// entries of all per cluster or per mesh light lists
+	int lightRefs = 0;
+	// shadow maps rendered this frame, 0 while the cached maps are valid
+	int shadowUpdates = 0;
+
+	// reset per frame counters
+	void beginFrame() {
+		drawCalls = 0;
+		triangles = 0;
+		trianglesCulled = 0;
+		programBinds = 0;
+		textureBinds = 0;
+		vertexArrayBinds = 0;
+		lightCullMs = 0;
+		lightRefs = 0;
+		shadowUpdates = 0;
+	}
+
+	void addDraw(int triangleNum) {
+		drawCalls++;
+		triangles += triangleNum;
+	}
+
+	// gpuMs is -1 when the timer query had no result
+	void endFrame(float cpuMs, float gpuMs) {
+		lastCpuMs = cpuMs;
+		lastGpuMs = gpuMs;
+		this->cpuMs = smooth(this->cpuMs, cpuMs);
+		if (gpuMs >= 0)
+			this->gpuMs = smooth(this->gpuMs, gpuMs);
+
+		cpuHistory[historyPos] = cpuMs;
+		gpuHistory[historyPos] = glm::max(gpuMs, 0.0f);
+		historyPos = (historyPos + 1) % HISTORY_SIZE;
+	}
+
+	void addStageTime(float& stageMs, float ms) {
+		stageMs = smooth(stageMs, ms);
+	}
+
+private:
+	float smooth(float average, float value) {
+		return average == 0 ? value : average * 0.9f + value * 0.1f;
+	}
+};
+
+FrameStats frameStats;
+
+// size of a texture for the memory stats, a full mip chain adds a third
+long long textureMemory(int width, int height, int bytesPerTexel, bool mipmaps = false) {
+	long long bytes = (long long)width * height * bytesPerTexel;
+	return mipmaps ? bytes * 4 / 3 : bytes;
+}
+
+// gpu time of a frame with GL_TIME_ELAPSED, results are read one frame later so it never stalls
+class GpuTimer {
+public:
+	GpuTimer() {
+		glGenQueries(2, queries);
+	}
+
+	void begin() {
+		glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+	}
+
+	// returns gpu time of the previous frame in ms, or -1 when it is not available yet
+	float end() {
+		glEndQuery(GL_TIME_ELAPSED);
+		started[current] = true;
+		current = 1 - current;
+
+		if (!started[current])
+			return -1;
+		int available = 0;
+		glGetQueryObjectiv(queries[current], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return -1;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &elapsed);
+		return elapsed / 1e6f;
+	}
+
+private:
+	unsigned int queries[2];
+	bool started[2] = { false, false };
+	int current = 0;
+};
+
+// cpu wall time
+class CpuTimer {
+public:
+	void begin() {
+		start = chrono::high_resolution_clock::now();
+	}
+
+	float end() {
+		return chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+private:
+	chrono::high_resolution_clock::time_point start;
+};
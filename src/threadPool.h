@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include "trace.h"
+
+using namespace std;
+
+// fixed set of worker threads shared by culling and loading code
+class ThreadPool {
+public:
+	ThreadPool(int workerNum = 0) {
+		if (workerNum <= 0) {
+			workerNum = (int)thread::hardware_concurrency() - 1;
+		}
+		workerNum = std::max(workerNum, 1);
+		for (int i = 0; i < workerNum; i++) {
+			workers.push_back(thread([this, i]() { workerLoop(i); }));
+		}
+	}
+
+	~ThreadPool() {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCv.notify_all();
+		for (thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	// shared pool, created on first use
+	static ThreadPool& instance() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	int workerCount() {
+		return workers.size();
+	}
+
+	void submit(function<void()> task) {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			tasks.push_back(move(task));
+		}
+		queueCv.notify_one();
+	}
+
+	// run fn(begin, end) over [0, count) in chunks, the calling thread takes part
+	// and keeps draining the queue while waiting, so nested calls do not deadlock
+	void parallelFor(int count, const function<void(int, int)>& fn, int minChunk = 256) {
+		if (count <= 0)
+			return;
+
+		int chunks = std::min((int)workers.size() + 1, (count + minChunk - 1) / minChunk);
+		if (chunks <= 1) {
+			fn(0, count);
+			return;
+		}
+		int chunkSize = (count + chunks - 1) / chunks;
+
+		atomic<int> remaining(chunks - 1);
+		for (int c = 1; c < chunks; c++) {
+			int begin = c * chunkSize;
+			int end = std::min(count, begin + chunkSize);
+			submit([&fn, &remaining, begin, end]() {
+				if (begin < end) {
+					TraceZone zone("ThreadPool::parallelFor chunk");
+					fn(begin, end);
+				}
+				remaining--;
+			});
+		}
+		{
+			TraceZone zone("ThreadPool::parallelFor chunk");
+			fn(0, chunkSize);
+		}
+
+		while (remaining.load() > 0) {
+			if (!runPendingTask())
+				this_thread::yield();
+		}
+	}
+
+private:
+	vector<thread> workers;
+	deque<function<void()>> tasks;
+	mutex queueMutex;
+	condition_variable queueCv;
+	bool stopping = false;
+
+	bool runPendingTask() {
+		function<void()> task;
+		{
+			lock_guard<mutex> lock(queueMutex);
+			if (tasks.empty())
+				return false;
+			task = move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+		return true;
+	}
+
+	void workerLoop(int index) {
+		tracer.setThreadName("worker " + to_string(index));
+		while (true) {
+			function<void()> task;
+			{
+				unique_lock<mutex> lock(queueMutex);
+				queueCv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty())
+					return;
+				task = move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+// text as the inside of a json string: quotes and backslashes escaped, control characters
+// dropped, for the trace and the benchmark results
+inline string jsonEscape(const string& text) {
+	string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		if ((unsigned char)c >= 0x20)
+			escaped += c;
+	}
+	return escaped;
+}
+
+// one finished zone, times in microseconds since the tracer was created
+struct TraceEvent {
+	const char* name;
+	string detail;
+	double start;
+	double duration;
+	int depth;
+};
+
+// zones of one thread, only written by that thread
+struct TraceThread {
+	int id;
+	string name;
+	vector<TraceEvent> events;
+	// zones currently open
+	int depth = 0;
+};
+
+// collects TraceZone timings per thread and writes them as chrome trace events, for
+// chrome://tracing or ui.perfetto.dev, every thread gets its own track
+// start, stop and write are called from the main thread while no parallel work is running
+class Tracer {
+public:
+	Tracer() {
+		origin = chrono::steady_clock::now();
+	}
+
+	// a relaxed load, this is all a zone costs while tracing is off
+	bool isEnabled() {
+		return enabled.load(memory_order_relaxed);
+	}
+
+	// begin a capture, events of the previous one are dropped
+	void start() {
+		lock_guard<mutex> lock(threadsMutex);
+		for (TraceThread* thread : threads) {
+			thread->events.clear();
+		}
+		enabled.store(true);
+	}
+
+	void stop() {
+		enabled.store(false);
+	}
+
+	// track name of the calling thread
+	void setThreadName(const string& name) {
+		currentThread()->name = name;
+	}
+
+	double now() {
+		return chrono::duration<double, micro>(chrono::steady_clock::now() - origin).count();
+	}
+
+	// returns the depth of the new zone
+	int enterZone() {
+		return currentThread()->depth++;
+	}
+
+	void leaveZone(const char* name, const char* detail, double start, int depth) {
+		TraceThread* thread = currentThread();
+		thread->depth--;
+		TraceEvent event;
+		event.name = name;
+		if (detail != NULL)
+			event.detail = detail;
+		event.start = start;
+		event.duration = now() - start;
+		event.depth = depth;
+		thread->events.push_back(event);
+	}
+
+	bool write(const string& path) {
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == NULL) {
+			cout << "can not write trace " << path << endl;
+			return false;
+		}
+
+		lock_guard<mutex> lock(threadsMutex);
+		int eventNum = 0;
+		fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		for (TraceThread* thread : threads) {
+			fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+				thread->id, jsonEscape(thread->name).c_str());
+			fprintf(file, "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+				thread->id, thread->id);
+			for (const TraceEvent& event : thread->events) {
+				fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %d",
+					jsonEscape(event.name).c_str(), thread->id, event.start, event.duration, event.depth);
+				if (!event.detail.empty())
+					fprintf(file, ", \"detail\": \"%s\"", jsonEscape(event.detail).c_str());
+				fprintf(file, "}}");
+				eventNum++;
+			}
+			fprintf(file, "%s\n", thread != threads.back() ? "," : "");
+		}
+		fprintf(file, "]}\n");
+		fclose(file);
+
+		cout << "trace with " << eventNum << " zones written to " << path << endl;
+		return true;
+	}
+
+private:
+	atomic<bool> enabled{ false };
+	chrono::steady_clock::time_point origin;
+	// threads live as long as the program, their records are never released
+	vector<TraceThread*> threads;
+	mutex threadsMutex;
+
+	TraceThread* currentThread() {
+		static thread_local TraceThread* thread = NULL;
+		if (thread == NULL) {
+			lock_guard<mutex> lock(threadsMutex);
+			thread = new TraceThread();
+			thread->id = threads.size();
+			thread->name = "thread " + to_string(thread->id);
+			threads.push_back(thread);
+		}
+		return thread;
+	}
+};
+
+Tracer tracer;
+
+// times the enclosing scope while tracing is on, name has to be a string literal,
+// detail (e.g. a file name) is copied and has to live until the end of the scope
+class TraceZone {
+public:
+	TraceZone(const char* name, const char* detail = NULL) {
+		active = tracer.isEnabled();
+		if (!active)
+			return;
+		this->name = name;
+		this->detail = detail;
+		depth = tracer.enterZone();
+		start = tracer.now();
+	}
+
+	~TraceZone() {
+		if (active)
+			tracer.leaveZone(name, detail, start, depth);
+	}
+
+private:
+	bool active;
+	const char* name;
+	const char* detail;
+	double start;
+	int depth;
+};
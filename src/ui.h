@@ -2,10 +2,15 @@
 
 #include <vector>
 #include <string>
+#include <stdio.h>
 
 #define GLT_IMPLEMENTATION
 #include "gltext.h"
 
+#include "stats.h"
+#include "trace.h"
+#include "frameGraph.h"
+
 using namespace std;
 
 class UI {
@@ -19,8 +24,21 @@ public:
 		addLine("mouse: rotate camera");
 		addLine("LEFT,RIGHT: change model");
 		addLine("Y: texture y axis flip");
-		addLine("B: alpha blending");
-		addLine("H: help info");
+		addLine("B: sorted / order independent blending");
+		addLine("I: instance grid");
+		addLine("G: gpu/cpu instance culling");
+		addLine("F: infinite floor");
+		addLine("P: depth pre-pass");
+		addLine("K: clustered lighting");
+		addLine("R: forward / deferred shading");
+		addLine("L: add/remove 256 point lights");
+		addLine("T: start / write trace");
+		addLine("H: help / performance overlay / hidden");
+
+		for (int i = 0; i < STATS_LINE_NUM; i++) {
+			statsLines.push_back(gltCreateText());
+		}
+		graph = new FrameGraph();
 	}
 
 	~UI() {
@@ -28,14 +46,33 @@ public:
 		for (GLTtext* line : lines) {
 			gltDeleteText(line);
 		}
+		for (GLTtext* line : statsLines) {
+			gltDeleteText(line);
+		}
+		delete graph;
 
 		// Destroy glText
 		gltTerminate();
 	}
 
 	void drawUI() {
-		if (hideHelp)
+		if (mode == MODE_HIDDEN)
 			return;
+		TraceZone zone("UI::drawUI");
+
+		CpuTimer timer;
+		timer.begin();
+
+		// glyph backgrounds are transparent black, without blending every label is a black box;
+		// the passes leave blending off, or set for their own use, so it is set here and restored
+		GLboolean blend = glIsEnabled(GL_BLEND);
+		GLint blendFunc[4];
+		glGetIntegerv(GL_BLEND_SRC_RGB, &blendFunc[0]);
+		glGetIntegerv(GL_BLEND_DST_RGB, &blendFunc[1]);
+		glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendFunc[2]);
+		glGetIntegerv(GL_BLEND_DST_ALPHA, &blendFunc[3]);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 		// Begin text drawing (this for instance calls glUseProgram)
 		gltBeginDraw();
@@ -45,24 +82,77 @@ public:
 		float scale = 1.5;
 		float stride = 15;
 
-		for (GLTtext* line : lines) {
-			gltDrawText2D(line, x, y, scale);
-			y += stride * scale;
+		if (mode == MODE_HELP) {
+			for (GLTtext* line : lines) {
+				gltDrawText2D(line, x, y, scale);
+				y += stride * scale;
+			}
+		}
+		else {
+			updateStatsLines();
+			for (GLTtext* line : statsLines) {
+				gltDrawText2D(line, x, y, scale);
+				y += stride * scale;
+			}
 		}
 
 		// Finish drawing text
 		gltEndDraw();
+
+		glBlendFuncSeparate(blendFunc[0], blendFunc[1], blendFunc[2], blendFunc[3]);
+		if (!blend)
+			glDisable(GL_BLEND);
+
+		if (mode == MODE_STATS)
+			graph->draw(x, y + stride * scale / 2, 360, 120);
+
+		frameStats.addStageTime(frameStats.uiMs, timer.end());
 	}
 
 	void keyPressCallback(GLFWwindow* window, int key, int action) {
 		if (key == GLFW_KEY_H && action == GLFW_PRESS) {
-			hideHelp = !hideHelp;
+			mode = (mode + 1) % MODE_NUM;
 		}
 	}
 
 private:
+	// key help, performance overlay, nothing
+	enum { MODE_HELP, MODE_STATS, MODE_HIDDEN, MODE_NUM };
+	const int STATS_LINE_NUM = 6;
+
 	vector<GLTtext*> lines;
-	bool hideHelp = false;
+	vector<GLTtext*> statsLines;
+	FrameGraph* graph;
+	int mode = MODE_HELP;
+
+	void updateStatsLines() {
+		char text[256];
+		snprintf(text, sizeof(text), "cpu %.2f ms, gpu %.2f ms, %.0f fps",
+			frameStats.cpuMs, frameStats.gpuMs, 1000 / glm::max(glm::max(frameStats.cpuMs, frameStats.gpuMs), 0.001f));
+		gltSetText(statsLines[0], text);
+
+		snprintf(text, sizeof(text), "shadows %.2f ms, culling %.2f ms, submission %.2f ms, ui %.2f ms",
+			frameStats.shadowMs, frameStats.cullMs, frameStats.submitMs, frameStats.uiMs);
+		gltSetText(statsLines[1], text);
+
+		snprintf(text, sizeof(text), "%d draws, %d triangles submitted, %d culled, depth pre-pass %s",
+			frameStats.drawCalls, frameStats.triangles, frameStats.trianglesCulled,
+			frameStats.depthPrepass ? "on" : "off");
+		gltSetText(statsLines[2], text);
+
+		snprintf(text, sizeof(text), "state changes: %d programs, %d textures, %d vertex arrays",
+			frameStats.programBinds, frameStats.textureBinds, frameStats.vertexArrayBinds);
+		gltSetText(statsLines[3], text);
+
+		snprintf(text, sizeof(text), "memory: textures %.1f MB, buffers %.1f MB",
+			frameStats.textureBytes / 1048576.0, frameStats.bufferBytes / 1048576.0);
+		gltSetText(statsLines[4], text);
+
+		snprintf(text, sizeof(text), "%d lights, %d shaded %s, light culling %.3f ms, %d light list entries, %d shadow updates",
+			frameStats.lights, frameStats.shadedLights, frameStats.lightingPath,
+			frameStats.lightCullMs, frameStats.lightRefs, frameStats.shadowUpdates);
+		gltSetText(statsLines[5], text);
+	}
 
 	void addLine(string line) {
 		GLTtext* text = gltCreateText();